@@ -3,14 +3,30 @@
 function build {
 	case $1 in
 		# So far the minimum viable standard is C99
-		"release") GCC_ARGS="-Wall -Wextra -Werror -pedantic --std=c99 -O2" ;;
-		"debug") GCC_ARGS="-Wall -Wextra -pedantic --std=c99 -g" ;;
+		"release") GCC_ARGS="-Wall -Wextra -Werror -pedantic --std=c99 -O2 -pthread" ;;
+		"debug") GCC_ARGS="-Wall -Wextra -pedantic --std=c99 -g -pthread" ;;
 	esac
+	# Counts the allocations for --stats, calls within libc aren't redirected
+	LINK_ARGS="-Wl,--wrap=malloc -Wl,--wrap=calloc -Wl,--wrap=realloc"
+	generate || exit 1
 	build_rec 'src'
 	binfiles=$(find 'bin' -maxdepth 1 -mindepth 1 -type f -name "*.o")
 	binfiles=$(echo "$binfiles" | tr '\n' ' ')
 	echo "Executable: $binfiles -> bin/compiler"
-	gcc $GCC_ARGS -o bin/compiler $binfiles
+	gcc $GCC_ARGS $LINK_ARGS -o bin/compiler $binfiles
+}
+
+function generate {
+	# Regenerate the lexer tables from the token definitions in tokens.h,
+	# only touching the output if it actually changed
+	mkdir -p bin/tools
+	gcc $GCC_ARGS -o bin/tools/lexgen tools/lexgen.c -Iincl || return 1
+	for table in hashmap dfa ; do
+		echo "Generating: tools/lexgen.c -> incl/lexer/$table.c"
+		bin/tools/lexgen $table > bin/tools/$table.c || return 1
+		cmp -s bin/tools/$table.c incl/lexer/$table.c \
+		|| cp bin/tools/$table.c incl/lexer/$table.c
+	done
 }
 
 function build_rec {
@@ -40,6 +56,72 @@ function build_rec {
 	done
 }
 
+function bench {
+	# Link the benchmark against the compiler's objects, leaving out its main,
+	# and run it with the given arguments. Only its results go to stdout.
+	build release >&2 || exit 1
+	binfiles=$(find 'bin' -maxdepth 1 -mindepth 1 -type f -name "*_dir.o")
+	binfiles=$(echo "$binfiles" | tr '\n' ' ')
+	echo "Benchmark: tools/bench.c $binfiles -> bin/tools/bench" >&2
+	gcc $GCC_ARGS $LINK_ARGS -o bin/tools/bench tools/bench.c $binfiles -Iincl || exit 1
+	bin/tools/bench "$@"
+}
+
+function native {
+	# Compile a program to x86-64 assembly next to the compiler and assemble
+	# and link it with the system toolchain, which provides the C library
+	[[ -x bin/compiler ]] || build release || return 1
+	local name=$(basename "$1" | cut -d'.' -f1)
+	local output=${2:-bin/$name}
+	mkdir -p bin/native
+	echo "Compiling: $1 -> bin/native/$name.s"
+	bin/compiler --asm "$1" > "bin/native/$name.s" || return 1
+	echo "Assembling: bin/native/$name.s -> bin/native/$name.o"
+	as -o "bin/native/$name.o" "bin/native/$name.s" || return 1
+	echo "Linking: bin/native/$name.o -> $output"
+	gcc -o "$output" "bin/native/$name.o"
+}
+
+function outcome {
+	# What a command printed, then what it reported, then how it exited
+	"$@" 2> bin/tests/errors
+	local status=$?
+	cat bin/tests/errors
+	echo "exit $status"
+}
+
+function run_tests {
+	# Run every program in tests/ on the interpreter with and without constant
+	# folding and natively. Each run has to match the program's .out file, and
+	# the run with folding has to match the one without it, apart from the
+	# warnings that only folding gives.
+	build release || return 1
+	mkdir -p bin/tests
+	local failed=0
+	for program in tests/*.mart ; do
+		local name=$(basename "$program" .mart)
+		local expected=$(cat "tests/$name.out")
+		local folded unfolded
+		native "$program" "bin/tests/$name" > /dev/null || return 1
+		for mode in run no-fold native fold ; do
+			case $mode in
+				"run") actual=$(outcome bin/compiler --run "$program") ; folded=$actual ;;
+				"no-fold") actual=$(outcome bin/compiler --run --no-fold "$program") ; unfolded=$actual ;;
+				"native") actual=$(outcome "bin/tests/$name") ;;
+				"fold") expected=$unfolded ; actual=$(grep -v '^Warning: ' <<< "$folded") ;;
+			esac
+			if [[ "$actual" == "$expected" ]] ; then
+				echo "Passed: $program ($mode)"
+			else
+				echo "Failed: $program ($mode)"
+				diff <(echo "$expected") <(echo "$actual")
+				failed=1
+			fi
+		done
+	done
+	return $failed
+}
+
 function clean {
 	[[ -d bin/ ]] && rm -r bin/
 	return 0
@@ -47,5 +129,8 @@ function clean {
 
 case $1 in
 	"build") build $2 ;;
+	"bench") shift ; bench "$@" ;;
+	"native") native "$2" "$3" ;;
+	"test") run_tests || exit 1 ;;
 	"clean") clean ;;
 esac
@@ -0,0 +1,30 @@
+#ifndef X86_H
+#define X86_H
+
+#include "parser/ast.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+
+/* Programs compile to the `main` function of a GNU assembler file for
+ * x86-64 Linux, which links against the C library for its output. Numbers
+ * and bools are 64-bit integers that wrap around like in the VM, and the
+ * natives `print` and `assert` and the runtime errors behave the same.
+ *
+ * The tree is first lowered into three-address instructions on an unlimited
+ * number of virtual registers, each temporary with its own. A linear scan
+ * over their live intervals then maps them to the general purpose registers
+ * or spills them to the stack frame, keeping values live across calls in
+ * callee-saved registers.
+ */
+
+/** Compiles a tree as the body of a program, whose exit status is the value
+  * it returns. Threads can compile at the same time.
+  * @param ast The block of the program.
+  * @param out Where to write the assembly, nothing is written on errors.
+  * @param errors Where to report errors like undeclared variables.
+  * @return Whether compiling succeeded.
+  */
+bool x86_compile(Node *ast, FILE *out, FILE *errors);
+
+#endif // X86_H
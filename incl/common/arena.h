@@ -26,6 +26,8 @@ typedef struct region {
   */
 typedef struct arena {
 	/// Allocations that create a new region use this value as its minimum size.
+	/// Past that each new region is twice as big as the one before it, up to
+	/// a limit, so big inputs don't end up in long lists of small regions.
 	size_t min_region_size;
 	/// Pointer to the first region in the linked list of regions.
 	region_t *first;
@@ -33,6 +35,30 @@ typedef struct arena {
 	region_t *last;
 } arena_t;
 
+/** Arenas of threads that work on the same job, whose allocations are all
+  * released together once the job is done. Every thread allocates from its
+  * own arena without any synchronization, and only the handing over of a
+  * finished arena to the group is an atomic operation. Create one with
+  * `arena_group_new`.
+  */
+typedef struct arena_group {
+	/// Minimum region size of the arenas of the group's threads in bytes.
+	size_t min_region_size_bytes;
+	/// Regions of the arenas handed over to the group, pushed to atomically.
+	region_t *handed;
+} arena_group_t;
+
+/** A position in an arena to return to with `arena_reset_to`, taken with
+  * `arena_mark`. It stays valid until the arena is reset to an earlier mark
+  * or freed.
+  */
+typedef struct arena_mark {
+	/// The region that was last when the mark was taken or `NULL` if none.
+	region_t *region;
+	/// How many elements of that region were allocated.
+	size_t used;
+} arena_mark_t;
+
 /** Creates a new empty `arena_t` struct. No regions are allocated initially.
   * An arena is a supplemental allocation scheme ontop of `malloc` that allows
   * allocations with a similar purpose to be grouped together and deallocated
@@ -52,20 +78,113 @@ arena_t arena_new(size_t min_region_size_bytes);
   * complexity bump allocator. The `last` field in the `arena` struct is used
   * as the starting point for the lookup of viable allocation space. If the
   * last region is reached but no space has been found a new region is created.
+  * The block is not zeroed, so all of it has to be written before it's read.
   * @param arena The arena to allocate the block into.
   * @param block_size_bytes The amount of bytes the new block will be.
   * Rounded up to a multiple of the size of `uintptr_t`.
-  * @return The address of the newly allocated block or `NULL` if during the
-  * process there was a need to allocate a new region and `malloc` returned
-  * `NULL`.
+  * @return The address of the newly allocated block, aligned to the size of
+  * `uintptr_t`. Exits the program if a new region couldn't be allocated.
   */
 void *arena_alloc(arena_t *arena, size_t block_size_bytes);
 
+/** Like `arena_alloc` but for blocks that need a stricter alignment than
+  * `uintptr_t` has, like the ones accessed with vector instructions. The
+  * space skipped over to align the block is lost until the arena is reset.
+  * @param arena The arena to allocate the block into.
+  * @param block_size_bytes The amount of bytes the new block will be.
+  * @param alignment The alignment of the block in bytes, a power of two.
+  * @return The address of the newly allocated block.
+  */
+void *arena_alloc_aligned(arena_t *arena, size_t block_size_bytes, size_t alignment);
+
+/** Like `arena_alloc` but with the block set to all zero bytes.
+  * @param arena The arena to allocate the block into.
+  * @param block_size_bytes The amount of bytes the new block will be.
+  * @return The address of the newly allocated block.
+  */
+void *arena_alloc_zeroed(arena_t *arena, size_t block_size_bytes);
+
+/** Remembers how far an arena is allocated, so that everything allocated
+  * after can be dropped at once with `arena_reset_to`. Marks can be nested
+  * and reset to in any order, as long as no mark is used after the arena was
+  * reset to an earlier one.
+  * @param arena The arena to mark.
+  * @return The mark.
+  */
+arena_mark_t arena_mark(const arena_t *arena);
+
+/** Drops all allocations made since a mark, which must not be used anymore.
+  * The regions are kept to allocate into again instead of being freed.
+  * @param arena The marked arena.
+  * @param mark The mark taken with `arena_mark` on the same arena.
+  */
+void arena_reset_to(arena_t *arena, arena_mark_t mark);
+
+/** Moves all regions of one arena into another, so that the allocations of
+  * both are freed together with the destination. Allocations keep their
+  * addresses and new allocations into the destination continue where they
+  * would have before. The source is left empty.
+  * @param arena The arena to move the regions into.
+  * @param other The arena to take the regions from.
+  */
+void arena_adopt(arena_t *arena, arena_t *other);
+
 /** Clears the arena of all allocations and removes and `free`s all of its
-  * regions. The arena is ultimately left to a state equivalent to if it was
-  * just created with `arena_new`.
+  * regions, or keeps them for other arenas to reuse while there's room in the
+  * retained regions. The arena is ultimately left to a state equivalent to if
+  * it was just created with `arena_new`.
   * @param arena The arena to clear all allocations from.
   */
 void arena_free(arena_t *arena);
 
+/** Creates a new group that no thread has joined and nothing was handed to.
+  * @param min_region_size_bytes The minimum region size of the arenas of the
+  * threads that join the group, see `arena_new`.
+  * @return The newly created `arena_group_t` struct.
+  */
+arena_group_t arena_group_new(size_t min_region_size_bytes);
+
+/** Gives the calling thread an arena of its own in a group, which has to be
+  * left with `arena_leave` before the thread can join another group. A thread
+  * that already joined the group gets the same arena again.
+  * @param group The group to join.
+  * @return The thread's arena, only to be used by this thread.
+  */
+arena_t *arena_join(arena_group_t *group);
+
+/** Hands the calling thread's arena over to the group it joined. Allocations
+  * from it stay valid and belong to the group from then on.
+  * @param group The group the thread joined.
+  */
+void arena_leave(arena_group_t *group);
+
+/** Moves all regions of an arena into a group, so that they are released
+  * with it. Can be called by any number of threads at the same time.
+  * @param group The group to hand the regions to.
+  * @param arena The arena to take the regions from, which is left empty.
+  */
+void arena_hand_off(arena_group_t *group, arena_t *arena);
+
+/** Moves everything handed to a group so far into an arena, like
+  * `arena_adopt`, usually after all threads of the group left it.
+  * @param arena The arena to move the regions into.
+  * @param group The group to take the regions from.
+  */
+void arena_group_take(arena_t *arena, arena_group_t *group);
+
+/** Frees everything handed to a group so far, like `arena_free`.
+  * @param group The group to release the regions of.
+  */
+void arena_group_free(arena_group_t *group);
+
+/** Sets how many bytes of freed regions are kept to be reused by new regions
+  * of any arena instead of going back to `malloc`, which pays off when the
+  * same work is repeated in one process. Nothing is kept by default. Lowering
+  * the limit frees retained regions until they fit under it, so 0 frees them
+  * all. The retained regions are shared without locks, so this and every
+  * other arena function is safe to call from any thread on its own arenas.
+  * @param max_bytes The most bytes to keep, counting the region headers.
+  */
+void arena_set_retain(size_t max_bytes);
+
 #endif // _ARENA_H_
@@ -0,0 +1,15 @@
+#ifndef ARRAY_H
+#define ARRAY_H
+
+#include <stddef.h>
+
+/** Doubles the capacity of a heap-allocated array, starting at 64 items,
+  * and exits like `error_if` if that fails.
+  * @param items The array, or NULL if nothing is allocated yet.
+  * @param capacity Count of items the array has room for, which is updated.
+  * @param item_size Size of an item in bytes.
+  * @return The array, which may have moved.
+  */
+void *array_grow(void *items, size_t *capacity, size_t item_size);
+
+#endif // ARRAY_H
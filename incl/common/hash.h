@@ -0,0 +1,18 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Hashes a buffer with the 64-bit variant of xxHash, which consumes 32 bytes
+  * per round in four independent lanes. Fast enough to be run over a whole
+  * source file before deciding whether to lex it. Not meant to withstand
+  * deliberate collisions.
+  * @param data The bytes to hash.
+  * @param size The amount of bytes to hash.
+  * @param seed Any value, different seeds give unrelated hashes.
+  * @return The hash of the bytes.
+  */
+uint64_t hash_bytes(const void *data, size_t size, uint64_t seed);
+
+#endif // HASH_H
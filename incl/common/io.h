@@ -21,10 +21,10 @@ typedef struct string {
 // The canonical configuration of a string_t to indicate that it is empty.
 #define EMPTY_STRING (string_t){.size=0, .string=NULL}
 
-/** Attempts to read from the given file in chunks and allocates an array on
-  * the heap to exatly fit the contents of it. If allocation is unsuccessful
-  * then an empty string is returned instead and errno is set. Use `error_if`
-  * to report the error and exit or handle it.
+/** Attempts to read from the given file into a geometrically grown buffer
+  * and trims it on the heap to exactly fit the contents of it. If allocation
+  * is unsuccessful then an empty string is returned instead and errno is set.
+  * Use `error_if` to report the error and exit or handle it.
   * @param fdesc The opened file descriptor to read from.
   * @return Returns a string struct with heap-allocated data if successful.
   */
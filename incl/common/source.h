@@ -0,0 +1,47 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include "common/io.h"
+
+#include <stddef.h>
+
+/** A source buffer handed to the lexer. The `text` field follows the same
+  * contract as the result of `str_read`: `size` includes the terminating null
+  * character which is guaranteed to be present at `text.string[size - 1]`.
+  * Depending on where the source came from, `text` either points into a
+  * read-only memory mapping of the file or into a heap allocation. Never write
+  * through `text.string` and release it only with `source_release`.
+  */
+typedef struct source {
+	/// The null-terminated contents of the source.
+	string_t text;
+	/// Length of the memory mapping backing `text` or 0 if heap-allocated.
+	size_t mapped_size;
+} source_t;
+
+/** Loads the file at the given path or standard input if the path is "-".
+  * Regular files are mapped read-only without copying them. Anything else,
+  * like pipes, terminals and files that report a size of 0, is read into a
+  * single heap buffer that is sized up front where possible and grown
+  * geometrically otherwise. If loading is unsuccessful then `text` is an
+  * empty string and errno is set. Use `error_if` to report the error and exit
+  * or handle it.
+  * @param file_path The path to the file to load.
+  * @return The loaded source.
+  */
+source_t source_load(const char *file_path);
+
+/** Like `source_load` but reads from an already opened file descriptor. The
+  * descriptor is neither closed nor required to stay open after returning.
+  * @param fd The opened file descriptor to read from.
+  * @return The loaded source.
+  */
+source_t source_load_fd(int fd);
+
+/** Unmaps or `free`s the buffer backing the given source and leaves it empty.
+  * Calling this on an already empty source does nothing.
+  * @param source The source to release.
+  */
+void source_release(source_t *source);
+
+#endif // SOURCE_H
@@ -0,0 +1,71 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "common/arena.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// The parts of a run that time is charged to. Phases nest, like lexing
+/// that happens on demand while parsing, and time is only ever charged to
+/// the innermost one, so the times of all phases add up to the whole run.
+typedef enum stats_phase {
+	/// Anything outside of the other phases, like startup and cleanup.
+	STATS_OTHER,
+	STATS_LOAD,
+	STATS_LEX,
+	STATS_PARSE,
+	STATS_FOLD,
+	/// Whatever is done with the tree, like printing or running it.
+	STATS_OUTPUT,
+	STATS_PHASE_COUNT
+} stats_phase_t;
+
+typedef enum stats_format {
+	STATS_TEXT,
+	STATS_JSON
+} stats_format_t;
+
+/// Whether statistics are being collected, every other function does
+/// nothing while it's false.
+extern bool stats_enabled;
+
+/** Starts collecting statistics and reports them to stderr at exit. Calls
+  * to `malloc`, `calloc` and `realloc` are only counted if the executable
+  * was linked with `-Wl,--wrap=` for each of them, as build.sh does.
+  * @param format How to print the report.
+  */
+void stats_enable(stats_format_t format);
+
+/** Charges the time since the last change of phase to the current one and
+  * makes the given phase current.
+  * @param phase The phase that starts.
+  * @return The phase to give back to `stats_leave`.
+  */
+stats_phase_t stats_enter(stats_phase_t phase);
+
+/** Charges the time since the last change of phase to the current one and
+  * returns to the phase that was current before `stats_enter`.
+  * @param previous What `stats_enter` returned.
+  */
+void stats_leave(stats_phase_t previous);
+
+/** Counts tokens by their type.
+  * @param types The `token_type_t` of every token.
+  * @param count Count of tokens.
+  */
+void stats_count_tokens(const uint8_t *types, size_t count);
+
+/** Counts tree nodes by their kind.
+  * @param kinds The `NodeType` of every node.
+  * @param count Count of nodes.
+  */
+void stats_count_nodes(const uint8_t *kinds, size_t count);
+
+/** Adds the regions of an arena that is about to be freed to the totals.
+  * @param arena The arena to count.
+  */
+void stats_count_arena(const arena_t *arena);
+
+#endif // STATS_H
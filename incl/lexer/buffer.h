@@ -0,0 +1,137 @@
+#ifndef BUFFER_H
+#define BUFFER_H
+
+#include "lexer.h"
+
+#include "common/io.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** A growable sequence of tokens stored as parallel arrays, one entry per
+  * token in each. Tokens don't own their content but refer to it by offset
+  * into the source they were lexed from, which is why the source has to be
+  * passed back in to reconstruct a full token. Tokens are addressed by their
+  * index, so remembering a position in the stream is just remembering a
+  * number. Create one with `token_buffer_new`.
+  */
+typedef struct token_buffer {
+	/// The `token_type_t` of every token, narrowed to a byte.
+	uint8_t *types;
+	/// Offset of the first character of every token in the source.
+	uint32_t *offsets;
+	/// Length of every token in characters.
+	uint32_t *lengths;
+	/// Symbol of every identifier, index into `numbers` of every number
+	/// literal and `SYMBOL_NONE` for other tokens. Before the lexer interns
+	/// them, identifiers hold their hash here instead.
+	symbol_t *symbols;
+	/// Values of the number literals in the order they were pushed.
+	uint64_t *numbers;
+	size_t number_count;
+	size_t number_capacity;
+	/// Count of how many tokens are stored.
+	size_t count;
+	/// Count of how many tokens fit before the arrays need to grow.
+	size_t capacity;
+} token_buffer_t;
+
+/** Creates a new empty token buffer with room for at least the given amount
+  * of tokens. Exits with an error if allocation fails.
+  * @param capacity The amount of tokens to make room for up front.
+  * @return The newly created buffer.
+  */
+token_buffer_t token_buffer_new(size_t capacity);
+
+/** Grows the arrays of a token buffer to fit at least the given amount of
+  * tokens in total, at least doubling the capacity if it has to grow at all.
+  * Exits with an error if allocation fails.
+  * @param buffer The buffer to grow.
+  * @param capacity The amount of tokens the buffer has to fit.
+  */
+void token_buffer_reserve(token_buffer_t *buffer, size_t capacity);
+
+/** Grows the values of the number literals of a token buffer to fit at least
+  * the given amount, at least doubling the capacity if it has to grow at all.
+  * Exits with an error if allocation fails.
+  * @param buffer The buffer to grow.
+  * @param capacity The amount of numbers the buffer has to fit.
+  */
+void token_buffer_reserve_numbers(token_buffer_t *buffer, size_t capacity);
+
+/** `free`s the arrays of a token buffer and leaves it empty. The buffer is
+  * ultimately left to a state equivalent to `token_buffer_new(0)`.
+  * @param buffer The buffer to free.
+  */
+void token_buffer_free(token_buffer_t *buffer);
+
+/** Appends a token to the end of a token buffer.
+  * @param buffer The buffer to append to.
+  * @param type The type of the token.
+  * @param offset Offset of the token's first character in the source.
+  * @param length Length of the token in characters.
+  * @param symbol Symbol or hash of an identifier, `SYMBOL_NONE` otherwise.
+  */
+static inline void token_buffer_push(
+	token_buffer_t *buffer, token_type_t type, uint32_t offset, uint32_t length, symbol_t symbol
+) {
+	if(buffer->count == buffer->capacity) token_buffer_reserve(buffer, buffer->count + 1);
+	buffer->types[buffer->count] = (uint8_t) type;
+	buffer->offsets[buffer->count] = offset;
+	buffer->lengths[buffer->count] = length;
+	buffer->symbols[buffer->count] = symbol;
+	buffer->count++;
+}
+
+/** Appends a number literal to the end of a token buffer.
+  * @param buffer The buffer to append to.
+  * @param offset Offset of the literal's first character in the source.
+  * @param length Length of the literal in characters.
+  * @param value The decoded value of the literal.
+  */
+static inline void token_buffer_push_number(
+	token_buffer_t *buffer, uint32_t offset, uint32_t length, uint64_t value
+) {
+	if(buffer->number_count == buffer->number_capacity)
+		token_buffer_reserve_numbers(buffer, buffer->number_count + 1);
+	buffer->numbers[buffer->number_count] = value;
+	token_buffer_push(buffer, TOK_LIT_NUM, offset, length, (symbol_t) buffer->number_count++);
+}
+
+/** Appends a copy of a token stored in another token buffer.
+  * @param buffer The buffer to append to.
+  * @param other The buffer holding the token.
+  * @param index Index of the token in `other`.
+  * @param offset Offset of the token's first character in the source of `buffer`.
+  */
+static inline void token_buffer_push_copy(
+	token_buffer_t *buffer, const token_buffer_t *other, size_t index, uint32_t offset
+) {
+	token_type_t type = (token_type_t) other->types[index];
+	if(type == TOK_LIT_NUM)
+		token_buffer_push_number(buffer, offset, other->lengths[index], other->numbers[other->symbols[index]]);
+	else token_buffer_push(buffer, type, offset, other->lengths[index], other->symbols[index]);
+}
+
+/** Reconstructs a single token stored in a token buffer.
+  * @param buffer The buffer to read from.
+  * @param src The source that the tokens were lexed from.
+  * @param index Index of the token, has to be less than `count`.
+  * @return The token with its content pointing into `src`.
+  */
+static inline token_t token_buffer_get(
+	const token_buffer_t *buffer, const char *src, size_t index
+) {
+	token_type_t type = (token_type_t) buffer->types[index];
+	return (token_t) {
+		.type = type,
+		.content = {
+			.size = buffer->lengths[index],
+			.string = (char *) &src[buffer->offsets[index]]
+		},
+		.symbol = type == TOK_LIT_NUM ? SYMBOL_NONE : buffer->symbols[index],
+		.number = type == TOK_LIT_NUM ? buffer->numbers[buffer->symbols[index]] : 0
+	};
+}
+
+#endif // BUFFER_H
@@ -0,0 +1,106 @@
+// Generated by tools/lexgen.c from the token definitions in tokens.h.
+// Do not edit, rerun `build.sh build` instead.
+
+#include "lexer.h"
+
+#include <stdint.h>
+#include <string.h>
+
+// Fails to compile if the condition doesn't hold
+#define DFA_CHECK(name, cond) typedef char dfa_check_##name[(cond) ? 1 : -1]
+
+#define DFA_COUNT_TOKEN(VAL) + 1
+DFA_CHECK(token_count, 0 FOREACH_TOKEN(DFA_COUNT_TOKEN) == 34);
+#undef DFA_COUNT_TOKEN
+
+#define DFA_STATES 28
+#define DFA_CLASSES 17
+// Transitioning to this state means the token ended before the character
+#define DFA_STOP 0
+#define DFA_START 1
+
+// Maps every character to its class
+static const uint8_t dfa_class[256] = {
+	 1,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0, 14,  0,  0,  4,  5, 12, 10,  6, 11,  0, 13,
+	 2,  2,  2,  2,  2,  2,  2,  2,  2,  2,  7,  8, 15,  9, 16,  0,
+	 0,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,
+	 3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  0,  0,  0,  0,  3,
+	 0,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,
+	 3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0
+};
+
+// Indexed by the current state and the class of the next character
+static const uint8_t dfa_next[DFA_STATES][DFA_CLASSES] = {
+	{  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0 },
+	{  3,  2,  5,  4,  6,  7,  8,  9, 10, 11, 12, 14, 16, 18, 20, 23, 26 },
+	{  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0 },
+	{  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0 },
+	{  0,  0,  4,  4,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0 },
+	{  0,  0,  5,  5,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0 },
+	{  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0 },
+	{  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0 },
+	{  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0 },
+	{  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0 },
+	{  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0 },
+	{  0,  0,  0,  0,  0,  0,  0,  0,  0, 22,  0,  0,  0,  0,  0,  0,  0 },
+	{  0,  0,  0,  0,  0,  0,  0,  0,  0, 13,  0,  0,  0,  0,  0,  0,  0 },
+	{  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0 },
+	{  0,  0,  0,  0,  0,  0,  0,  0,  0, 15,  0,  0,  0,  0,  0,  0,  0 },
+	{  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0 },
+	{  0,  0,  0,  0,  0,  0,  0,  0,  0, 17,  0,  0,  0,  0,  0,  0,  0 },
+	{  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0 },
+	{  0,  0,  0,  0,  0,  0,  0,  0,  0, 19,  0,  0,  0,  0,  0,  0,  0 },
+	{  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0 },
+	{  0,  0,  0,  0,  0,  0,  0,  0,  0, 21,  0,  0,  0,  0,  0,  0,  0 },
+	{  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0 },
+	{  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0 },
+	{  0,  0,  0,  0,  0,  0,  0,  0,  0, 25,  0,  0,  0,  0,  0,  0, 24 },
+	{  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0 },
+	{  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0 },
+	{  0,  0,  0,  0,  0,  0,  0,  0,  0, 27,  0,  0,  0,  0,  0,  0,  0 },
+	{  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0 }
+};
+
+// The token type of a token that ends in the given state
+static const token_type_t dfa_accept[DFA_STATES] = {
+	TOK_ERROR,
+	TOK_ERROR,
+	TOK_EOF,
+	TOK_ERROR,
+	TOK_IDENT,
+	TOK_LIT_NUM,
+	TOK_OPEN_ROUND,
+	TOK_CLOSE_ROUND,
+	TOK_COMMA,
+	TOK_COLON,
+	TOK_SEMICOLON,
+	TOK_OP_ASSIGN,
+	TOK_OP_PLUS,
+	TOK_OP_ASSIGN_ALT,
+	TOK_OP_MINUS,
+	TOK_OP_ASSIGN_ALT,
+	TOK_OP_MULT,
+	TOK_OP_ASSIGN_ALT,
+	TOK_OP_DIV,
+	TOK_OP_ASSIGN_ALT,
+	TOK_OP_MOD,
+	TOK_OP_ASSIGN_ALT,
+	TOK_OP_COMPARE,
+	TOK_OP_COMPARE,
+	TOK_OP_COMPARE,
+	TOK_OP_COMPARE,
+	TOK_OP_COMPARE,
+	TOK_OP_COMPARE
+};
+
+#undef DFA_CHECK
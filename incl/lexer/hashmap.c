@@ -1,9 +1,22 @@
+// Generated by tools/lexgen.c from the token definitions in tokens.h.
+// Do not edit, rerun `build.sh build` instead.
+
 #include "lexer.h"
 
 #include <stdint.h>
+#include <string.h>
+
+// Fails to compile if the condition doesn't hold
+#define MAP_CHECK(name, cond) typedef char map_check_##name[(cond) ? 1 : -1]
+
+#define MAP_COUNT_TOKEN(VAL) + 1
+MAP_CHECK(token_count, 0 FOREACH_TOKEN(MAP_COUNT_TOKEN) == 34);
+#undef MAP_COUNT_TOKEN
 
-// Must be a power of two
-#define MAP_SIZE 32
+// Number of keywords, also the index of the slot that matches nothing
+#define MAP_KEYWORDS 17
+// Initial value of the hash before any bytes are mixed in
+#define MAP_SEED 0x00
 
 static const uint8_t map_sbox[256] = {
 	0xeb, 0xce, 0x84, 0xe9, 0x3b, 0x49, 0x2a, 0x4e, 0x76, 0x9e, 0xaa, 0xf2, 0xfa, 0xa0, 0x74, 0xf0,
@@ -24,20 +37,88 @@ static const uint8_t map_sbox[256] = {
 	0xe7, 0xdc, 0xb0, 0x8f, 0x6f, 0xda, 0x14, 0xf3, 0xb8, 0x07, 0x72, 0x57, 0xcf, 0xcb, 0x86, 0x5f
 };
 
-static const char *map_keys[MAP_SIZE] = {
-	"end", "", "var", "", "false", "or", "", "",
-	"bool", "", "", "if", "", "", "else", "and",
-	"while", "", "nil", "true", "", "", "not", "elif",
-	"do", "nat", "", "return", "", "int", "", ""
+// Maps a hash to the index of the only keyword that can have it
+static const uint8_t map_slots[256] = {
+	 17,  17,  17,  17,  17,  17,  17,  17,  17,  17,  17,   4,  17,  17,   6,  17,
+	 17,  17,  17,  17,  17,  17,  17,  17,  17,  14,  17,  17,  17,  17,  17,  17,
+	 17,  17,  17,  17,  17,  17,  17,  17,  17,  17,  17,  17,  17,  17,  17,  17,
+	 17,  17,  17,  17,  17,  17,  17,  17,  17,  17,  17,  17,  17,  17,  17,  17,
+	 17,  17,  17,  17,  12,  17,  17,  17,  17,  17,  17,  17,  17,  17,  17,  17,
+	  7,  17,  17,  11,  17,  17,  17,  17,  17,  17,  17,   3,  17,  17,  17,  17,
+	 17,  17,   2,  17,  17,  17,  17,  17,  17,  17,  17,  17,  17,  17,  17,  17,
+	 17,  17,  17,  17,  17,  17,  17,   5,  17,  17,  17,  17,  17,  17,  17,  17,
+	 17,  17,  17,  17,  17,  17,  17,  17,  17,  17,  17,  17,  17,  17,  17,  17,
+	 17,  17,  17,  17,  17,  17,  10,  17,  17,  17,  17,  17,  17,  17,  17,  17,
+	 17,  17,  17,  17,  17,  17,  17,  17,  17,  17,  17,  17,  17,  17,  17,   8,
+	 17,  17,  17,  17,  17,  17,  17,  17,  17,  17,  17,  17,  17,  15,  17,  17,
+	 17,  17,  17,  17,  17,  17,  17,  17,  17,  17,  17,  17,  17,  17,  17,  17,
+	 17,  17,  13,  17,  17,  17,  17,  17,   0,  17,  17,  17,  17,  17,  17,  17,
+	  1,  17,  17,  17,  17,   9,  17,  17,  16,  17,  17,  17,  17,  17,  17,  17,
+	 17,  17,  17,  17,  17,  17,  17,  17,  17,  17,  17,  17,  17,  17,  17,  17
+};
+
+// Zero padded so that they can be loaded as a single word
+static const char map_keys[MAP_KEYWORDS + 1][8] = {
+	"do",
+	"end",
+	"var",
+	"return",
+	"if",
+	"elif",
+	"else",
+	"while",
+	"and",
+	"or",
+	"not",
+	"true",
+	"false",
+	"nil",
+	"nat",
+	"int",
+	"bool",
+	""
 };
 
-static const token_type_t map_vals[MAP_SIZE] = {
-	TOK_KW_END, TOK_IDENT, TOK_KW_VAR, TOK_IDENT,
-	TOK_KW_FALSE, TOK_KW_OR, TOK_IDENT, TOK_IDENT,
-	TOK_TYPE_BOOL, TOK_IDENT, TOK_IDENT, TOK_KW_IF,
-	TOK_IDENT, TOK_IDENT, TOK_KW_ELSE, TOK_KW_AND,
-	TOK_KW_WHILE, TOK_IDENT, TOK_KW_NIL, TOK_KW_TRUE,
-	TOK_IDENT, TOK_IDENT, TOK_KW_NOT, TOK_KW_ELIF,
-	TOK_KW_DO, TOK_TYPE_NAT, TOK_IDENT, TOK_KW_RETURN,
-	TOK_IDENT, TOK_TYPE_INT, TOK_IDENT, TOK_IDENT
+static const uint8_t map_lens[MAP_KEYWORDS + 1] = {
+	2, 3, 3, 6, 2, 4, 4, 5, 3, 2, 3, 4, 5, 3, 3, 3, 4, 0
 };
+
+static const token_type_t map_vals[MAP_KEYWORDS + 1] = {
+	TOK_KW_DO,
+	TOK_KW_END,
+	TOK_KW_VAR,
+	TOK_KW_RETURN,
+	TOK_KW_IF,
+	TOK_KW_ELIF,
+	TOK_KW_ELSE,
+	TOK_KW_WHILE,
+	TOK_KW_AND,
+	TOK_KW_OR,
+	TOK_KW_NOT,
+	TOK_KW_TRUE,
+	TOK_KW_FALSE,
+	TOK_KW_NIL,
+	TOK_TYPE_NAT,
+	TOK_TYPE_INT,
+	TOK_TYPE_BOOL,
+	TOK_IDENT
+};
+
+/** Looks up whether the given identifier is a keyword.
+  * @param content Pointer to the first character of the identifier.
+  * @param count Length of the identifier.
+  * @param hash The result of mixing every character of the identifier
+  * into `MAP_SEED` using `hash = map_sbox[hash ^ c]`.
+  * @return The keyword's token type or `TOK_IDENT` if it isn't one.
+  */
+static token_type_t map_lookup(const char *content, size_t count, uint8_t hash) {
+	// the slot that matches nothing has length zero, which no identifier has
+	uint8_t slot = map_slots[hash];
+	if(count != map_lens[slot]) return TOK_IDENT;
+	uint64_t word = 0, key;
+	memcpy(&word, content, count);
+	memcpy(&key, map_keys[slot], sizeof(key));
+	return word == key ? map_vals[slot] : TOK_IDENT;
+}
+
+#undef MAP_CHECK
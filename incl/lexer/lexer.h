@@ -1,29 +1,78 @@
 #ifndef LEXER_H
 #define LEXER_H
 
+#include "symbols.h"
 #include "tokens.h"
 
 #include "common/io.h"
+#include "common/source.h"
 
 extern const char *token_type_strs[];
 typedef enum token_type {
 	FOREACH_TOKEN(GENERATE_ENUM)
 } token_type_t;
 
+// Number literals go up to the magnitude of the smallest int, which only
+// fits once it's negated, and larger ones get the value after it so that the
+// parser can report them. The largest nat is the largest int.
+#define LEXER_MAX_NUMBER ((uint64_t) INT64_MAX + 1)
+#define LEXER_TOO_LARGE (LEXER_MAX_NUMBER + 1)
+
 typedef struct token {
 	token_type_t type;
 	string_t content;
+	/// The interned identifier of a `TOK_IDENT` or `SYMBOL_NONE`.
+	symbol_t symbol;
+	/// The value of a `TOK_LIT_NUM`, at most `LEXER_TOO_LARGE`, or 0.
+	uint64_t number;
 } token_t;
 
-typedef struct token_list {
-	struct token_list *next;
-	token_t token;
-} token_list_t;
+struct token_buffer;
+
+typedef enum lexer_mode {
+	/// Splits tokens with the state machine generated from tokens.h.
+	LEXER_MODE_TABLE,
+	/// Splits tokens with the original hand-written scanner. Slower, but
+	/// useful as a reference to compare the token stream against.
+	LEXER_MODE_REFERENCE
+} lexer_mode_t;
+
+/// Splits one source at a time into tokens and holds on to them together
+/// with the interned identifiers. Lexers are independent of each other, so
+/// every thread can work with its own. Create one with `lexer_new`.
+typedef struct lexer lexer_t;
 
-void lexer_init(const char *file_path);
-void lexer_backtrack(token_t *next_ptr);
-token_t *lexer_next(void);
-token_t *lexer_peek(void);
-string_t lexer_get_src(void);
+// Creates a lexer without a source, which is freed with `lexer_free`
+lexer_t *lexer_new(void);
+// Frees the lexer along with its source, tokens and symbols
+void lexer_free(lexer_t *lexer);
+// Takes effect starting with the next call to `lexer_load`
+void lexer_set_mode(lexer_t *lexer, lexer_mode_t mode);
+// Threads to lex large inputs with, 0 uses one per processor and is the
+// default. Takes effect starting with the next call to `lexer_load`.
+void lexer_set_threads(lexer_t *lexer, size_t threads);
+// Loads the source, which is split into tokens when they are first asked
+// for. The tokens and symbols of the previous source are dropped, but their
+// buffers are kept for reuse. Returns false with errno set if loading fails.
+bool lexer_load(lexer_t *lexer, const char *file_path);
+// Loads a source that was read some other way, which the lexer takes over
+// and releases with the next one
+bool lexer_load_source(lexer_t *lexer, source_t source);
+// Loads the source and splits it into tokens right away
+bool lexer_init(lexer_t *lexer, const char *file_path);
+// Appends the tokens of a null-terminated text starting at `begin`, which
+// has to be outside of any token or comment, followed by an EOF token. The
+// identifiers are interned into the given table.
+void lexer_lex(struct token_buffer *tokens, symbol_table_t *symbols, string_t text, size_t begin);
+size_t lexer_position(const lexer_t *lexer);
+void lexer_backtrack(lexer_t *lexer, size_t position);
+token_t lexer_next(lexer_t *lexer);
+token_t lexer_peek(lexer_t *lexer);
+const struct token_buffer *lexer_get_tokens(lexer_t *lexer);
+string_t lexer_get_src(const lexer_t *lexer);
+// Identifiers of the tokens so far, which are kept until the next source loads
+symbol_table_t *lexer_get_symbols(lexer_t *lexer);
+// Interns an identifier alongside the ones of the tokens
+symbol_t lexer_intern(lexer_t *lexer, string_t name);
 
 #endif // LEXER_H
@@ -0,0 +1,64 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Selects the fastest scanning kernels supported by the running processor.
+  * Until this is called the kernels use the baseline instruction set of the
+  * target (SSE2 on x86-64, plain C elsewhere), so calling it is optional but
+  * recommended. It's meant to be called once from `main` before any thread
+  * lexes, as it changes the kernels that those threads use. Calling it again
+  * does nothing.
+  */
+void scan_init(void);
+
+/** Finds the first byte at or after `begin` that isn't a space, tab, carriage
+  * return or line feed. Bytes at and after `end` are never read.
+  * @param src The buffer to scan.
+  * @param begin Index of the first byte to look at.
+  * @param end Index one past the last byte that may be looked at.
+  * @return The index of the found byte or `end` if there was none.
+  */
+size_t scan_skip_white(const char *src, size_t begin, size_t end);
+
+/** Finds the first occurrence of the given byte at or after `begin`. Bytes at
+  * and after `end` are never read.
+  * @param src The buffer to scan.
+  * @param begin Index of the first byte to look at.
+  * @param end Index one past the last byte that may be looked at.
+  * @param c The byte to look for.
+  * @return The index of the found byte or `end` if there was none.
+  */
+size_t scan_find_byte(const char *src, size_t begin, size_t end, char c);
+
+/** Finds the first "*" immediately followed by "/" at or after `begin`, which
+  * is where a block comment ends. Bytes at and after `end` are never read.
+  * @param src The buffer to scan.
+  * @param begin Index of the first byte to look at.
+  * @param end Index one past the last byte that may be looked at.
+  * @return The index of the found "*" or `end` if there was none.
+  */
+size_t scan_find_comment_end(const char *src, size_t begin, size_t end);
+
+/// How decoding a number went, a malformed number may also be too large.
+typedef enum scan_number_result {
+	SCAN_NUMBER_OK,
+	SCAN_NUMBER_OVERFLOW,
+	SCAN_NUMBER_MALFORMED
+} scan_number_result_t;
+
+/** Decodes the decimal number spelled by the bytes from `begin` up to `end`,
+  * eight digits at a time. Up to seven bytes before `begin` may be read, but
+  * none before `src` or at and after `end`.
+  * @param src The buffer holding the digits.
+  * @param begin Index of the first digit.
+  * @param end Index one past the last digit.
+  * @param value Where to store the number, which is only set if it's OK.
+  * @return Whether all the bytes are digits and the number fits in 64 bits,
+  *         and if not which of the two failed.
+  */
+scan_number_result_t scan_number(const char *src, size_t begin, size_t end, uint64_t *value);
+
+#endif // SCAN_H
@@ -0,0 +1,84 @@
+#ifndef SYMBOLS_H
+#define SYMBOLS_H
+
+#include "common/arena.h"
+#include "common/io.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// Dense number of an interned identifier, the first one interned is 0.
+typedef uint32_t symbol_t;
+
+/// Stands in for the symbol of tokens that aren't identifiers.
+#define SYMBOL_NONE UINT32_MAX
+
+/// Initial value of the hash of an identifier before any bytes are mixed in.
+#define SYMBOL_HASH_SEED 2166136261u
+
+/** Mixes the next byte of an identifier into its hash. The lexer mixes the
+  * bytes in while it reads them, next to the 8-bit hash that tells keywords
+  * apart, so interning doesn't have to read the identifier again.
+  * @param hash The hash of the bytes before, starting at `SYMBOL_HASH_SEED`.
+  * @param byte The next byte.
+  * @return The hash including the byte.
+  */
+static inline uint32_t symbol_hash_step(uint32_t hash, uint8_t byte) {
+	return (hash ^ byte) * 16777619u;
+}
+
+/** A set of identifiers, each numbered by a `symbol_t` in the order they were
+  * first interned. Identifiers are found through an open addressing table of
+  * their hashes, and the table and copies of the identifiers live in an arena
+  * so they go all at once. Create one with `symbol_table_new`, a
+  * zeroed struct works too.
+  */
+typedef struct symbol_table {
+	/// Holds the slots and the names, old slots are left behind on growth.
+	arena_t arena;
+	/// Power of two count of slots, each with a hash and its symbol + 1 or 0.
+	struct symbol_slot { uint32_t hash; uint32_t symbol; } *slots;
+	size_t slot_capacity;
+	/// The identifier of every symbol, null-terminated.
+	string_t *names;
+	size_t count;
+	size_t name_capacity;
+} symbol_table_t;
+
+/** Creates a new empty symbol table, nothing is allocated until something
+  * is interned.
+  * @return The newly created table.
+  */
+symbol_table_t symbol_table_new(void);
+
+/** Hashes a whole identifier the way the lexer does.
+  * @param name Characters of the identifier.
+  * @param size Count of characters.
+  * @return The hash to pass to `symbol_intern`.
+  */
+uint32_t symbol_hash(const char *name, size_t size);
+
+/** Finds the symbol of an identifier, adding it if it's new.
+  * @param table The table to look in.
+  * @param name The identifier, which is copied if it's new.
+  * @param hash The result of `symbol_hash` for the identifier.
+  * @return The identifier's symbol.
+  */
+symbol_t symbol_intern(symbol_table_t *table, string_t name, uint32_t hash);
+
+/** Looks up the identifier of a symbol.
+  * @param table The table the symbol was interned in.
+  * @param symbol The symbol, less than `count`.
+  * @return The identifier, owned by the table.
+  */
+static inline string_t symbol_name(const symbol_table_t *table, symbol_t symbol) {
+	return table->names[symbol];
+}
+
+/** Frees everything that the table holds and leaves it empty. Names that
+  * were looked up become invalid.
+  * @param table The table to free.
+  */
+void symbol_table_free(symbol_table_t *table);
+
+#endif // SYMBOLS_H
@@ -17,5 +17,21 @@
 	/* Others */ \
 	FN(IDENT) FN(LIT_NUM)
 
+// Spellings of the tokens made up of symbol characters. The lexer's state
+// machine is generated from these, so every prefix of a spelling has to be
+// spelled out as well.
+#define FOREACH_SYMBOL(FN) \
+	/* Structural */ \
+	FN("(", OPEN_ROUND) FN(")", CLOSE_ROUND) \
+	FN(",", COMMA) FN(":", COLON) FN(";", SEMICOLON) \
+	/* Operators */ \
+	FN("=", OP_ASSIGN) \
+	FN("+=", OP_ASSIGN_ALT) FN("-=", OP_ASSIGN_ALT) FN("*=", OP_ASSIGN_ALT) \
+	FN("/=", OP_ASSIGN_ALT) FN("%=", OP_ASSIGN_ALT) \
+	FN("==", OP_COMPARE) FN("<>", OP_COMPARE) \
+	FN("<", OP_COMPARE) FN("<=", OP_COMPARE) \
+	FN(">", OP_COMPARE) FN(">=", OP_COMPARE) \
+	FN("+", OP_PLUS) FN("-", OP_MINUS) FN("*", OP_MULT) FN("/", OP_DIV) FN("%", OP_MOD)
+
 #define GENERATE_ENUM(VAL) TOK_##VAL,
 #define GENERATE_STRS(VAL) #VAL,
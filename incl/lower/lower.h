@@ -0,0 +1,151 @@
+#ifndef LOWER_H
+#define LOWER_H
+
+#include "parser/ast.h"
+
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* What the bytecode compiler and the x86 backend have in common when they
+ * lower a tree: reporting errors, keeping track of the variables in scope,
+ * reading literals and turning conditions into jumps. Each backend keeps a
+ * `lower_t` in its thread-local state.
+ */
+
+/// What a backend knows about a value, registers themselves are untyped.
+typedef enum value_type {
+	VALUE_NUMBER,
+	VALUE_BOOL,
+	VALUE_NIL
+} value_type_t;
+
+/** A variable in scope and the register that holds it, which is a virtual
+  * register for backends that allocate registers later.
+  */
+typedef struct lower_var {
+	string_t name;
+	symbol_t symbol;
+	/// The variable of the same name that this one hides as its index + 1.
+	size_t shadowed;
+	uint32_t reg;
+	value_type_t type;
+	/// Whether the variable is a nat, which is checked whenever it changes.
+	bool nat;
+} lower_var_t;
+
+typedef struct lower {
+	FILE *errors;
+	/// Where an error jumps to once it's reported.
+	jmp_buf fail;
+	/// Variables in scope, innermost last.
+	lower_var_t *vars;
+	size_t var_count;
+	size_t var_capacity;
+	/// Innermost variable in scope of every symbol as its index + 1 or 0.
+	size_t *bindings;
+	size_t binding_capacity;
+	/// Chains of operations being lowered, see `lower_push_chain`.
+	NodeStack chain;
+} lower_t;
+
+/** How a backend emits the jumps of a condition. A target is whatever the
+  * backend finds the jumps to a place by, like a label or a list of jumps
+  * that are patched once the place is known.
+  */
+typedef struct lower_jumps {
+	/// Emits a jump to the target.
+	void (*jump)(size_t *target);
+	/// Emits a jump to the target that is taken if the node has the truth
+	/// value, for conditions that aren't bools, `not`, `and` or `or`.
+	void (*test)(Node *node, bool when, size_t *target);
+	/// Creates a target that jumps are emitted to before it's placed.
+	size_t (*new_target)(void);
+	/// Places a target at the next instruction.
+	void (*place)(size_t target);
+} lower_jumps_t;
+
+/** Reports an error and jumps to `fail` of the lowering.
+  * @param lower The lowering that fails.
+  * @param fmt The format of the message, followed by its arguments.
+  */
+void lower_error(lower_t *lower, const char *fmt, ...);
+
+/** Finds the innermost variable in scope of the identifier's name, an
+  * undeclared one is an error.
+  * @param lower The lowering to look in.
+  * @param ident The identifier.
+  * @return The variable, which moves once another one is declared.
+  */
+const lower_var_t *lower_lookup(lower_t *lower, const IdentNode *ident);
+
+/** Brings a variable into scope, hiding any other one of the same name.
+  * @param lower The lowering to declare the variable in.
+  * @param var The variable, `shadowed` is filled in.
+  */
+void lower_declare(lower_t *lower, lower_var_t var);
+
+/** Takes the variables declared after the first `var_count` out of scope
+  * again, so that the ones they hid come back.
+  * @param lower The lowering whose scope ends.
+  * @param var_count Count of variables that were in scope when it began.
+  */
+void lower_leave_scope(lower_t *lower, size_t var_count);
+
+/** Frees the variables of a lowering.
+  * @param lower The lowering to free.
+  */
+void lower_free(lower_t *lower);
+
+/** Whether the node is a literal or a variable, which lowering reads without
+  * running anything.
+  * @param node The node to check.
+  * @return True if it is.
+  */
+bool lower_is_leaf(const Node *node);
+
+/** Whether lowering the node into a register only writes it once its
+  * operands are read, which makes the register of an operand a safe target.
+  * @param node The node to check.
+  * @return True if it does.
+  */
+bool lower_writes_late(const Node *node);
+
+/** Reads a literal number, which is negative if it's negated.
+  * @param node The node to read.
+  * @param value Receives the number.
+  * @return Whether the node is a literal number.
+  */
+bool lower_literal(const Node *node, int64_t *value);
+
+/** Whether the left operand of a binary operation has to be copied before
+  * the right one is evaluated, because it's a variable that the right one
+  * may change.
+  * @param node The binary operation.
+  * @return True if it has to be.
+  */
+bool lower_copies_left(const BinaryOpNode *node);
+
+/** Pushes a binary operation onto the `chain` of a lowering and then the
+  * ones down its left operands that lower the same way, which are either
+  * arithmetic operations and comparisons or `and` and `or`. A chain like
+  * `a + b - c` can be too long to recurse once per operation, so backends
+  * lower it in a loop from the last operation pushed.
+  * @param lower The lowering to push onto.
+  * @param node The outermost operation of the chain.
+  */
+void lower_push_chain(lower_t *lower, BinaryOpNode *node);
+
+/** Lowers a condition into jumps that are taken if it has the given truth
+  * value and fall through otherwise, without materializing `and`, `or` and
+  * `not` as values. Chains of `and` and `or` are lowered without recursing.
+  * @param jumps How the backend emits jumps.
+  * @param node The condition.
+  * @param when The truth value to jump on.
+  * @param target Where the jumps go.
+  */
+void lower_branch(const lower_jumps_t *jumps, Node *node, bool when, size_t *target);
+
+#endif // LOWER_H
@@ -9,9 +9,43 @@
 typedef enum {
 	NODE_BLOCK,
 	NODE_NUMBER,
-	NODE_BINARY_OP
+	NODE_BINARY_OP,
+	NODE_IDENT,
+	NODE_VAR,
+	NODE_IF,
+	NODE_WHILE,
+	NODE_RETURN,
+	NODE_UNARY_OP,
+	NODE_CALL,
+	NODE_BOOL,
+	NODE_NIL
 } NodeType;
 
+// Operators grouped by their precedence level in grammar.bnf
+#define FOREACH_OP(FN) \
+	/* PREC_0 */ \
+	FN(ASSIGN, "=") FN(ASSIGN_ADD, "+=") FN(ASSIGN_SUB, "-=") \
+	FN(ASSIGN_MUL, "*=") FN(ASSIGN_DIV, "/=") FN(ASSIGN_MOD, "%=") \
+	/* PREC_1 */ \
+	FN(AND, "and") FN(OR, "or") \
+	/* PREC_2 */ \
+	FN(NOT, "not") \
+	FN(EQ, "==") FN(NE, "<>") FN(LT, "<") FN(LE, "<=") FN(GT, ">") FN(GE, ">=") \
+	/* PREC_3 */ \
+	FN(ADD, "+") FN(SUB, "-") \
+	/* PREC_4 */ \
+	FN(MUL, "*") FN(DIV, "/") FN(MOD, "%") \
+	/* PREC_5 */ \
+	FN(POS, "+") FN(NEG, "-")
+
+#define GENERATE_OP_ENUM(NAME, STR) OP_##NAME,
+#define GENERATE_OP_STRS(NAME, STR) STR,
+
+extern const char* op_type_strs[];
+typedef enum {
+	FOREACH_OP(GENERATE_OP_ENUM)
+} OpType;
+
 typedef struct {
 	NodeType type;
 } Node;
@@ -24,23 +58,93 @@ typedef struct {
 
 typedef struct {
 	Node 				 base;
-	unsigned int value;
+	uint64_t		 value;
 } NumberNode;
 
 typedef struct {
 	Node 				 base;
 	Node *			 left;
 	Node *			 right;
-	token_type_t op;
-	bool				 is_op;
+	OpType			 op;
 } BinaryOpNode;
 
-Node* ast_new_block(void* children, size_t size);
-Node* ast_new_number(unsigned int value);
-Node* ast_new_binary_op(Node* left, Node* right, token_type_t op);
+typedef struct {
+	Node 				 base;
+	OpType			 op;
+	Node *			 operand;
+} UnaryOpNode;
+
+// Names keep their spelling for messages and their symbol for lookups
+typedef struct {
+	Node 				 base;
+	string_t		 name;
+	symbol_t		 symbol;
+} IdentNode;
+
+typedef struct {
+	Node 				 base;
+	token_type_t var_type;
+	string_t		 name;
+	symbol_t		 symbol;
+	Node *			 value;
+} VarNode;
+
+// An elif is an IfNode in the otherwise branch, which is NULL if absent
+typedef struct {
+	Node 				 base;
+	Node *			 condition;
+	Node *			 then;
+	Node *			 otherwise;
+} IfNode;
+
+typedef struct {
+	Node 				 base;
+	Node *			 condition;
+	Node *			 body;
+} WhileNode;
+
+typedef struct {
+	Node 				 base;
+	Node *			 value;
+} ReturnNode;
+
+typedef struct {
+	Node 				 base;
+	string_t		 name;
+	symbol_t		 symbol;
+	size_t 			 size;
+	void *			 args;
+} CallNode;
+
+typedef struct {
+	Node 				 base;
+	bool				 value;
+} BoolNode;
+
+// Growable stack that child lists are built on before they are copied into
+// an arena, which keeps every list in one piece without reallocating it
+typedef struct {
+	Node**			 nodes;
+	size_t			 size;
+	size_t			 capacity;
+} NodeStack;
+
+// Nodes are allocated from the given arena and freed together with it
+Node* ast_new_block(arena_t* arena, Node** children, size_t size);
+Node* ast_new_number(arena_t* arena, uint64_t value);
+Node* ast_new_binary_op(arena_t* arena, Node* left, Node* right, OpType op);
+Node* ast_new_ident(arena_t* arena, string_t name, symbol_t symbol);
+Node* ast_new_var(arena_t* arena, token_type_t var_type, string_t name, symbol_t symbol, Node* value);
+Node* ast_new_if(arena_t* arena, Node* condition, Node* then, Node* otherwise);
+Node* ast_new_while(arena_t* arena, Node* condition, Node* body);
+Node* ast_new_return(arena_t* arena, Node* value);
+Node* ast_new_unary_op(arena_t* arena, Node* operand, OpType op);
+Node* ast_new_call(arena_t* arena, string_t name, symbol_t symbol, Node** args, size_t size);
+Node* ast_new_bool(arena_t* arena, bool value);
+Node* ast_new_nil(arena_t* arena);
 
 // Other functions
-void ast_node_append(void** children, size_t* size, Node* node);
-void ast_node_erase(void** children, size_t* size, size_t index);
+void ast_stack_push(NodeStack* stack, Node* node);
+void ast_stack_free(NodeStack* stack);
 
 #endif // AST_H
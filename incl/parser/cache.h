@@ -0,0 +1,35 @@
+#ifndef PARSER_CACHE_H
+#define PARSER_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "parser/flat.h"
+
+// A cached tree mapped read-only from its file or shared from memory
+typedef struct {
+  FlatAst ast;
+  void *map;
+  size_t map_size;
+  struct MemoryEntry *shared;
+} CacheEntry;
+
+// Caching is off until a directory is set, NULL turns it off again. The
+// directory is created on the first store if it doesn't exist.
+void cache_set_dir(const char *dir);
+// Keeps up to max_bytes of the most recently used trees in memory in front
+// of the directory, or on their own if no directory is set. Trees loaded from
+// memory are shared until they are closed, so evicting one waits for that.
+// 0 turns it off again and drops what isn't in use.
+void cache_set_memory(size_t max_bytes);
+bool cache_enabled(void);
+// Hashes the contents of a source together with the cache format
+uint64_t cache_key(string_t src);
+// Maps the tree cached under the key, returns false on a miss
+bool cache_load(uint64_t key, string_t src, CacheEntry *entry);
+void cache_close(CacheEntry *entry);
+// Stores the tree parsed from the source, failures only mean a later miss
+void cache_store(uint64_t key, string_t src, const FlatAst *ast);
+
+#endif // PARSER_CACHE_H
@@ -0,0 +1,54 @@
+#ifndef PARSER_DOCUMENT_H
+#define PARSER_DOCUMENT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "common/arena.h"
+#include "lexer/buffer.h"
+#include "parser/ast.h"
+
+/* A document is a source split into segments of whole top-level statements.
+ * Every segment owns a copy of its text, its tokens and the nodes of its
+ * statements, so an edit only relexes and reparses the segments it touches
+ * and leaves every other subtree where it is. A segment starts right after
+ * the last token of the one before it, which keeps whitespace and comments
+ * from ever spanning two segments.
+ *
+ * Text that doesn't parse is kept in segments without a block. Edits next to
+ * them reparse them together with the edited text, so that for example an
+ * "end" typed after an unfinished "do" completes it.
+ */
+typedef struct {
+  // Null-terminated copy of this part of the source
+  char*          text;
+  size_t         size;
+  // Offsets are relative to text and the last token is EOF
+  token_buffer_t tokens;
+  arena_t        arena;
+  // The statements of the segment or NULL if they don't parse
+  BlockNode*     block;
+} Segment;
+
+typedef struct {
+  Segment*       segments;
+  size_t         count;
+  size_t         capacity;
+  // Length of the whole source
+  size_t         size;
+  // Count of segments that don't parse
+  size_t         broken;
+  // Identifiers of every segment, which keep their symbols across edits
+  symbol_table_t symbols;
+} Document;
+
+// Lexes and parses a whole source into a new document, sizes never count a null terminator
+Document document_open(string_t text);
+// Replaces removed bytes at offset with text, returns whether the document parses afterwards
+bool document_edit(Document* doc, size_t offset, size_t removed, string_t text);
+bool document_valid(const Document* doc);
+// Gathers all statements into one block, which is valid until the next edit
+Node* document_ast(const Document* doc, arena_t* arena);
+void document_free(Document* doc);
+
+#endif // PARSER_DOCUMENT_H
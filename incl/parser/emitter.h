@@ -0,0 +1,31 @@
+#ifndef AST_EMITTER_H
+#define AST_EMITTER_H
+
+#include "parser/ast.h"
+
+#include <stdio.h>
+
+typedef enum {
+  // The indented form of ast_print
+  EMIT_PRETTY,
+  // One object per node with its kind in "type" and its fields by name
+  EMIT_JSON,
+  // One list per node headed by its operator or kind
+  EMIT_SEXPR
+} EmitFormat;
+
+/* The tree is walked with an explicit stack, so a deep tree costs heap rather
+ * than stack while it's written. How deep a tree gets is up to the parser,
+ * which rejects sources that nest too deeply. Output collects in a buffer
+ * that every thread keeps from one tree to the next. Once the stream is
+ * flushed, the buffer goes out in large `write`s to its descriptor, or in
+ * `fwrite`s to streams that have none, like memory streams.
+ */
+
+// Writes the tree followed by a newline to the stream
+void ast_emit(Node* root, EmitFormat format, FILE* out);
+
+// Frees the buffer and stack that ast_emit keeps for the calling thread
+void ast_emit_release(void);
+
+#endif // AST_EMITTER_H
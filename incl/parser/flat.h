@@ -0,0 +1,78 @@
+#ifndef AST_FLAT_H
+#define AST_FLAT_H
+
+#include "parser/ast.h"
+
+#include <stdint.h>
+
+// Handle of a node in a FlatAst, the root is always 0
+typedef uint32_t NodeRef;
+
+// Stands in for an absent child, like the otherwise branch of an if
+#define NODE_NONE UINT32_MAX
+
+/* An AST stored as parallel arrays indexed by NodeRef. Nodes are numbered in
+ * pre-order, so every child has a higher index than its parent. The children
+ * of a node are the `counts[i]` handles in `links` starting at `firsts[i]`,
+ * in the same order as the fields of the matching pointer node.
+ *
+ * `values` holds the literal of numbers and bools. Named nodes store the
+ * offset of the name into the source in the low and its length in the high
+ * half, and their symbol in `symbols`. Those are numbered like the lexer
+ * numbers the identifiers of the source, which is the same every time it's
+ * lexed, so a tree rebuilt from the cache needs no interning. `ops` holds the
+ * OpType of operators and the type token of vars.
+ *
+ * Every array lives in the single block `data`, so copying `bytes` bytes of
+ * it copies the whole tree.
+ */
+typedef struct {
+  void*      data;
+  size_t     bytes;
+  uint32_t   size;
+  uint32_t   link_count;
+  uint64_t*  values;
+  uint32_t*  firsts;
+  uint32_t*  counts;
+  symbol_t*  symbols;
+  NodeRef*   links;
+  uint8_t*   kinds;
+  uint8_t*   ops;
+} FlatAst;
+
+// Called on every node of a walk, before or after its children
+typedef void (*FlatVisitor)(const FlatAst* ast, NodeRef node, void* data);
+
+// Size of the block holding a tree of the given dimensions
+size_t flat_bytes(uint32_t size, uint32_t link_count);
+// Points the arrays into a block of flat_bytes(size, link_count) bytes
+void flat_attach(FlatAst* ast, void* data, uint32_t size, uint32_t link_count);
+// Names of the tree point into src, which has to outlive the FlatAst
+FlatAst flat_from_tree(Node* root, const char* src);
+// Builds the pointer tree again, allocating from the arena
+Node* flat_to_tree(const FlatAst* ast, arena_t* arena, const char* src);
+void flat_free(FlatAst* ast);
+// Checks that a tree from an untrusted block can be walked safely over a source of src_size bytes
+bool flat_validate(const FlatAst* ast, size_t src_size);
+
+// Visits the subtree of root depth first without recursing, either visitor may be NULL
+void flat_walk(const FlatAst* ast, NodeRef root, FlatVisitor enter, FlatVisitor leave, void* data);
+
+static inline NodeType flat_kind(const FlatAst* ast, NodeRef node) {
+  return (NodeType)ast->kinds[node];
+}
+
+static inline uint32_t flat_child_count(const FlatAst* ast, NodeRef node) {
+  return ast->counts[node];
+}
+
+static inline NodeRef flat_child(const FlatAst* ast, NodeRef node, uint32_t index) {
+  return ast->links[ast->firsts[node] + index];
+}
+
+static inline string_t flat_name(const FlatAst* ast, const char* src, NodeRef node) {
+  uint64_t value = ast->values[node];
+  return (string_t){ .size = value >> 32, .string = (char*)&src[(uint32_t)value] };
+}
+
+#endif // AST_FLAT_H
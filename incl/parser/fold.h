@@ -0,0 +1,29 @@
+#ifndef AST_FOLD_H
+#define AST_FOLD_H
+
+#include "parser/ast.h"
+
+#include <stdio.h>
+
+/* Numbers fold as 64-bit two's complement integers that wrap on overflow,
+ * division truncates towards zero. A constant is a number, a bool or the
+ * negation of a number, which is how negative results are stored.
+ *
+ * Besides folding, operations that don't change their operand like `x * 1`
+ * or `x + 0` are dropped if `x` is known to be a number, and `x and true` if
+ * it's known to be a bool, so that the result prints the same. Ones that
+ * always give the same result like `x * 0` are replaced by it if `x` has no
+ * side effects. `and` and `or`
+ * short-circuit, so `false and f()` is false without calling f.
+ */
+
+// Folds the tree in a single bottom-up pass, rewriting it in place and
+// allocating new nodes from the arena. Types aren't checked here, so whether
+// a program is accepted doesn't depend on folding: operations on constants of
+// the wrong kind, like a bool added to a number, are left as they are. So are
+// divisions by a constant zero, for the program to trap on, with a warning to
+// out for each one that isn't in a branch that a constant rules out. Returns
+// the new root.
+Node* ast_fold(Node* root, arena_t* arena, FILE* out);
+
+#endif // AST_FOLD_H
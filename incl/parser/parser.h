@@ -3,15 +3,48 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
 
 #include "parser/ast.h"
+#include "parser/flat.h"
 
+/* A parser reads the source and tokens of its lexer. Parsing on one thread
+ * keeps its working state in thread-local storage, so any number of threads
+ * can parse with parsers of their own at the same time.
+ */
 typedef struct {
-  char *input;
-  size_t pos;
+  // Where the source and its tokens come from
+  lexer_t *lexer;
+  // Whether the tree is folded once it's parsed
+  bool fold;
+  // Threads to parse large inputs with, 0 uses one per processor
+  size_t threads;
+  // Where syntax errors and the warnings of folding are reported
+  FILE *errors;
+  // The tree of the current parse, owned by the arena
   Node *ast;
+  arena_t arena;
 } Parser;
 
-void parser_start(void);
+// Creates a parser of the lexer's source with folding enabled, one thread
+// per processor and errors going to stderr
+Parser parser_new(lexer_t *lexer);
+void parser_set_fold(Parser *parser, bool enabled);
+void parser_set_threads(Parser *parser, size_t threads);
+void parser_set_errors(Parser *parser, FILE *errors);
+// Parses the loaded source and hands the tree to consume, which doesn't own
+// it. Returns false without calling consume if the source doesn't parse,
+// which is reported to the parser's errors.
+bool parser_start(Parser *parser, void (*consume)(Node *ast, void *data), void *data);
+
+// Parses a token stream that ends in EOF as a block, allocating from the
+// arena. Returns NULL instead of reporting an error if it doesn't parse.
+Node* parser_parse_tokens(const struct token_buffer* tokens, const char* src, arena_t* arena);
+// Groups the tokens before EOF into runs of whole top-level statements of at
+// least grain tokens and stores the index one past the last token of each.
+// The last run also takes any tokens after the last statement. Returns the
+// number of runs, at most max_runs, or 0 if the tokens don't nest properly.
+size_t parser_split_statements(const struct token_buffer* tokens, size_t* ends,
+  size_t max_runs, size_t grain);
 
 #endif // PARSER_H
\ No newline at end of file
@@ -0,0 +1,92 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "common/io.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Requests and responses go over a Unix domain socket, in the byte order of
+ * the machine since both ends run on it. A request is a 32-bit count of
+ * arguments, each a 32-bit size followed by its bytes, then a 64-bit size of
+ * the inline source followed by its bytes or all ones if there is none. A
+ * response is the 32-bit exit status and 32 reserved bits, the 64-bit sizes
+ * of the output and the errors, and then the bytes of both. A connection
+ * carries any number of requests one after another.
+ */
+
+/** A compile request, made of the same arguments that the compiler takes on
+  * its command line.
+  */
+typedef struct server_request {
+	/// The options and paths, each null-terminated, followed by NULL.
+	char **args;
+	size_t arg_count;
+	/// Source to compile in place of a path, following the contract of
+	/// `str_read`, or empty. A handler may take it over by emptying it.
+	string_t source;
+} server_request_t;
+
+/** What compiling a request printed and how it ended. */
+typedef struct server_response {
+	int status;
+	/// Heap-allocated bytes without a null terminator, that the server frees
+	/// once they are sent. Either may be empty.
+	string_t out;
+	string_t errors;
+} server_response_t;
+
+/** Compiles a request on whichever worker thread it was handed to. */
+typedef void (*server_handler_t)(server_request_t *request, server_response_t *response, void *data);
+
+/** Creates a socket at the given path to listen for clients on. A socket
+  * that is left over from a server that's gone is replaced, but one that
+  * another server still listens on is not.
+  * @param socket_path Where the socket goes in the file system.
+  * @return The listening descriptor or -1 with errno set.
+  */
+int server_listen(const char *socket_path);
+
+/** Serves clients until the listener breaks. The calling thread waits on
+  * every connection at once and hands each request to a pool of workers
+  * once all of it has come, so an idle client doesn't keep a worker. A
+  * connection has one request answered at a time, which keeps its responses
+  * in order, and is closed if the client leaves it idle or stops in the
+  * middle of sending a request or taking a response for too long. Running
+  * out of descriptors or memory only holds new clients back for a moment.
+  * The workers stay the same threads for as long as the server runs, so
+  * what a handler keeps in thread-local storage stays warm between requests.
+  * @param listener The result of `server_listen`.
+  * @param workers Count of worker threads, at least 1.
+  * @param handler Compiles each request.
+  * @param data Passed on to the handler.
+  */
+void server_run(int listener, size_t workers, server_handler_t handler, void *data);
+
+/** Connects to a server.
+  * @param socket_path The path the server listens on.
+  * @return The connected descriptor or -1 with errno set.
+  */
+int server_connect(const char *socket_path);
+
+/** Sends a request to the server on the other end.
+  * @param fd The result of `server_connect`.
+  * @param request The request to send, the source of which may be empty.
+  * @return Whether it was sent, otherwise errno is set.
+  */
+bool server_send(int fd, const server_request_t *request);
+
+/** Waits for the response to the oldest request sent that wasn't answered.
+  * @param fd The result of `server_connect`.
+  * @param response Receives the response, which is freed with
+  *                 `server_response_free`.
+  * @return Whether a whole response came, otherwise errno is set.
+  */
+bool server_receive(int fd, server_response_t *response);
+
+/** Frees the output and errors of a response and leaves them empty.
+  * @param response The response to free.
+  */
+void server_response_free(server_response_t *response);
+
+#endif // SERVER_H
@@ -0,0 +1,145 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include "lower/lower.h"	// value_type_t
+#include "parser/ast.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Instructions are 64-bit words of an 8-bit opcode and three 16-bit
+ * operands A, B and C, of which B and C may also be taken together as one
+ * signed 32-bit operand sBx. R(X) is the register with the index X and
+ * jumps are relative to the instruction after them.
+ *
+ * Literals that don't fit into an immediate operand live in read-only
+ * registers at the top of the register file, constants[k] in R(K(k)), so
+ * that instructions take them like any other operand.
+ */
+#define FOREACH_OPCODE(FN) \
+	FN(MOVE)     /* R(A) = R(B) */ \
+	FN(LOADI)    /* R(A) = sBx */ \
+	FN(ADD)      /* R(A) = R(B) + R(C) */ \
+	FN(ADDI)     /* R(A) = R(B) + sC */ \
+	FN(SUB)      /* R(A) = R(B) - R(C) */ \
+	FN(MUL)      /* R(A) = R(B) * R(C) */ \
+	FN(DIV)      /* R(A) = R(B) / R(C) */ \
+	FN(MOD)      /* R(A) = R(B) % R(C) */ \
+	FN(NEG)      /* R(A) = -R(B) */ \
+	FN(NOT)      /* R(A) = !R(B) */ \
+	FN(EQ)       /* R(A) = R(B) == R(C) */ \
+	FN(NE)       /* R(A) = R(B) != R(C) */ \
+	FN(LT)       /* R(A) = R(B) < R(C) */ \
+	FN(LE)       /* R(A) = R(B) <= R(C) */ \
+	FN(JMP)      /* jump by sBx */ \
+	FN(JMPF)     /* jump by sBx if R(A) is false */ \
+	FN(JMPT)     /* jump by sBx if R(A) is true */ \
+	FN(JEQ)      /* jump by sA if R(B) == R(C) */ \
+	FN(JNE)      /* jump by sA if R(B) != R(C) */ \
+	FN(JLT)      /* jump by sA if R(B) < R(C) */ \
+	FN(JLE)      /* jump by sA if R(B) <= R(C) */ \
+	FN(CHECKNAT) /* fail if R(A) is negative */ \
+	FN(CALL)     /* R(A) = the call calls[Bx] with arguments from R(A) on */ \
+	FN(RETURN)   /* stop with R(A) as the result */
+
+#define GENERATE_OPCODE_ENUM(NAME) BC_##NAME,
+#define GENERATE_OPCODE_STRS(NAME) #NAME,
+
+extern const char *opcode_strs[];
+typedef enum opcode {
+	FOREACH_OPCODE(GENERATE_OPCODE_ENUM)
+	BC_COUNT
+} opcode_t;
+
+#define BC_ENCODE(op, a, b, c) ((uint64_t) (op) | (uint64_t) (uint16_t) (a) << 16 \
+	| (uint64_t) (uint16_t) (b) << 32 | (uint64_t) (uint16_t) (c) << 48)
+#define BC_ENCODE_BX(op, a, bx) ((uint64_t) (op) | (uint64_t) (uint16_t) (a) << 16 \
+	| (uint64_t) (uint32_t) (bx) << 32)
+#define BC_OP(i) ((opcode_t) ((i) & 0xff))
+#define BC_A(i) ((uint16_t) ((i) >> 16))
+#define BC_SA(i) ((int16_t) ((i) >> 16))
+#define BC_B(i) ((uint16_t) ((i) >> 32))
+#define BC_C(i) ((uint16_t) ((i) >> 48))
+#define BC_SC(i) ((int16_t) ((i) >> 48))
+#define BC_BX(i) ((uint32_t) ((i) >> 32))
+#define BC_SBX(i) ((int32_t) ((i) >> 32))
+
+/// Registers are operands of 16 bits, constants included.
+#define BC_MAX_REGISTERS 65536
+/// The register holding a constant.
+#define BC_K(k) (BC_MAX_REGISTERS - 1 - (k))
+
+/** A function built into the VM, as programs can't define their own yet.
+  * Receives the arguments of a call and the types they were compiled with.
+  * Returns false after reporting an error to stop the program.
+  */
+typedef bool (*native_fn_t)(int64_t *result, const int64_t *args, size_t count,
+	const uint8_t *types);
+
+typedef struct native {
+	const char *name;
+	/// Count of arguments or -1 if it takes any.
+	int arity;
+	value_type_t result;
+	native_fn_t fn;
+} native_t;
+
+typedef struct call_site {
+	/// Index into the table of natives.
+	uint32_t native;
+	/// Count of arguments, which are in consecutive registers.
+	uint32_t count;
+	/// Offset of the `value_type_t`s of the arguments into `types`.
+	uint32_t types;
+} call_site_t;
+
+/** A compiled program, which runs from the first instruction until it
+  * returns. Create one with `bytecode_compile`.
+  */
+typedef struct bytecode {
+	uint64_t *code;
+	size_t count;
+	size_t capacity;
+	/// Values of the constant registers.
+	int64_t *constants;
+	size_t constant_count;
+	size_t constant_capacity;
+	call_site_t *calls;
+	size_t call_count;
+	size_t call_capacity;
+	/// The argument types of all call sites back to back.
+	uint8_t *types;
+	size_t type_count;
+	size_t type_capacity;
+	/// Count of registers the program uses at most, not counting constants.
+	size_t registers;
+} bytecode_t;
+
+/** Compiles a tree as the body of a program, whose result is the value it
+  * returns or nil if it runs to the end. Names of the tree are looked
+  * up in the table of natives. Threads can compile at the same time.
+  * @param ast The block of the program.
+  * @param natives The functions that calls refer to.
+  * @param native_count Count of `natives`.
+  * @param errors Where to report errors like undeclared variables.
+  * @param code Where to store the program.
+  * @return Whether compiling succeeded, `code` is empty if it didn't.
+  */
+bool bytecode_compile(
+	Node *ast, const native_t *natives, size_t native_count, FILE *errors, bytecode_t *code
+);
+
+/** Prints every instruction of a program with its operands.
+  * @param code The program to print.
+  * @param out The stream to print to.
+  */
+void bytecode_print(const bytecode_t *code, FILE *out);
+
+/** `free`s every array of a program and leaves it empty.
+  * @param code The program to free.
+  */
+void bytecode_free(bytecode_t *code);
+
+#endif // BYTECODE_H
@@ -0,0 +1,34 @@
+#ifndef VM_H
+#define VM_H
+
+#include "bytecode.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/// The natives every program can call: `print` writes its arguments to the
+/// output of `vm_run` and `assert` stops the program if its argument is false.
+extern const native_t vm_natives[];
+extern const size_t vm_native_count;
+
+/** Limits how long every program that starts after this may run, so that
+  * one that loops forever is stopped with an error. Programs have no limit
+  * by default. Not meant to be called while programs run.
+  * @param milliseconds The longest a program may run, 0 for no limit.
+  */
+void vm_set_time_limit(uint32_t milliseconds);
+
+/** Runs a program compiled against `vm_natives` until it returns. Runtime
+  * errors like dividing by zero or running out of time are reported and stop
+  * it. Threads can run programs at the same time.
+  * @param code The program to run.
+  * @param out Where the program prints to.
+  * @param errors Where to report runtime errors.
+  * @param result Where to store the value the program returned.
+  * @return Whether the program ran without errors.
+  */
+bool vm_run(const bytecode_t *code, FILE *out, FILE *errors, int64_t *result);
+
+#endif // VM_H
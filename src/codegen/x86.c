@@ -0,0 +1,968 @@
+#include "x86.h"
+
+#include "common/array.h"
+#include "common/io.h"
+#include "lower/lower.h"
+
+#include <inttypes.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Virtual register standing in for a value that isn't needed
+#define NO_VREG UINT32_MAX
+
+typedef enum ir_op {
+	IR_MOV,     // dst = a
+	IR_ADD,     // dst = a + b
+	IR_SUB,     // dst = a - b
+	IR_MUL,     // dst = a * b
+	IR_DIV,     // dst = a / b, b is neither zero nor -1 if it's an immediate
+	IR_MOD,     // dst = a % b, likewise
+	IR_NEG,     // dst = -a
+	IR_NOT,     // dst = a == 0
+	IR_SET,     // dst = a cond b
+	IR_JMP,     // jump to label
+	IR_JCC,     // jump to label if a cond b
+	IR_LABEL,   // target of jumps
+	IR_FAIL,    // stop with the error label if a cond b
+	IR_PRINT,   // print the count arguments from label on
+	IR_RET      // return a
+} ir_op_t;
+
+// Conditions in the order of the comparison operators from OP_EQ on
+typedef enum cond {
+	COND_EQ, COND_NE, COND_LT, COND_LE, COND_GT, COND_GE
+} cond_t;
+
+static const char *cond_suffixes[] = { "e", "ne", "l", "le", "g", "ge" };
+static const cond_t cond_negations[] = { COND_NE, COND_EQ, COND_GE, COND_GT, COND_LE, COND_LT };
+
+// Runtime errors, which print their message and exit
+typedef enum failure {
+	FAIL_DIVISION, FAIL_NAT, FAIL_ASSERT, FAIL_COUNT
+} failure_t;
+
+static const char *failure_names[] = { "division", "nat", "assert" };
+static const char *failure_messages[] = {
+	"Division by zero\\n", "Negative value for nat\\n", "Assertion failed\\n"
+};
+
+/// A virtual register or an immediate, which fits 32 bits unless it's moved.
+typedef struct operand {
+	bool imm;
+	int64_t value;
+} operand_t;
+
+typedef struct instr {
+	ir_op_t op;
+	cond_t cond;
+	uint32_t dst;
+	operand_t a;
+	operand_t b;
+	/// Label of jumps, failure of IR_FAIL or first argument of IR_PRINT.
+	uint32_t label;
+	/// Count of arguments of IR_PRINT.
+	uint32_t count;
+} instr_t;
+
+typedef struct print_arg {
+	operand_t value;
+	value_type_t type;
+} print_arg_t;
+
+typedef struct builtin {
+	const char *name;
+	/// Count of arguments or -1 if it takes any.
+	int arity;
+} builtin_t;
+
+static const builtin_t builtins[] = {
+	{ .name = "print", .arity = -1 },
+	{ .name = "assert", .arity = 1 }
+};
+
+// Registers the allocator hands out, callee-saved ones first. rax, rcx and
+// rdx are left as scratch registers, which division needs anyway.
+static const char *registers[] = {
+	"rbx", "r12", "r13", "r14", "r15", "rsi", "rdi", "r8", "r9", "r10", "r11"
+};
+#define REGISTER_COUNT (sizeof(registers) / sizeof(*registers))
+#define CALLEE_SAVED 5
+
+// Every thread that compiles has its own state
+static __thread struct generator_state {
+	/// Where errors go and which variables are in scope, in virtual registers.
+	lower_t lower;
+	instr_t *code;
+	size_t count;
+	size_t capacity;
+	print_arg_t *args;
+	size_t arg_count;
+	size_t arg_capacity;
+
+	uint32_t vreg_count;
+	uint32_t label_count;
+
+	/// Register of each virtual register or -1 - its stack slot if spilled.
+	int32_t *locations;
+	uint32_t slot_count;
+	/// Bitmask of the registers used, which are saved if callee-saved.
+	uint32_t used_registers;
+	/// Count of callee-saved registers pushed below the frame pointer.
+	int saved_count;
+} gs;
+
+// Internal Functions //
+
+static void _emit(instr_t instr) {
+	if(gs.count == gs.capacity) gs.code = array_grow(gs.code, &gs.capacity, sizeof(instr_t));
+	gs.code[gs.count++] = instr;
+}
+
+static operand_t _imm(int64_t value) {
+	return (operand_t) { .imm = true, .value = value };
+}
+
+static operand_t _vreg(uint32_t vreg) {
+	return (operand_t) { .imm = false, .value = vreg };
+}
+
+static uint32_t _new_vreg(void) {
+	if(gs.vreg_count == NO_VREG) lower_error(&gs.lower, "Program too large\n");
+	return gs.vreg_count++;
+}
+
+static uint32_t _new_label(void) {
+	return gs.label_count++;
+}
+
+static void _emit_op(ir_op_t op, uint32_t dst, operand_t a, operand_t b) {
+	_emit((instr_t) { .op = op, .dst = dst, .a = a, .b = b });
+}
+
+static void _emit_mov(uint32_t dst, operand_t a) {
+	if(dst != NO_VREG && (a.imm || (uint32_t) a.value != dst)) _emit_op(IR_MOV, dst, a, _imm(0));
+}
+
+static void _emit_jump(ir_op_t op, cond_t cond, operand_t a, operand_t b, uint32_t label) {
+	_emit((instr_t) { .op = op, .cond = cond, .dst = NO_VREG, .a = a, .b = b, .label = label });
+}
+
+static void _emit_label(uint32_t label) {
+	_emit((instr_t) { .op = IR_LABEL, .dst = NO_VREG, .a = _imm(0), .b = _imm(0), .label = label });
+}
+
+static value_type_t _expr(Node *node, uint32_t dst);
+
+// Returns an operand holding the value of the node, lowering it into a new
+// temporary unless it's a variable or a literal that fits an immediate
+static operand_t _operand(Node *node, value_type_t *type) {
+	int64_t value;
+	if(lower_literal(node, &value) && value >= INT32_MIN && value <= INT32_MAX) {
+		if(type) *type = VALUE_NUMBER;
+		return _imm(value);
+	}
+	if(node->type == NODE_BOOL) {
+		if(type) *type = VALUE_BOOL;
+		return _imm(((BoolNode *) node)->value);
+	}
+	if(node->type == NODE_IDENT) {
+		const lower_var_t *var = lower_lookup(&gs.lower, (IdentNode *) node);
+		if(type) *type = var->type;
+		return _vreg(var->reg);
+	}
+	uint32_t vreg = _new_vreg();
+	value_type_t result = _expr(node, vreg);
+	if(type) *type = result;
+	return _vreg(vreg);
+}
+
+// Puts both operands of a binary operation into operands, left first
+static void _operands(BinaryOpNode *node, operand_t *left, operand_t *right) {
+	if(lower_copies_left(node)) {
+		// a variable on the left is copied in case the right side changes it
+		uint32_t vreg = _new_vreg();
+		_expr(node->left, vreg);
+		*left = _vreg(vreg);
+	} else *left = _operand(node->left, NULL);
+	*right = _operand(node->right, NULL);
+}
+
+static void _jump(size_t *label) {
+	_emit_jump(IR_JMP, COND_EQ, _imm(0), _imm(0), (uint32_t) *label);
+}
+
+// Compares without materializing the comparison as a value
+static void _test(Node *node, bool when, size_t *label) {
+	BinaryOpNode *compare = (BinaryOpNode *) node;
+	if(node->type == NODE_BINARY_OP && compare->op >= OP_EQ && compare->op <= OP_GE) {
+		operand_t left, right;
+		_operands(compare, &left, &right);
+		cond_t cond = compare->op - OP_EQ;
+		_emit_jump(IR_JCC, when ? cond : cond_negations[cond], left, right, (uint32_t) *label);
+		return;
+	}
+	operand_t value = _operand(node, NULL);
+	_emit_jump(IR_JCC, when ? COND_NE : COND_EQ, value, _imm(0), (uint32_t) *label);
+}
+
+static size_t _new_target(void) {
+	return _new_label();
+}
+
+static void _place(size_t label) {
+	_emit_label((uint32_t) label);
+}
+
+// Conditions jump to labels
+static const lower_jumps_t jumps = {
+	.jump = _jump, .test = _test, .new_target = _new_target, .place = _place
+};
+
+// Lowers a condition into jumps to a label that are taken if it has the
+// given truth value and fall through otherwise
+static void _branch(Node *node, bool when, uint32_t label) {
+	size_t target = label;
+	lower_branch(&jumps, node, when, &target);
+}
+
+static void _check_nat(uint32_t vreg) {
+	_emit((instr_t) {
+		.op = IR_FAIL, .cond = COND_LT, .dst = NO_VREG, .a = _vreg(vreg), .b = _imm(0), .label = FAIL_NAT
+	});
+}
+
+// Lowers a division, checking for a divisor of zero and -1, which would trap
+static void _divide(ir_op_t op, uint32_t dst, operand_t left, operand_t right) {
+	if(right.imm && right.value == -1) {
+		if(op == IR_DIV) _emit_op(IR_NEG, dst, left, _imm(0));
+		else _emit_mov(dst, _imm(0));
+		return;
+	}
+	if(right.imm && right.value == 0) {
+		uint32_t vreg = _new_vreg();
+		_emit_mov(vreg, right);
+		right = _vreg(vreg);
+	}
+	if(!right.imm) {
+		_emit((instr_t) {
+			.op = IR_FAIL, .cond = COND_EQ, .dst = NO_VREG, .a = right, .b = _imm(0), .label = FAIL_DIVISION
+		});
+	}
+	_emit_op(op, dst, left, right);
+}
+
+static value_type_t _assign(BinaryOpNode *node, uint32_t dst) {
+	if(node->left->type != NODE_IDENT) lower_error(&gs.lower, "Can only assign to variables\n");
+	// a copy, as the right side may declare variables and move the others
+	lower_var_t var = *lower_lookup(&gs.lower, (IdentNode *) node->left);
+	int64_t value;
+	bool checked = false;
+
+	if(node->op == OP_ASSIGN) {
+		checked = node->right->type == NODE_NUMBER;
+		if(lower_writes_late(node->right)) {
+			_expr(node->right, var.reg);
+		} else {
+			uint32_t vreg = _new_vreg();
+			_expr(node->right, vreg);
+			_emit_mov(var.reg, _vreg(vreg));
+		}
+	} else {
+		static const ir_op_t ops[] = { IR_ADD, IR_SUB, IR_MUL, IR_DIV, IR_MOD };
+		ir_op_t op = ops[node->op - OP_ASSIGN_ADD];
+		if(lower_literal(node->right, &value)) {
+			checked = (op == IR_ADD && value >= 0) || (op == IR_SUB && value <= 0);
+		}
+		// the variable is read after the value is evaluated
+		operand_t right = _operand(node->right, NULL);
+		if(op == IR_DIV || op == IR_MOD) _divide(op, var.reg, _vreg(var.reg), right);
+		else _emit_op(op, var.reg, _vreg(var.reg), right);
+	}
+
+	if(var.nat && !checked) _check_nat(var.reg);
+	_emit_mov(dst, _vreg(var.reg));
+	return var.type;
+}
+
+// Lowers an arithmetic operation or comparison whose left operand is lowered
+// already, the right one is evaluated after it
+static value_type_t _operate(BinaryOpNode *node, uint32_t target, operand_t left) {
+	operand_t right = _operand(node->right, NULL);
+	if(node->op >= OP_EQ && node->op <= OP_GE) {
+		_emit((instr_t) { .op = IR_SET, .cond = node->op - OP_EQ, .dst = target, .a = left, .b = right });
+		return VALUE_BOOL;
+	}
+	switch(node->op) {
+		case OP_ADD: _emit_op(IR_ADD, target, left, right); break;
+		case OP_SUB: _emit_op(IR_SUB, target, left, right); break;
+		case OP_MUL: _emit_op(IR_MUL, target, left, right); break;
+		case OP_DIV: _divide(IR_DIV, target, left, right); break;
+		case OP_MOD: _divide(IR_MOD, target, left, right); break;
+		default: break;
+	}
+	return VALUE_NUMBER;
+}
+
+static value_type_t _binary_op(BinaryOpNode *node, uint32_t dst) {
+	if(node->op <= OP_ASSIGN_MOD) return _assign(node, dst);
+	uint32_t target = dst != NO_VREG ? dst : _new_vreg();
+	// a chain like `a + b - c` is lowered from its innermost operation out
+	NodeStack *chain = &gs.lower.chain;
+	size_t outer = chain->size;
+	lower_push_chain(&gs.lower, node);
+	BinaryOpNode *inner = (BinaryOpNode *) chain->nodes[chain->size - 1];
+	value_type_t type;
+
+	if(node->op == OP_AND || node->op == OP_OR) {
+		// the value of the operand that decided it is the result
+		type = _expr(inner->left, target);
+		for(size_t i = chain->size; i-- > outer;) {
+			BinaryOpNode *logical = (BinaryOpNode *) chain->nodes[i];
+			uint32_t skip = _new_label();
+			_emit_jump(IR_JCC, logical->op == OP_AND ? COND_EQ : COND_NE, _vreg(target), _imm(0), skip);
+			_expr(logical->right, target);
+			_emit_label(skip);
+		}
+		chain->size = outer;
+		return type;
+	}
+
+	operand_t left;
+	if(lower_copies_left(inner)) {
+		// a variable on the left is copied in case the right side changes it
+		uint32_t vreg = _new_vreg();
+		_expr(inner->left, vreg);
+		left = _vreg(vreg);
+	} else left = _operand(inner->left, NULL);
+	// the operations inside the outermost one get a temporary each, as the
+	// target may be a variable that the chain reads
+	for(size_t i = chain->size; i-- > outer;) {
+		uint32_t partial = i == outer ? target : _new_vreg();
+		type = _operate((BinaryOpNode *) chain->nodes[i], partial, left);
+		left = _vreg(partial);
+	}
+	chain->size = outer;
+	return type;
+}
+
+static value_type_t _call(CallNode *node, uint32_t dst) {
+	size_t builtin = 0, builtin_count = sizeof(builtins) / sizeof(*builtins);
+	while(builtin < builtin_count && (strlen(builtins[builtin].name) != node->name.size
+		|| memcmp(builtins[builtin].name, node->name.string, node->name.size))) builtin++;
+	if(builtin == builtin_count) {
+		lower_error(&gs.lower, "Unknown function %.*s\n", (int) node->name.size, node->name.string);
+	}
+	const builtin_t *fn = &builtins[builtin];
+	if(fn->arity >= 0 && (size_t) fn->arity != node->size) {
+		lower_error(&gs.lower, "%s takes %d arguments but got %zu\n", fn->name, fn->arity, node->size);
+	}
+
+	// the arguments are reserved up front, as they may contain calls too
+	Node **args = (Node **) node->args;
+	size_t first = gs.arg_count;
+	while(gs.arg_count + node->size > gs.arg_capacity) {
+		gs.args = array_grow(gs.args, &gs.arg_capacity, sizeof(print_arg_t));
+	}
+	gs.arg_count += node->size;
+	for(size_t i = 0; i < node->size; i++) {
+		// variables are copied if a later argument could change them
+		bool later_leaves = true;
+		for(size_t j = i + 1; j < node->size; j++) later_leaves &= lower_is_leaf(args[j]);
+		value_type_t type;
+		operand_t value;
+		if(args[i]->type == NODE_IDENT && !later_leaves) {
+			uint32_t vreg = _new_vreg();
+			type = _expr(args[i], vreg);
+			value = _vreg(vreg);
+		} else value = _operand(args[i], &type);
+		gs.args[first + i] = (print_arg_t) { .value = value, .type = type };
+	}
+
+	// print is lowered to calls into the runtime and assert to a check
+	if(builtin == 0) {
+		_emit((instr_t) {
+			.op = IR_PRINT, .dst = NO_VREG, .a = _imm(0), .b = _imm(0), .label = first, .count = node->size
+		});
+	} else {
+		_emit((instr_t) {
+			.op = IR_FAIL, .cond = COND_EQ, .dst = NO_VREG,
+			.a = gs.args[first].value, .b = _imm(0), .label = FAIL_ASSERT
+		});
+	}
+	_emit_mov(dst, _imm(0));
+	return VALUE_NIL;
+}
+
+static value_type_t _var(VarNode *node, uint32_t dst) {
+	// the variable only comes into scope after its value
+	uint32_t vreg = _new_vreg();
+	_expr(node->value, vreg);
+	bool nat = node->var_type == TOK_TYPE_NAT;
+	if(nat && node->value->type != NODE_NUMBER) _check_nat(vreg);
+
+	value_type_t type = node->var_type == TOK_TYPE_BOOL ? VALUE_BOOL : VALUE_NUMBER;
+	lower_declare(&gs.lower, (lower_var_t) {
+		.name = node->name, .symbol = node->symbol, .reg = vreg, .type = type, .nat = nat
+	});
+	_emit_mov(dst, _vreg(vreg));
+	return type;
+}
+
+static value_type_t _block(BlockNode *node, uint32_t dst) {
+	size_t var_count = gs.lower.var_count;
+	value_type_t type = VALUE_NIL;
+	if(node->size == 0) _emit_mov(dst, _imm(0));
+	for(size_t i = 0; i < node->size; i++) {
+		bool last = i + 1 == node->size;
+		type = _expr(((Node **) node->children)[i], last ? dst : NO_VREG);
+	}
+	lower_leave_scope(&gs.lower, var_count);
+	return type;
+}
+
+static value_type_t _if(IfNode *node, uint32_t dst) {
+	uint32_t otherwise = _new_label();
+	_branch(node->condition, false, otherwise);
+	value_type_t type = _expr(node->then, dst);
+	if(!node->otherwise && dst == NO_VREG) {
+		_emit_label(otherwise);
+		return type;
+	}
+	uint32_t end = _new_label();
+	_emit_jump(IR_JMP, COND_EQ, _imm(0), _imm(0), end);
+	_emit_label(otherwise);
+	if(node->otherwise) _expr(node->otherwise, dst);
+	else _emit_mov(dst, _imm(0));
+	_emit_label(end);
+	return type;
+}
+
+static value_type_t _while(WhileNode *node, uint32_t dst) {
+	// the condition goes last so that every iteration takes a single jump
+	uint32_t body = _new_label(), test = _new_label();
+	_emit_jump(IR_JMP, COND_EQ, _imm(0), _imm(0), test);
+	_emit_label(body);
+	_expr(node->body, NO_VREG);
+	_emit_label(test);
+	_branch(node->condition, true, body);
+	_emit_mov(dst, _imm(0));
+	return VALUE_NIL;
+}
+
+/** Lowers a node into the instructions that compute its value.
+  * @param node The node to lower.
+  * @param dst The virtual register to store the value in or NO_VREG.
+  * @return The type of the value.
+  */
+static value_type_t _expr(Node *node, uint32_t dst) {
+	switch(node->type) {
+		case NODE_NUMBER:
+			_emit_mov(dst, _imm((int64_t) ((NumberNode *) node)->value));
+			return VALUE_NUMBER;
+		case NODE_BOOL:
+			_emit_mov(dst, _imm(((BoolNode *) node)->value));
+			return VALUE_BOOL;
+		case NODE_NIL:
+			_emit_mov(dst, _imm(0));
+			return VALUE_NIL;
+		case NODE_IDENT: {
+			const lower_var_t *var = lower_lookup(&gs.lower, (IdentNode *) node);
+			_emit_mov(dst, _vreg(var->reg));
+			return var->type;
+		}
+		case NODE_UNARY_OP: {
+			UnaryOpNode *unary_op = (UnaryOpNode *) node;
+			int64_t value;
+			if(unary_op->op == OP_POS) return _expr(unary_op->operand, dst);
+			if(lower_literal(node, &value)) {
+				_emit_mov(dst, _imm(value));
+				return VALUE_NUMBER;
+			}
+			operand_t operand = _operand(unary_op->operand, NULL);
+			bool negate = unary_op->op == OP_NEG;
+			if(dst != NO_VREG) _emit_op(negate ? IR_NEG : IR_NOT, dst, operand, _imm(0));
+			return negate ? VALUE_NUMBER : VALUE_BOOL;
+		}
+		case NODE_BINARY_OP:
+			return _binary_op((BinaryOpNode *) node, dst);
+		case NODE_CALL:
+			return _call((CallNode *) node, dst);
+		case NODE_VAR:
+			return _var((VarNode *) node, dst);
+		case NODE_BLOCK:
+			return _block((BlockNode *) node, dst);
+		case NODE_IF:
+			return _if((IfNode *) node, dst);
+		case NODE_WHILE:
+			return _while((WhileNode *) node, dst);
+		case NODE_RETURN:
+			_emit_op(IR_RET, NO_VREG, _operand(((ReturnNode *) node)->value, NULL), _imm(0));
+			return VALUE_NIL;
+	}
+	return VALUE_NIL;
+}
+
+typedef struct interval {
+	uint32_t vreg;
+	uint32_t start;
+	uint32_t end;
+} interval_t;
+
+static int _by_start(const void *a, const void *b) {
+	const interval_t *left = a, *right = b;
+	if(left->start != right->start) return left->start < right->start ? -1 : 1;
+	return left->vreg < right->vreg ? -1 : left->vreg > right->vreg;
+}
+
+static void _touch(interval_t *intervals, operand_t operand, uint32_t pos) {
+	if(operand.imm) return;
+	interval_t *interval = &intervals[operand.value];
+	if(interval->start == UINT32_MAX) interval->start = pos;
+	interval->end = pos;
+}
+
+// Whether the instruction jumps back to a label before it, which ends a loop
+static bool _jumps_back(const instr_t *instr, const uint32_t *labels, size_t pos) {
+	return (instr->op == IR_JMP || instr->op == IR_JCC) && labels[instr->label] <= pos;
+}
+
+// Finds the first of the sorted positions that comes after pos
+static uint32_t _first_after(const uint32_t *positions, uint32_t count, uint32_t pos) {
+	uint32_t low = 0, high = count;
+	while(low < high) {
+		uint32_t middle = low + (high - low) / 2;
+		if(positions[middle] > pos) high = middle;
+		else low = middle + 1;
+	}
+	return low;
+}
+
+/** Computes the live interval of every virtual register as the range from
+  * its first to its last appearance. Loops extend the intervals that are live
+  * at their start up to their backward jump, as the value is needed again in
+  * the next iteration. Each loop only looks at the intervals live at its start.
+  * @param intervals Where to store one interval per virtual register.
+  */
+static void _live_intervals(interval_t *intervals) {
+	for(uint32_t vreg = 0; vreg < gs.vreg_count; vreg++) {
+		intervals[vreg] = (interval_t) { .vreg = vreg, .start = UINT32_MAX, .end = 0 };
+	}
+	uint32_t *labels = (uint32_t *) malloc((gs.label_count + 1) * sizeof(uint32_t));
+	error_if(labels == NULL);
+	for(size_t pos = 0; pos < gs.count; pos++) {
+		instr_t *instr = &gs.code[pos];
+		_touch(intervals, instr->a, pos);
+		_touch(intervals, instr->b, pos);
+		if(instr->op == IR_PRINT) {
+			for(uint32_t i = 0; i < instr->count; i++) _touch(intervals, gs.args[instr->label + i].value, pos);
+		}
+		if(instr->dst != NO_VREG) _touch(intervals, _vreg(instr->dst), pos);
+		if(instr->op == IR_LABEL) labels[instr->label] = pos;
+	}
+
+	// loops are numbered in order of their starts, loops[label] is the number
+	// of the loop that starts at a label or UINT32_MAX if none does
+	uint32_t *loops = (uint32_t *) malloc((gs.label_count + 1) * sizeof(uint32_t));
+	uint32_t *starts = (uint32_t *) malloc((gs.label_count + 1) * sizeof(uint32_t));
+	error_if(loops == NULL || starts == NULL);
+	for(uint32_t label = 0; label < gs.label_count; label++) loops[label] = UINT32_MAX;
+	for(size_t pos = 0; pos < gs.count; pos++) {
+		if(_jumps_back(&gs.code[pos], labels, pos)) loops[gs.code[pos].label] = 0;
+	}
+	uint32_t loop_count = 0;
+	for(size_t pos = 0; pos < gs.count; pos++) {
+		instr_t *instr = &gs.code[pos];
+		if(instr->op != IR_LABEL || loops[instr->label] == UINT32_MAX) continue;
+		loops[instr->label] = loop_count;
+		starts[loop_count++] = pos;
+	}
+
+	// the intervals live at the start of loop i are live[firsts[i]] up to
+	// live[firsts[i + 1]], they are counted first and then filled in
+	size_t *firsts = (size_t *) calloc(loop_count + 2, sizeof(size_t));
+	error_if(firsts == NULL);
+	for(uint32_t vreg = 0; vreg < gs.vreg_count; vreg++) {
+		const interval_t *interval = &intervals[vreg];
+		if(interval->start == UINT32_MAX) continue;
+		uint32_t loop = _first_after(starts, loop_count, interval->start);
+		for(; loop < loop_count && starts[loop] <= interval->end; loop++) firsts[loop + 2]++;
+	}
+	for(uint32_t loop = 2; loop < loop_count + 2; loop++) firsts[loop] += firsts[loop - 1];
+	uint32_t *live = (uint32_t *) malloc((firsts[loop_count + 1] + 1) * sizeof(uint32_t));
+	error_if(live == NULL);
+	for(uint32_t vreg = 0; vreg < gs.vreg_count; vreg++) {
+		const interval_t *interval = &intervals[vreg];
+		if(interval->start == UINT32_MAX) continue;
+		uint32_t loop = _first_after(starts, loop_count, interval->start);
+		for(; loop < loop_count && starts[loop] <= interval->end; loop++) live[firsts[loop + 1]++] = vreg;
+	}
+
+	// loops nest, so extending them in order of their ends covers enclosing
+	// loops that an extension lands in too
+	for(size_t pos = 0; pos < gs.count; pos++) {
+		instr_t *instr = &gs.code[pos];
+		if(!_jumps_back(instr, labels, pos)) continue;
+		uint32_t loop = loops[instr->label];
+		for(size_t i = firsts[loop]; i < firsts[loop + 1]; i++) {
+			interval_t *interval = &intervals[live[i]];
+			if(interval->end < pos) interval->end = pos;
+		}
+	}
+	free(live);
+	free(firsts);
+	free(starts);
+	free(loops);
+	free(labels);
+}
+
+/** Assigns every virtual register a register or a stack slot with a linear
+  * scan over the live intervals in order of their start. Once no register
+  * is free the interval that ends last is spilled. Intervals that live across
+  * a call only get callee-saved registers.
+  */
+static void _allocate(void) {
+	interval_t *intervals = (interval_t *) malloc((gs.vreg_count + 1) * sizeof(interval_t));
+	// calls[pos] is the count of calls before pos
+	uint32_t *calls = (uint32_t *) malloc((gs.count + 1) * sizeof(uint32_t));
+	gs.locations = (int32_t *) malloc((gs.vreg_count + 1) * sizeof(int32_t));
+	error_if(intervals == NULL || calls == NULL || gs.locations == NULL);
+	_live_intervals(intervals);
+	calls[0] = 0;
+	for(size_t pos = 0; pos < gs.count; pos++) calls[pos + 1] = calls[pos] + (gs.code[pos].op == IR_PRINT);
+	qsort(intervals, gs.vreg_count, sizeof(interval_t), _by_start);
+
+	interval_t *active[REGISTER_COUNT];
+	size_t active_count = 0;
+	uint32_t free_registers = (1u << REGISTER_COUNT) - 1;
+	for(uint32_t i = 0; i < gs.vreg_count && intervals[i].start != UINT32_MAX; i++) {
+		interval_t *current = &intervals[i];
+		// intervals that end where this one starts are only read before it's written
+		size_t kept = 0;
+		for(size_t j = 0; j < active_count; j++) {
+			if(active[j]->end <= current->start) {
+				free_registers |= 1u << gs.locations[active[j]->vreg];
+			} else active[kept++] = active[j];
+		}
+		active_count = kept;
+
+		bool crosses_call = calls[current->end + 1] - calls[current->start + 1] > 0;
+		uint32_t allowed = crosses_call ? (1u << CALLEE_SAVED) - 1 : (1u << REGISTER_COUNT) - 1;
+		uint32_t candidates = free_registers & allowed;
+		if(candidates) {
+			// caller-saved registers are left for intervals that need them less
+			int reg = 0;
+			if(!crosses_call && (candidates >> CALLEE_SAVED)) reg = CALLEE_SAVED;
+			while(!(candidates >> reg & 1)) reg++;
+			free_registers &= ~(1u << reg);
+			gs.used_registers |= 1u << reg;
+			gs.locations[current->vreg] = reg;
+			active[active_count++] = current;
+			continue;
+		}
+
+		size_t victim = active_count;
+		for(size_t j = 0; j < active_count; j++) {
+			if(!(allowed >> gs.locations[active[j]->vreg] & 1)) continue;
+			if(victim == active_count || active[j]->end > active[victim]->end) victim = j;
+		}
+		if(victim < active_count && active[victim]->end > current->end) {
+			gs.locations[current->vreg] = gs.locations[active[victim]->vreg];
+			gs.locations[active[victim]->vreg] = -1 - (int32_t) gs.slot_count++;
+			active[victim] = current;
+		} else gs.locations[current->vreg] = -1 - (int32_t) gs.slot_count++;
+	}
+	free(calls);
+	free(intervals);
+}
+
+// Emission //
+
+static int32_t _location(operand_t operand) {
+	return gs.locations[operand.value];
+}
+
+static bool _in_register(operand_t operand) {
+	return !operand.imm && _location(operand) >= 0;
+}
+
+static bool _in_memory(operand_t operand) {
+	return !operand.imm && _location(operand) < 0;
+}
+
+static bool _same(operand_t a, operand_t b) {
+	return !a.imm && !b.imm && _location(a) == _location(b);
+}
+
+static bool _fits_imm(operand_t operand) {
+	return operand.value >= INT32_MIN && operand.value <= INT32_MAX;
+}
+
+// Offset of a stack slot from the frame pointer, below the saved registers
+static int32_t _slot_offset(int32_t location) {
+	return -8 * (gs.saved_count + (-1 - location) + 1);
+}
+
+static void _print_operand(FILE *out, operand_t operand) {
+	if(operand.imm) fprintf(out, "$%" PRId64, operand.value);
+	else if(_location(operand) >= 0) fprintf(out, "%%%s", registers[_location(operand)]);
+	else fprintf(out, "%" PRId32 "(%%rbp)", _slot_offset(_location(operand)));
+}
+
+// Prints a two-operand instruction
+static void _print_instr(FILE *out, const char *mnemonic, operand_t src, operand_t dst) {
+	fprintf(out, "\t%s ", mnemonic);
+	_print_operand(out, src);
+	fputs(", ", out);
+	_print_operand(out, dst);
+	fputc('\n', out);
+}
+
+static void _load(FILE *out, operand_t operand, const char *reg) {
+	fprintf(out, "\t%s ", operand.imm && !_fits_imm(operand) ? "movabsq" : "movq");
+	_print_operand(out, operand);
+	fprintf(out, ", %%%s\n", reg);
+}
+
+static void _store(FILE *out, const char *reg, uint32_t dst) {
+	fprintf(out, "\tmovq %%%s, ", reg);
+	_print_operand(out, _vreg(dst));
+	fputc('\n', out);
+}
+
+static void _move(FILE *out, uint32_t dst, operand_t src) {
+	operand_t target = _vreg(dst);
+	if(_same(target, src)) return;
+	if(_in_register(target)) {
+		_load(out, src, registers[_location(target)]);
+	} else if(_in_memory(src) || (src.imm && !_fits_imm(src))) {
+		_load(out, src, "rax");
+		_store(out, "rax", dst);
+	} else _print_instr(out, "movq", src, target);
+}
+
+// Compares a to b, a has to be a register or memory and only one of them memory
+static void _compare(FILE *out, operand_t a, operand_t b) {
+	if(a.imm || (_in_memory(a) && _in_memory(b))) {
+		_load(out, a, "rax");
+		fputs("\tcmpq ", out);
+		_print_operand(out, b);
+		fputs(", %rax\n", out);
+		return;
+	}
+	_print_instr(out, "cmpq", b, a);
+}
+
+static void _arithmetic(FILE *out, const char *mnemonic, bool commutative, const instr_t *instr) {
+	operand_t dst = _vreg(instr->dst);
+	if(_in_register(dst) && !_same(dst, instr->b)) {
+		_move(out, instr->dst, instr->a);
+		_print_instr(out, mnemonic, instr->b, dst);
+	} else if(_in_register(dst) && commutative) {
+		_print_instr(out, mnemonic, instr->a, dst);
+	} else {
+		_load(out, instr->a, "rax");
+		fprintf(out, "\t%s ", mnemonic);
+		_print_operand(out, instr->b);
+		fputs(", %rax\n", out);
+		_store(out, "rax", instr->dst);
+	}
+}
+
+static void _division(FILE *out, const instr_t *instr) {
+	bool quotient = instr->op == IR_DIV;
+	if(instr->b.imm) {
+		_load(out, instr->b, "rcx");
+		_load(out, instr->a, "rax");
+		fputs("\tcqto\n\tidivq %rcx\n", out);
+	} else {
+		// INT64_MIN / -1 overflows, which idiv traps on
+		fputs("\tcmpq $-1, ", out);
+		_print_operand(out, instr->b);
+		fputs("\n\tjne 1f\n", out);
+		_load(out, instr->a, "rax");
+		fputs(quotient ? "\tnegq %rax\n" : "\txorl %edx, %edx\n", out);
+		fputs("\tjmp 2f\n1:\n", out);
+		_load(out, instr->a, "rax");
+		fputs("\tcqto\n\tidivq ", out);
+		_print_operand(out, instr->b);
+		fputs("\n2:\n", out);
+	}
+	_store(out, quotient ? "rax" : "rdx", instr->dst);
+}
+
+static void _emit_instr(FILE *out, const instr_t *instr) {
+	switch(instr->op) {
+		case IR_MOV:
+			_move(out, instr->dst, instr->a);
+			break;
+		case IR_ADD:
+			_arithmetic(out, "addq", true, instr);
+			break;
+		case IR_SUB:
+			_arithmetic(out, "subq", false, instr);
+			break;
+		case IR_MUL:
+			_arithmetic(out, "imulq", true, instr);
+			break;
+		case IR_DIV:
+		case IR_MOD:
+			_division(out, instr);
+			break;
+		case IR_NEG:
+			if(_in_register(_vreg(instr->dst))) {
+				_move(out, instr->dst, instr->a);
+				fprintf(out, "\tnegq %%%s\n", registers[_location(_vreg(instr->dst))]);
+			} else {
+				_load(out, instr->a, "rax");
+				fputs("\tnegq %rax\n", out);
+				_store(out, "rax", instr->dst);
+			}
+			break;
+		case IR_NOT:
+		case IR_SET:
+			_compare(out, instr->a, instr->b);
+			fprintf(out, "\tset%s %%al\n\tmovzbl %%al, %%eax\n",
+				cond_suffixes[instr->op == IR_NOT ? COND_EQ : instr->cond]);
+			_store(out, "rax", instr->dst);
+			break;
+		case IR_JMP:
+			fprintf(out, "\tjmp .L%" PRIu32 "\n", instr->label);
+			break;
+		case IR_JCC:
+			_compare(out, instr->a, instr->b);
+			fprintf(out, "\tj%s .L%" PRIu32 "\n", cond_suffixes[instr->cond], instr->label);
+			break;
+		case IR_LABEL:
+			fprintf(out, ".L%" PRIu32 ":\n", instr->label);
+			break;
+		case IR_FAIL:
+			_compare(out, instr->a, instr->b);
+			fprintf(out, "\tj%s .Lfail_%s\n", cond_suffixes[instr->cond], failure_names[instr->label]);
+			break;
+		case IR_PRINT:
+			if(instr->count == 0) fputs("\tmovl $10, %edi\n\tcall putchar@PLT\n", out);
+			for(uint32_t i = 0; i < instr->count; i++) {
+				const print_arg_t *arg = &gs.args[instr->label + i];
+				_load(out, arg->value, "rdi");
+				fprintf(out, "\tmovl $%d, %%esi\n\tmovl $%d, %%edx\n\tcall mart_print\n",
+					(int) arg->type, i + 1 == instr->count);
+			}
+			break;
+		case IR_RET:
+			_load(out, instr->a, "rax");
+			fputs("\tjmp .Lreturn\n", out);
+			break;
+	}
+}
+
+// Prints `print` for one value and `fail` for the runtime errors, both
+// called with a stack aligned to 16 bytes
+static const char runtime[] =
+	"# rdi: value, esi: value_type_t, edx: whether it's the last argument\n"
+	"mart_print:\n"
+	"\tpushq %rbx\n"
+	"\tmovl %edx, %ebx\n"
+	"\tcmpl $1, %esi\n"
+	"\tje 1f\n"
+	"\tja 2f\n"
+	"\tmovq %rdi, %rsi\n"
+	"\tleaq .Lnumber_format(%rip), %rdi\n"
+	"\tjmp 3f\n"
+	"1:\n"
+	"\tleaq .Lfalse(%rip), %rsi\n"
+	"\tleaq .Ltrue(%rip), %rax\n"
+	"\ttestq %rdi, %rdi\n"
+	"\tcmovneq %rax, %rsi\n"
+	"\tleaq .Lstring_format(%rip), %rdi\n"
+	"\tjmp 3f\n"
+	"2:\n"
+	"\tleaq .Lnil(%rip), %rsi\n"
+	"\tleaq .Lstring_format(%rip), %rdi\n"
+	"3:\n"
+	"\txorl %eax, %eax\n"
+	"\tcall printf@PLT\n"
+	"\tmovl $32, %edi\n"
+	"\tmovl $10, %eax\n"
+	"\ttestl %ebx, %ebx\n"
+	"\tcmovnel %eax, %edi\n"
+	"\tcall putchar@PLT\n"
+	"\tpopq %rbx\n"
+	"\tret\n"
+	"\n"
+	"# rdi: message\n"
+	"mart_fail:\n"
+	"\tandq $-16, %rsp\n"
+	"\tmovq stderr@GOTPCREL(%rip), %rax\n"
+	"\tmovq (%rax), %rsi\n"
+	"\tcall fputs@PLT\n"
+	"\tmovl $1, %edi\n"
+	"\tcall exit@PLT\n"
+	"\n"
+	"\t.section .rodata\n"
+	".Lnumber_format:\n"
+	"\t.string \"%ld\"\n"
+	".Lstring_format:\n"
+	"\t.string \"%s\"\n"
+	".Ltrue:\n"
+	"\t.string \"true\"\n"
+	".Lfalse:\n"
+	"\t.string \"false\"\n"
+	".Lnil:\n"
+	"\t.string \"nil\"\n";
+
+static void _emit_program(FILE *out) {
+	// rbp and the saved registers are pushed, the frame keeps the stack aligned
+	for(int reg = 0; reg < CALLEE_SAVED; reg++) gs.saved_count += gs.used_registers >> reg & 1;
+	uint32_t frame = 8 * gs.slot_count;
+	if((8 * gs.saved_count + frame) % 16) frame += 8;
+
+	fputs("\t.text\n\t.globl main\n\t.type main, @function\nmain:\n", out);
+	fputs("\tpushq %rbp\n\tmovq %rsp, %rbp\n", out);
+	for(int reg = 0; reg < CALLEE_SAVED; reg++) {
+		if(gs.used_registers >> reg & 1) fprintf(out, "\tpushq %%%s\n", registers[reg]);
+	}
+	if(frame) fprintf(out, "\tsubq $%" PRIu32 ", %%rsp\n", frame);
+
+	for(size_t pos = 0; pos < gs.count; pos++) _emit_instr(out, &gs.code[pos]);
+
+	fputs(".Lreturn:\n", out);
+	if(gs.saved_count) fprintf(out, "\tleaq -%d(%%rbp), %%rsp\n", 8 * gs.saved_count);
+	else fputs("\tmovq %rbp, %rsp\n", out);
+	for(int reg = CALLEE_SAVED; reg-- > 0;) {
+		if(gs.used_registers >> reg & 1) fprintf(out, "\tpopq %%%s\n", registers[reg]);
+	}
+	fputs("\tpopq %rbp\n\tret\n\t.size main, .-main\n\n", out);
+
+	for(int failure = 0; failure < FAIL_COUNT; failure++) {
+		fprintf(out, ".Lfail_%s:\n\tleaq .Lmessage_%s(%%rip), %%rdi\n\tjmp mart_fail\n",
+			failure_names[failure], failure_names[failure]);
+	}
+	fputs("\n", out);
+	fputs(runtime, out);
+	for(int failure = 0; failure < FAIL_COUNT; failure++) {
+		fprintf(out, ".Lmessage_%s:\n\t.string \"%s\"\n", failure_names[failure], failure_messages[failure]);
+	}
+	fputs("\t.section .note.GNU-stack,\"\",@progbits\n", out);
+}
+
+// External Functions //
+
+bool x86_compile(Node *ast, FILE *out, FILE *errors) {
+	gs = (struct generator_state) { .lower = { .errors = errors }, .code = NULL, .count = 0, .capacity = 0 };
+	volatile bool ok = false;
+	if(!setjmp(gs.lower.fail)) {
+		_expr(ast, NO_VREG);
+		// a program that doesn't return returns nil
+		_emit_op(IR_RET, NO_VREG, _imm(0), _imm(0));
+		_allocate();
+		_emit_program(out);
+		ok = true;
+	}
+	free(gs.code);
+	free(gs.args);
+	lower_free(&gs.lower);
+	free(gs.locations);
+	return ok;
+}
@@ -1,97 +1,250 @@
 #include "arena.h"
 #include "io.h"
+#include "stats.h"
 
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
+
+// Regions stop doubling in size once they hold this many elements (8 MiB)
+#define ARENA_MAX_GROWTH ((size_t) 1 << 20)
+
+// Size of the region header in elements of `data`
+#define REGION_HEADER ((sizeof(region_t) - 1) / sizeof(uintptr_t) + 1)
+
+// Freed regions that are kept to be reused by new ones, shared by all arenas
+// and threads. Regions are pushed onto the list with a compare-and-swap, and
+// taken by swapping out the whole list so that no other thread can pop and
+// push back a region in between, which would corrupt a list popped from.
+static struct region_pool {
+	region_t *first;
+	/// Bytes taken up by the regions in the list and how many may be.
+	size_t bytes;
+	size_t max_bytes;
+} pool = { .first = NULL, .bytes = 0, .max_bytes = 0 };
+
+// The arena of the group this thread joined
+static __thread struct {
+	arena_group_t *group;
+	arena_t arena;
+} member = { .group = NULL };
 
 // Internal Functions //
 
-static region_t *_create_region(size_t block_size) {
+static size_t _words(size_t bytes) {
 	// round up to the next highest mutliple of uintptr_t
-	size_t header = (sizeof(region_t) - 1) / sizeof(uintptr_t) + 1;
-	// ask libc for a new zeroed region and initialise it
-	region_t *region = (region_t *) calloc(header + block_size, sizeof(uintptr_t));
-	error_if(region == NULL);
-	region->next = NULL, region->used = 0; // redundant
-	region->size = block_size;
+	return (bytes + sizeof(uintptr_t) - 1) / sizeof(uintptr_t);
+}
+
+static size_t _region_bytes(const region_t *region) {
+	return (REGION_HEADER + region->size) * sizeof(uintptr_t);
+}
+
+// Links a chain of regions in front of a list that other threads push to
+static void _push(region_t **list, region_t *first, region_t *tail) {
+	tail->next = __atomic_load_n(list, __ATOMIC_RELAXED);
+	while(!__atomic_compare_exchange_n(list, &tail->next, first, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+static region_t *_tail(region_t *region) {
+	while(region->next != NULL) region = region->next;
 	return region;
 }
 
-static void *_alloc_first(arena_t *arena, size_t block_size_bytes) {
-	// this function should only have been called on empty arenas
-	assert(arena->first == NULL && arena->last == NULL);
-	
-	// calculate the rounded up size of the block and use that for
-	// the size of the new region if it's bigger than the minimum
-	size_t block_size = (block_size_bytes - 1) / sizeof(uintptr_t) + 1;
-	size_t new_region_size = arena->min_region_size;
-	if(new_region_size < block_size) new_region_size = block_size;
-
-	// create the region and link it to the arena
-	region_t *new_region = _create_region(new_region_size);
-	if(new_region == NULL) return NULL;
-	arena->first = arena->last = new_region;
-
-	// no need index into data, it's guaranteed to be empty
-	void *block = (void *) &arena->last->data;
-	arena->last->used += block_size;
+// Takes the first retained region that's big enough or NULL if there is none
+static region_t *_reuse_region(size_t block_size) {
+	if(__atomic_load_n(&pool.first, __ATOMIC_RELAXED) == NULL) return NULL;
+	// other threads find the pool empty for a moment and allocate instead
+	region_t *list = __atomic_exchange_n(&pool.first, NULL, __ATOMIC_ACQUIRE);
+	region_t **link = &list;
+	while(*link != NULL && (*link)->size < block_size) link = &(*link)->next;
+	region_t *region = *link;
+	if(region != NULL) {
+		*link = region->next;
+		__atomic_sub_fetch(&pool.bytes, _region_bytes(region), __ATOMIC_RELAXED);
+	}
+	if(list != NULL) _push(&pool.first, list, _tail(list));
+	return region;
+}
+
+static region_t *_create_region(size_t block_size) {
+	region_t *region = _reuse_region(block_size);
+	if(region == NULL) {
+		// ask libc for a new region, its contents are written before they're read
+		region = (region_t *) malloc((REGION_HEADER + block_size) * sizeof(uintptr_t));
+		error_if(region == NULL);
+		region->size = block_size;
+	}
+	region->next = NULL, region->used = 0;
+	return region;
+}
+
+// Size of the region to create after `prev`, or the first one if it's NULL
+static size_t _next_region_size(const arena_t *arena, const region_t *prev, size_t block_size) {
+	size_t size = arena->min_region_size;
+	if(prev != NULL && prev->size < ARENA_MAX_GROWTH) {
+		size_t grown = prev->size * 2;
+		if(grown > ARENA_MAX_GROWTH) grown = ARENA_MAX_GROWTH;
+		if(size < grown) size = grown;
+	}
+	if(size < block_size) size = block_size;
+	return size;
+}
+
+// Elements to skip at the end of a region for the next block to be aligned
+static size_t _padding(const region_t *region, size_t alignment) {
+	if(alignment <= sizeof(uintptr_t)) return 0;
+	uintptr_t address = (uintptr_t) &region->data[region->used];
+	return (-address & (alignment - 1)) / sizeof(uintptr_t);
+}
+
+static void *_alloc(arena_t *arena, size_t block_size, size_t alignment) {
+	// a fresh region needs room for the worst case of padding
+	size_t slack = alignment > sizeof(uintptr_t) ? alignment / sizeof(uintptr_t) - 1 : 0;
+	if(arena->first == NULL) {
+		assert(arena->last == NULL);
+		arena->first = arena->last = _create_region(_next_region_size(arena, NULL, block_size + slack));
+	}
+
+	// regions past the last one are empty, either left over from a reset or
+	// created here when the last region in the list doesn't fit the block
+	region_t *curr = arena->last;
+	size_t padding = _padding(curr, alignment);
+	while(curr->used + padding + block_size > curr->size) {
+		if(curr->next == NULL)
+			curr->next = _create_region(_next_region_size(arena, curr, block_size + slack));
+		curr = curr->next;
+		padding = _padding(curr, alignment);
+	}
+	arena->last = curr;
+
+	void *block = (void *) &curr->data[curr->used + padding];
+	curr->used += padding + block_size;
 	return block;
 }
 
 // External Functions //
 
 arena_t arena_new(size_t min_region_size_bytes) {
-	// round up to the next highest mutliple of uintptr_t
-	size_t min_region_size = (min_region_size_bytes - 1) / sizeof(uintptr_t) + 1;
+	size_t min_region_size = _words(min_region_size_bytes);
 	return (arena_t) {
-		.min_region_size = min_region_size,
+		.min_region_size = min_region_size ? min_region_size : 1,
 		.first = NULL, .last = NULL
 	};
 }
 
 void *arena_alloc(arena_t *arena, size_t block_size_bytes) {
-	// call the first allocation function instead if the arena is empty
-	if(arena->first == NULL) {
-		assert(arena->last == NULL);
-		return _alloc_first(arena, block_size_bytes);
-	}
+	return _alloc(arena, _words(block_size_bytes), sizeof(uintptr_t));
+}
 
-	// * the block size calculation can be pulled out the loop
-	size_t block_size = (block_size_bytes - 1) / sizeof(uintptr_t) + 1;
-	for(region_t *curr = arena->last; curr != NULL; curr = curr->next) {
-		// if it fits into the current region then we are done
-		if(block_size + curr->used <= curr->size) break;
-		// if instead we reached the last region and it still doesn't fit
-		if(curr->next == NULL) {
-			// calculate the rounded up size of the block and use that for
-			// the size of the new region if it's bigger than the minimum *
-			size_t new_region_size = arena->min_region_size;
-			if(new_region_size < block_size) new_region_size = block_size;
-
-			// create the region and link it to the previously last one
-			region_t *new_region = _create_region(new_region_size);
-			if(new_region == NULL) return NULL;
-			curr->next = new_region;
-		}
-		arena->last = curr->next;
-	}
+void *arena_alloc_aligned(arena_t *arena, size_t block_size_bytes, size_t alignment) {
+	assert(alignment != 0 && (alignment & (alignment - 1)) == 0);
+	return _alloc(arena, _words(block_size_bytes), alignment);
+}
 
-	void *block = (void *) &arena->last->data[arena->last->used];
-	arena->last->used += block_size;
+void *arena_alloc_zeroed(arena_t *arena, size_t block_size_bytes) {
+	void *block = arena_alloc(arena, block_size_bytes);
+	memset(block, 0, block_size_bytes);
 	return block;
 }
 
+arena_mark_t arena_mark(const arena_t *arena) {
+	return (arena_mark_t) {
+		.region = arena->last,
+		.used = arena->last != NULL ? arena->last->used : 0
+	};
+}
+
+void arena_reset_to(arena_t *arena, arena_mark_t mark) {
+	// a mark of an empty arena drops everything
+	region_t *curr = mark.region != NULL ? mark.region : arena->first;
+	if(curr == NULL) return;
+	arena->last = curr;
+	curr->used = mark.used;
+	// the regions after it were all allocated into since, or are empty
+	for(curr = curr->next; curr != NULL; curr = curr->next) curr->used = 0;
+}
+
+void arena_adopt(arena_t *arena, arena_t *other) {
+	if(other->first == NULL) return;
+	// link the adopted regions in front so the last region stays the same
+	region_t *tail = _tail(other->first);
+	tail->next = arena->first;
+	arena->first = other->first;
+	if(arena->last == NULL) arena->last = tail;
+	other->first = other->last = NULL;
+}
+
 void arena_free(arena_t *arena) {
-	for(
-		// iterate over all regions *
-		region_t *curr = arena->first;
-		curr != NULL;
-	) {
+	if(stats_enabled) stats_count_arena(arena);
+	region_t *curr = arena->first;
+	arena->first = NULL;
+	arena->last = NULL;
+
+	// keep what fits into the pool and free the rest
+	size_t max_bytes = __atomic_load_n(&pool.max_bytes, __ATOMIC_RELAXED);
+	region_t *kept = NULL, *kept_tail = NULL;
+	while(curr != NULL) {
 		// we can't free before we follow next
 		region_t *tmp = curr;
-		curr = curr->next; // * increment here
+		curr = curr->next;
+		size_t bytes = _region_bytes(tmp);
+		if(max_bytes != 0 && __atomic_add_fetch(&pool.bytes, bytes, __ATOMIC_RELAXED) <= max_bytes) {
+			tmp->next = kept, kept = tmp;
+			if(kept_tail == NULL) kept_tail = tmp;
+			continue;
+		}
+		if(max_bytes != 0) __atomic_sub_fetch(&pool.bytes, bytes, __ATOMIC_RELAXED);
 		free(tmp);
 	}
-	arena->first = NULL;
-	arena->last = NULL;
+	if(kept != NULL) _push(&pool.first, kept, kept_tail);
+}
+
+void arena_set_retain(size_t max_bytes) {
+	__atomic_store_n(&pool.max_bytes, max_bytes, __ATOMIC_RELAXED);
+	region_t *list = __atomic_exchange_n(&pool.first, NULL, __ATOMIC_ACQUIRE);
+	while(list != NULL && __atomic_load_n(&pool.bytes, __ATOMIC_RELAXED) > max_bytes) {
+		region_t *tmp = list;
+		list = list->next;
+		__atomic_sub_fetch(&pool.bytes, _region_bytes(tmp), __ATOMIC_RELAXED);
+		free(tmp);
+	}
+	if(list != NULL) _push(&pool.first, list, _tail(list));
+}
+
+arena_group_t arena_group_new(size_t min_region_size_bytes) {
+	return (arena_group_t) { .min_region_size_bytes = min_region_size_bytes, .handed = NULL };
+}
+
+arena_t *arena_join(arena_group_t *group) {
+	if(member.group != group) {
+		assert(member.group == NULL);
+		member.group = group;
+		member.arena = arena_new(group->min_region_size_bytes);
+	}
+	return &member.arena;
+}
+
+void arena_leave(arena_group_t *group) {
+	assert(member.group == group);
+	arena_hand_off(group, &member.arena);
+	member.group = NULL;
+}
+
+void arena_hand_off(arena_group_t *group, arena_t *arena) {
+	if(arena->first == NULL) return;
+	_push(&group->handed, arena->first, _tail(arena->first));
+	arena->first = arena->last = NULL;
+}
+
+void arena_group_take(arena_t *arena, arena_group_t *group) {
+	region_t *handed = __atomic_exchange_n(&group->handed, NULL, __ATOMIC_ACQUIRE);
+	arena_t other = { .min_region_size = 0, .first = handed, .last = NULL };
+	arena_adopt(arena, &other);
+}
+
+void arena_group_free(arena_group_t *group) {
+	arena_t all = arena_new(0);
+	arena_group_take(&all, group);
+	arena_free(&all);
 }
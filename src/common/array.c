@@ -0,0 +1,11 @@
+#include "array.h"
+#include "io.h"
+
+#include <stdlib.h>
+
+void *array_grow(void *items, size_t *capacity, size_t item_size) {
+	*capacity = *capacity ? *capacity * 2 : 64;
+	items = realloc(items, *capacity * item_size);
+	error_if(items == NULL);
+	return items;
+}
@@ -0,0 +1,71 @@
+#include "hash.h"
+
+#include <string.h>
+
+#define PRIME_1 11400714785074694791ull
+#define PRIME_2 14029467366897019727ull
+#define PRIME_3 1609587929392839161ull
+#define PRIME_4 9650029242287828579ull
+#define PRIME_5 2870177450012600261ull
+
+// Internal Functions //
+
+static uint64_t _rotl(uint64_t x, int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+// unaligned reads, which compile to single loads where those are allowed
+static uint64_t _read64(const unsigned char *p) {
+	uint64_t x;
+	return memcpy(&x, p, sizeof(x)), x;
+}
+
+static uint32_t _read32(const unsigned char *p) {
+	uint32_t x;
+	return memcpy(&x, p, sizeof(x)), x;
+}
+
+static uint64_t _round(uint64_t acc, uint64_t input) {
+	acc += input * PRIME_2;
+	return _rotl(acc, 31) * PRIME_1;
+}
+
+static uint64_t _merge(uint64_t acc, uint64_t lane) {
+	acc ^= _round(0, lane);
+	return acc * PRIME_1 + PRIME_4;
+}
+
+// External Functions //
+
+uint64_t hash_bytes(const void *data, size_t size, uint64_t seed) {
+	const unsigned char *p = (const unsigned char *) data;
+	const unsigned char *end = p + size;
+	uint64_t h;
+
+	if(size >= 32) {
+		uint64_t v1 = seed + PRIME_1 + PRIME_2, v2 = seed + PRIME_2;
+		uint64_t v3 = seed, v4 = seed - PRIME_1;
+		for(; p + 32 <= end; p += 32) {
+			v1 = _round(v1, _read64(p));
+			v2 = _round(v2, _read64(p + 8));
+			v3 = _round(v3, _read64(p + 16));
+			v4 = _round(v4, _read64(p + 24));
+		}
+		h = _rotl(v1, 1) + _rotl(v2, 7) + _rotl(v3, 12) + _rotl(v4, 18);
+		h = _merge(_merge(_merge(_merge(h, v1), v2), v3), v4);
+	} else h = seed + PRIME_5;
+	h += (uint64_t) size;
+
+	// the tail of less than 32 bytes
+	for(; p + 8 <= end; p += 8)
+		h = _rotl(h ^ _round(0, _read64(p)), 27) * PRIME_1 + PRIME_4;
+	if(p + 4 <= end)
+		h = _rotl(h ^ (uint64_t) _read32(p) * PRIME_1, 23) * PRIME_2 + PRIME_3, p += 4;
+	for(; p < end; p++)
+		h = _rotl(h ^ *p * PRIME_5, 11) * PRIME_1;
+
+	// avalanche so that every input bit affects every output bit
+	h ^= h >> 33, h *= PRIME_2;
+	h ^= h >> 29, h *= PRIME_3;
+	return h ^ (h >> 32);
+}
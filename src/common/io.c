@@ -4,27 +4,32 @@
 #include <string.h>
 
 string_t str_read(FILE *fdesc) {
-	const size_t buffer_size =  4096;
-	char read_buffer[buffer_size];
+	size_t capacity = 4096, used = 0;
 	string_t result = { .size = 0, .string = NULL };
+	char *buffer = (char *) malloc(capacity);
+	if(!buffer) return result;
 
-	for(bool finished = false; !finished; ) {
-		size_t read_amount = fread(read_buffer, 1, buffer_size, fdesc);
-		if(read_amount < buffer_size) finished = true, read_amount++;
-
-		size_t new_size = result.size + read_amount;
-		char *new_string = (char *) realloc(result.string, new_size);
-		if(!new_string) {
-			if(result.string) free(result.string);
-			result.string = NULL;
-			return result;
+	while(true) {
+		// grow geometrically so that reading is linear in the input size,
+		// always keeping one spare byte for the null terminator
+		if(used == capacity - 1) {
+			char *new_buffer = (char *) realloc(buffer, capacity * 2);
+			if(!new_buffer) return free(buffer), result;
+			buffer = new_buffer, capacity *= 2;
 		}
 
-		memcpy(&new_string[result.size], read_buffer, read_amount);
-		result.size += read_amount, result.string = new_string;
-		if(finished) result.string[result.size - 1] = '\0';
+		size_t read_amount = fread(&buffer[used], 1, capacity - 1 - used, fdesc);
+		used += read_amount;
+		if(read_amount == 0 && (feof(fdesc) || ferror(fdesc))) break;
 	}
-	
+
+	if(ferror(fdesc)) return free(buffer), result;
+	buffer[used] = '\0';
+
+	// trim the spare capacity, which only fails if we're out of memory anyway
+	char *exact = (char *) realloc(buffer, used + 1);
+	result.string = exact ? exact : buffer;
+	result.size = used + 1;
 	return result;
 }
 
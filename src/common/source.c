@@ -0,0 +1,126 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS
+
+#include "source.h"
+#include "io.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Initial buffer size for inputs that can't tell their size up front
+#define SOURCE_MIN_BUFFER 65536
+
+// Internal Functions //
+
+static source_t _map_file(int fd, size_t file_size) {
+	source_t result = { .text = EMPTY_STRING, .mapped_size = 0 };
+	size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+	char *base;
+
+	if(file_size % page_size) {
+		// the tail of the last page past the end of the file reads as zero
+		// so the null terminator comes for free
+		base = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(base == MAP_FAILED) return result;
+		result.mapped_size = file_size;
+	} else {
+		// the file ends on a page boundary, so reserve one extra zeroed page
+		// and map the file over the start of the reservation
+		result.mapped_size = file_size + page_size;
+		base = mmap(NULL, result.mapped_size, PROT_READ,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(base == MAP_FAILED) return result.mapped_size = 0, result;
+		if(file_size && mmap(base, file_size, PROT_READ,
+			MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+			int saved_errno = errno;
+			munmap(base, result.mapped_size);
+			errno = saved_errno;
+			result.mapped_size = 0;
+			return result;
+		}
+	}
+
+	// the lexer walks the buffer front to back exactly once
+	if(file_size) posix_madvise(base, file_size, POSIX_MADV_SEQUENTIAL);
+	result.text = (string_t) { .size = file_size + 1, .string = base };
+	return result;
+}
+
+static source_t _read_file(int fd, size_t size_hint) {
+	source_t result = { .text = EMPTY_STRING, .mapped_size = 0 };
+	// one spare byte for the null terminator
+	size_t capacity = (size_hint ? size_hint : SOURCE_MIN_BUFFER) + 1;
+	size_t used = 0;
+	char *buffer = (char *) malloc(capacity);
+	if(!buffer) return result;
+
+	while(true) {
+		if(used == capacity - 1) {
+			// a full buffer is usually the whole input when the hint was
+			// right, so only grow once a byte past it turns up
+			char extra;
+			ssize_t probe = read(fd, &extra, 1);
+			if(probe < 0 && errno == EINTR) continue;
+			if(probe < 0) return free(buffer), result;
+			if(probe == 0) break;
+			char *new_buffer = (char *) realloc(buffer, capacity * 2);
+			if(!new_buffer) return free(buffer), result;
+			buffer = new_buffer, capacity *= 2;
+			buffer[used++] = extra;
+			continue;
+		}
+
+		ssize_t read_amount = read(fd, &buffer[used], capacity - 1 - used);
+		if(read_amount < 0 && errno == EINTR) continue;
+		if(read_amount < 0) return free(buffer), result;
+		if(read_amount == 0) break;
+		used += (size_t) read_amount;
+	}
+
+	buffer[used] = '\0';
+	result.text = (string_t) { .size = used + 1, .string = buffer };
+	return result;
+}
+
+// External Functions //
+
+source_t source_load(const char *file_path) {
+	bool is_stdin = file_path[0] == '-' && file_path[1] == '\0';
+	int fd = is_stdin ? STDIN_FILENO : open(file_path, O_RDONLY);
+	if(fd < 0) return (source_t) { .text = EMPTY_STRING, .mapped_size = 0 };
+
+	source_t result = source_load_fd(fd);
+	if(!is_stdin) {
+		int saved_errno = errno;
+		close(fd);
+		errno = saved_errno;
+	}
+	return result;
+}
+
+source_t source_load_fd(int fd) {
+	struct stat info;
+	if(fstat(fd, &info) < 0) return (source_t) { .text = EMPTY_STRING, .mapped_size = 0 };
+
+	// only regular files are worth mapping, fall back to reading if mapping
+	// fails anyway since some filesystems don't support it. Files like the
+	// ones in /proc say they're empty but aren't, so those are read too.
+	size_t size_hint = info.st_size > 0 ? (size_t) info.st_size : 0;
+	if(S_ISREG(info.st_mode) && size_hint) {
+		source_t result = _map_file(fd, size_hint);
+		if(result.text.string) return result;
+	}
+	return _read_file(fd, size_hint);
+}
+
+void source_release(source_t *source) {
+	if(!source->text.string) return;
+	if(source->mapped_size) munmap(source->text.string, source->mapped_size);
+	else free(source->text.string);
+	source->text = EMPTY_STRING;
+	source->mapped_size = 0;
+}
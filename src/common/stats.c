@@ -0,0 +1,195 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "stats.h"
+
+#include "lexer/lexer.h"	// token_type_strs
+#include "parser/ast.h"		// NodeType
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Spelled like the phases in stats_phase_t
+static const char *phase_names[] = { "other", "load", "lex", "parse", "fold", "output" };
+// Spelled like the nodes in NodeType
+static const char *node_names[] = {
+	"block", "number", "binary_op", "ident", "var", "if", "while", "return",
+	"unary_op", "call", "bool", "nil"
+};
+
+bool stats_enabled = false;
+
+// Phases are only timed on the thread that enabled the stats, the counts
+// below come from any thread
+static __thread bool stats_owner = false;
+
+static struct stats_state {
+	stats_format_t format;
+	stats_phase_t phase;
+	/// Clocks at the last change of phase.
+	double wall_mark;
+	double cpu_mark;
+	double wall[STATS_PHASE_COUNT];
+	double cpu[STATS_PHASE_COUNT];
+
+	/// Updated atomically, as any thread may lex, parse or allocate.
+	size_t tokens[256];
+	size_t nodes[NODE_NIL + 1];
+	size_t mallocs;
+	size_t callocs;
+	size_t reallocs;
+
+	size_t arenas;
+	size_t regions;
+	/// Words handed out by the arenas and words left over at the end of regions.
+	size_t used_words;
+	size_t wasted_words;
+} ss;
+
+// Internal Functions //
+
+static double _clock(clockid_t clock) {
+	struct timespec time;
+	clock_gettime(clock, &time);
+	return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+static void _charge(void) {
+	double wall = _clock(CLOCK_MONOTONIC), cpu = _clock(CLOCK_PROCESS_CPUTIME_ID);
+	ss.wall[ss.phase] += wall - ss.wall_mark;
+	ss.cpu[ss.phase] += cpu - ss.cpu_mark;
+	ss.wall_mark = wall, ss.cpu_mark = cpu;
+}
+
+static void _report_text(void) {
+	double wall = 0, cpu = 0;
+	fprintf(stderr, "%-8s %12s %12s\n", "phase", "wall ms", "cpu ms");
+	for(int phase = 0; phase < STATS_PHASE_COUNT; phase++) {
+		fprintf(stderr, "%-8s %12.3f %12.3f\n", phase_names[phase], ss.wall[phase] * 1e3, ss.cpu[phase] * 1e3);
+		wall += ss.wall[phase], cpu += ss.cpu[phase];
+	}
+	fprintf(stderr, "%-8s %12.3f %12.3f\n", "total", wall * 1e3, cpu * 1e3);
+
+	fprintf(stderr, "\ntokens\n");
+	for(int type = 0; type <= TOK_LIT_NUM; type++) {
+		if(ss.tokens[type]) fprintf(stderr, "  %-16s %zu\n", token_type_strs[type], ss.tokens[type]);
+	}
+	fprintf(stderr, "\nnodes\n");
+	for(int kind = 0; kind <= NODE_NIL; kind++) {
+		if(ss.nodes[kind]) fprintf(stderr, "  %-16s %zu\n", node_names[kind], ss.nodes[kind]);
+	}
+
+	fprintf(stderr, "\nallocations\n  malloc %zu\n  calloc %zu\n  realloc %zu\n",
+		ss.mallocs, ss.callocs, ss.reallocs);
+	fprintf(stderr, "\narenas\n  freed %zu\n  regions %zu\n  used words %zu\n  wasted words %zu\n",
+		ss.arenas, ss.regions, ss.used_words, ss.wasted_words);
+}
+
+static void _report_json(void) {
+	double wall = 0, cpu = 0;
+	fprintf(stderr, "{\"phases\":{");
+	for(int phase = 0; phase < STATS_PHASE_COUNT; phase++) {
+		fprintf(stderr, "%s\"%s\":{\"wall_ms\":%.3f,\"cpu_ms\":%.3f}", phase ? "," : "",
+			phase_names[phase], ss.wall[phase] * 1e3, ss.cpu[phase] * 1e3);
+		wall += ss.wall[phase], cpu += ss.cpu[phase];
+	}
+	fprintf(stderr, "},\"total\":{\"wall_ms\":%.3f,\"cpu_ms\":%.3f}", wall * 1e3, cpu * 1e3);
+
+	const char *separator = "";
+	fprintf(stderr, ",\"tokens\":{");
+	for(int type = 0; type <= TOK_LIT_NUM; type++) {
+		if(!ss.tokens[type]) continue;
+		fprintf(stderr, "%s\"%s\":%zu", separator, token_type_strs[type], ss.tokens[type]);
+		separator = ",";
+	}
+	separator = "";
+	fprintf(stderr, "},\"nodes\":{");
+	for(int kind = 0; kind <= NODE_NIL; kind++) {
+		if(!ss.nodes[kind]) continue;
+		fprintf(stderr, "%s\"%s\":%zu", separator, node_names[kind], ss.nodes[kind]);
+		separator = ",";
+	}
+
+	fprintf(stderr, "},\"allocations\":{\"malloc\":%zu,\"calloc\":%zu,\"realloc\":%zu}",
+		ss.mallocs, ss.callocs, ss.reallocs);
+	fprintf(stderr, ",\"arenas\":{\"freed\":%zu,\"regions\":%zu,\"used_words\":%zu,\"wasted_words\":%zu}}\n",
+		ss.arenas, ss.regions, ss.used_words, ss.wasted_words);
+}
+
+static void _report(void) {
+	_charge();
+	stats_enabled = false;
+	if(ss.format == STATS_JSON) _report_json();
+	else _report_text();
+}
+
+// External Functions //
+
+void stats_enable(stats_format_t format) {
+	if(!stats_enabled) atexit(_report);
+	stats_enabled = true;
+	stats_owner = true;
+	ss.format = format;
+	ss.wall_mark = _clock(CLOCK_MONOTONIC);
+	ss.cpu_mark = _clock(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+stats_phase_t stats_enter(stats_phase_t phase) {
+	if(!stats_enabled || !stats_owner) return STATS_OTHER;
+	stats_phase_t previous = ss.phase;
+	_charge();
+	ss.phase = phase;
+	return previous;
+}
+
+void stats_leave(stats_phase_t previous) {
+	if(!stats_enabled || !stats_owner) return;
+	_charge();
+	ss.phase = previous;
+}
+
+void stats_count_tokens(const uint8_t *types, size_t count) {
+	if(!stats_enabled) return;
+	for(size_t i = 0; i < count; i++) __atomic_fetch_add(&ss.tokens[types[i]], 1, __ATOMIC_RELAXED);
+}
+
+void stats_count_nodes(const uint8_t *kinds, size_t count) {
+	if(!stats_enabled) return;
+	for(size_t i = 0; i < count; i++) if(kinds[i] <= NODE_NIL) __atomic_fetch_add(&ss.nodes[kinds[i]], 1, __ATOMIC_RELAXED);
+}
+
+void stats_count_arena(const arena_t *arena) {
+	if(!stats_enabled) return;
+	size_t regions = 0, used = 0, wasted = 0;
+	for(const region_t *region = arena->first; region != NULL; region = region->next) {
+		regions++;
+		used += region->used;
+		wasted += region->size - region->used;
+	}
+	__atomic_fetch_add(&ss.arenas, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&ss.regions, regions, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&ss.used_words, used, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&ss.wasted_words, wasted, __ATOMIC_RELAXED);
+}
+
+// The linker sends the program's own calls here with --wrap, the ones
+// within the C library aren't affected
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *block, size_t size);
+
+void *__wrap_malloc(size_t size) {
+	if(stats_enabled) __atomic_fetch_add(&ss.mallocs, 1, __ATOMIC_RELAXED);
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+	if(stats_enabled) __atomic_fetch_add(&ss.callocs, 1, __ATOMIC_RELAXED);
+	return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *block, size_t size) {
+	if(stats_enabled) __atomic_fetch_add(&ss.reallocs, 1, __ATOMIC_RELAXED);
+	return __real_realloc(block, size);
+}
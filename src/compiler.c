@@ -1,17 +1,585 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "codegen/x86.h"
 #include "common/io.h"
+#include "common/stats.h"
 #include "lexer/lexer.h"
+#include "lexer/scan.h"
+#include "parser/cache.h"
+#include "parser/document.h"
+#include "parser/emitter.h"
+#include "parser/fold.h"
 #include "parser/parser.h"
+#include "server/server.h"
+#include "vm/bytecode.h"
+#include "vm/vm.h"
 
 #include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Bytes of freed arena regions that batches keep around for the next file
+#define BATCH_RETAIN_BYTES ((size_t) 64 << 20)
+// Bytes of freed arena regions and of parsed trees that a server keeps
+#define SERVER_RETAIN_BYTES ((size_t) 64 << 20)
+#define SERVER_CACHE_BYTES ((size_t) 256 << 20)
+// How long a program that a server runs may take before it's stopped, so that
+// one that loops forever doesn't keep a worker for good
+#define SERVER_RUN_MILLISECONDS 10000
+// Most threads that --jobs, --lex-threads or --parse-threads may ask for
+#define MAX_THREADS 256
+
+// How to compile a file, as given on the command line or with a request
+typedef struct options {
+	bool only_tokens;
+	bool run;
+	bool assembly;
+	bool fold;
+	bool print_bytecode;
+	EmitFormat format;
+	lexer_mode_t lexer_mode;
+	/// Threads for each file, 0 uses one per processor.
+	size_t lex_threads;
+	size_t parse_threads;
+	bool threads_given;
+} options_t;
+
+static const options_t default_options = {
+	.only_tokens = false, .run = false, .assembly = false, .fold = true,
+	.print_bytecode = false, .format = EMIT_PRETTY, .lexer_mode = LEXER_MODE_TABLE,
+	.lex_threads = 0, .parse_threads = 0, .threads_given = false
+};
+
+// One file to compile, where its output goes and how it ended
+typedef struct job {
+	const char *path;
+	/// Source sent to a server in place of the path, or empty.
+	string_t source;
+	const options_t *options;
+	FILE *out;
+	FILE *errors;
+	/// What a batch collected in `out` and `errors` until it's written out.
+	char *out_text;
+	size_t out_size;
+	char *error_text;
+	size_t error_size;
+	/// Exit status of compiling the file on its own.
+	int status;
+	bool done;
+} job_t;
+
+// A thread of a batch and the jobs it has left
+typedef struct worker {
+	pthread_t thread;
+	/// Index of the next job in the low and one past the last job in the high
+	/// 32 bits, so that the owner and thieves both take from it with one CAS.
+	uint64_t range;
+	lexer_t *lexer;
+} worker_t;
+
+static struct batch_state {
+	job_t *jobs;
+	size_t count;
+	worker_t *workers;
+	size_t worker_count;
+	/// Guards writing out, the jobs before `written` have been written.
+	pthread_mutex_t lock;
+	size_t written;
+} bs;
+
+// Prints one token per line as its type, source offset, length and content
+static void print_tokens(lexer_t *lexer, FILE *out) {
+	const char *src = lexer_get_src(lexer).string;
+	while(true) {
+		token_t token = lexer_next(lexer);
+		fprintf(out, "%s %zu %zu %.*s\n", token_type_strs[token.type],
+			(size_t) (token.content.string - src), token.content.size,
+			(int) token.content.size, token.content.string);
+		if(token.type == TOK_EOF) break;
+	}
+}
+
+// Writes the tree to the job's output in the format picked with --format
+static void print_ast(Node *ast, void *data) {
+	job_t *job = data;
+	ast_emit(ast, job->options->format, job->out);
+}
+
+// Applies edits given as "offset,removed,text" to the loaded source one after
+// another and prints the resulting tree, reparsing only what they touch
+static void edit_source(job_t *job, lexer_t *lexer, char **edits, size_t count) {
+	string_t src = lexer_get_src(lexer);
+	Document doc = document_open((string_t) { .size = src.size - 1, .string = src.string });
+	for(size_t i = 0; i < count; i++) {
+		char *removed_text, *rest;
+		size_t offset = strtoul(edits[i], &removed_text, 10);
+		bool valid = isdigit((unsigned char) edits[i][0]) && *removed_text++ == ',';
+		size_t removed = valid ? strtoul(removed_text, &rest, 10) : 0;
+		if(!valid || !isdigit((unsigned char) *removed_text) || *rest != ',') {
+			fprintf(job->errors, "Malformed edit %s\n", edits[i]);
+			job->status = EXIT_FAILURE;
+			document_free(&doc);
+			return;
+		}
+		rest++;
+		document_edit(&doc, offset, removed, (string_t) { .size = strlen(rest), .string = rest });
+	}
+	if(!document_valid(&doc)) {
+		fprintf(job->errors, "The edited source doesn't parse\n");
+		job->status = EXIT_FAILURE;
+		document_free(&doc);
+		return;
+	}
+	arena_t arena = arena_new(4096);
+	stats_phase_t phase = stats_enter(STATS_PARSE);
+	Node *ast = document_ast(&doc, &arena);
+	stats_enter(STATS_FOLD);
+	if(job->options->fold) ast = ast_fold(ast, &arena, job->errors);
+	stats_enter(STATS_OUTPUT);
+	print_ast(ast, job);
+	stats_leave(phase);
+	arena_free(&arena);
+	document_free(&doc);
+}
+
+// Compiles the tree to bytecode and runs it, a number it returns is the exit status
+static void run_program(Node *ast, void *data) {
+	job_t *job = data;
+	bytecode_t code;
+	if(!bytecode_compile(ast, vm_natives, vm_native_count, job->errors, &code)) {
+		job->status = EXIT_FAILURE;
+		return;
+	}
+	if(job->options->print_bytecode) {
+		bytecode_print(&code, job->out);
+		bytecode_free(&code);
+		return;
+	}
+	int64_t result;
+	bool ok = vm_run(&code, job->out, job->errors, &result);
+	bytecode_free(&code);
+	job->status = ok ? (int) (result & 0xff) : EXIT_FAILURE;
+}
+
+// Compiles the tree to x86-64 assembly on the job's output
+static void emit_assembly(Node *ast, void *data) {
+	job_t *job = data;
+	if(!x86_compile(ast, job->out, job->errors)) job->status = EXIT_FAILURE;
+}
+
+// Compiles the job's file with the lexer, which is free to be used again after
+static void compile(job_t *job, lexer_t *lexer, char **edits, size_t edit_count) {
+	const options_t *options = job->options;
+	lexer_set_mode(lexer, options->lexer_mode);
+	lexer_set_threads(lexer, options->lex_threads);
+	// tokens are only lexed if they are needed
+	stats_phase_t phase = stats_enter(STATS_LOAD);
+	bool loaded = job->source.string
+		? lexer_load_source(lexer, (source_t) { .text = job->source, .mapped_size = 0 })
+		: lexer_load(lexer, job->path);
+	job->source = EMPTY_STRING;
+	if(!loaded) {
+		fprintf(job->errors, "%s: %s\n", job->path, strerror(errno));
+		job->status = EXIT_FAILURE;
+		stats_leave(phase);
+		return;
+	}
+	stats_enter(options->only_tokens ? STATS_OUTPUT : STATS_OTHER);
+	if(options->only_tokens) print_tokens(lexer, job->out);
+	else if(edit_count) edit_source(job, lexer, edits, edit_count);
+	else {
+		Parser parser = parser_new(lexer);
+		parser_set_fold(&parser, options->fold);
+		parser_set_threads(&parser, options->parse_threads);
+		parser_set_errors(&parser, job->errors);
+		void (*consume)(Node *, void *) = options->assembly ? emit_assembly
+			: options->run ? run_program : print_ast;
+		if(!parser_start(&parser, consume, job)) job->status = EXIT_FAILURE;
+	}
+	stats_leave(phase);
+}
+
+// Reads a count of threads, where 0 means one per processor. Fails if it
+// isn't a plain number or asks for more than MAX_THREADS.
+static bool read_threads(const char *text, size_t *threads) {
+	char *end;
+	unsigned long count = strtoul(text, &end, 10);
+	if(!isdigit((unsigned char) text[0]) || *end != '\0' || count > MAX_THREADS) return false;
+	*threads = count;
+	return true;
+}
+
+// Reads the compile option at argv[i] into the options. Returns how many
+// arguments it took, 0 if it isn't one or -1 if it's one that's malformed.
+static int read_option(options_t *options, int argc, char **argv, int i) {
+	if(!strcmp(argv[i], "--tokens")) options->only_tokens = true;
+	else if(!strcmp(argv[i], "--run")) options->run = true;
+	else if(!strcmp(argv[i], "--bytecode")) options->run = options->print_bytecode = true;
+	else if(!strcmp(argv[i], "--asm")) options->assembly = true;
+	else if(!strcmp(argv[i], "--reference-lexer")) options->lexer_mode = LEXER_MODE_REFERENCE;
+	else if(!strcmp(argv[i], "--no-fold")) options->fold = false;
+	else if(!strcmp(argv[i], "--format") && i + 1 < argc) {
+		const char *name = argv[i + 1];
+		if(!strcmp(name, "pretty")) options->format = EMIT_PRETTY;
+		else if(!strcmp(name, "json")) options->format = EMIT_JSON;
+		else if(!strcmp(name, "sexpr")) options->format = EMIT_SEXPR;
+		else return -1;
+		return 2;
+	}
+	else if(!strcmp(argv[i], "--lex-threads") && i + 1 < argc) {
+		if(!read_threads(argv[i + 1], &options->lex_threads)) return -1;
+		options->threads_given = true;
+		return 2;
+	}
+	else if(!strcmp(argv[i], "--parse-threads") && i + 1 < argc) {
+		if(!read_threads(argv[i + 1], &options->parse_threads)) return -1;
+		options->threads_given = true;
+		return 2;
+	}
+	else return 0;
+	return 1;
+}
+
+static size_t processors(void) {
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (size_t) count : 1;
+}
+
+// Batches //
+
+static uint64_t _range(uint32_t begin, uint32_t end) {
+	return (uint64_t) end << 32 | begin;
+}
+
+// Takes the next job of the worker's own range
+static bool _take(worker_t *worker, size_t *index) {
+	uint64_t range = __atomic_load_n(&worker->range, __ATOMIC_ACQUIRE);
+	while(true) {
+		uint32_t begin = (uint32_t) range, end = (uint32_t) (range >> 32);
+		if(begin >= end) return false;
+		if(__atomic_compare_exchange_n(&worker->range, &range, _range(begin + 1, end), true,
+			__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			*index = begin;
+			return true;
+		}
+	}
+}
+
+// Takes the back half of the jobs of the worker with the most left, the
+// first of which is returned and the rest become the thief's own range
+static bool _steal(worker_t *thief, size_t *index) {
+	while(true) {
+		worker_t *victim = NULL;
+		uint64_t range = 0;
+		uint32_t most = 0;
+		for(size_t i = 0; i < bs.worker_count; i++) {
+			if(&bs.workers[i] == thief) continue;
+			uint64_t other = __atomic_load_n(&bs.workers[i].range, __ATOMIC_ACQUIRE);
+			uint32_t begin = (uint32_t) other, end = (uint32_t) (other >> 32);
+			if(begin < end && end - begin > most) victim = &bs.workers[i], range = other, most = end - begin;
+		}
+		if(victim == NULL) return false;
+
+		// ranges never repeat as every job is handed out once, so a CAS
+		// that succeeds saw the range that was picked
+		uint32_t begin = (uint32_t) range, end = (uint32_t) (range >> 32);
+		uint32_t first = end - (end - begin + 1) / 2;
+		if(!__atomic_compare_exchange_n(&victim->range, &range, _range(begin, first), false,
+			__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) continue;
+		__atomic_store_n(&thief->range, _range(first + 1, end), __ATOMIC_RELEASE);
+		*index = first;
+		return true;
+	}
+}
+
+// Writes out the finished jobs that no unfinished one comes before
+static void _finish(job_t *job) {
+	pthread_mutex_lock(&bs.lock);
+	job->done = true;
+	for(; bs.written < bs.count && bs.jobs[bs.written].done; bs.written++) {
+		job_t *next = &bs.jobs[bs.written];
+		// each output is flushed so that the two don't interleave mid-file
+		fwrite(next->out_text, 1, next->out_size, stdout);
+		fflush(stdout);
+		fwrite(next->error_text, 1, next->error_size, stderr);
+		fflush(stderr);
+		free(next->out_text);
+		free(next->error_text);
+		next->out_text = next->error_text = NULL;
+	}
+	pthread_mutex_unlock(&bs.lock);
+}
+
+static void *_work(void *data) {
+	worker_t *worker = data;
+	size_t index;
+	while(_take(worker, &index) || _steal(worker, &index)) {
+		job_t *job = &bs.jobs[index];
+		job->out = open_memstream(&job->out_text, &job->out_size);
+		job->errors = open_memstream(&job->error_text, &job->error_size);
+		error_if(job->out == NULL || job->errors == NULL);
+		compile(job, worker->lexer, NULL, 0);
+		fclose(job->out);
+		fclose(job->errors);
+		_finish(job);
+	}
+	ast_emit_release();
+	return NULL;
+}
+
+// Compiles the files on a pool of workers and writes the output of each in
+// the order of the files. The exit status is that of the first file that
+// didn't compile or run successfully.
+static int compile_batch(const char **paths, size_t count, size_t workers, options_t options) {
+	if(count > UINT32_MAX) errno = EOVERFLOW;
+	error_if(count > UINT32_MAX);
+	if(workers == 0) workers = processors();
+	if(workers > count) workers = count;
+	// the files are small next to the machine, so each is compiled on one thread
+	if(!options.threads_given) options.lex_threads = options.parse_threads = 1;
+	arena_set_retain(BATCH_RETAIN_BYTES);
+
+	bs.jobs = calloc(count, sizeof(job_t));
+	bs.workers = calloc(workers, sizeof(worker_t));
+	error_if(bs.jobs == NULL || bs.workers == NULL);
+	bs.count = count, bs.worker_count = workers, bs.written = 0;
+	pthread_mutex_init(&bs.lock, NULL);
+	for(size_t i = 0; i < count; i++) bs.jobs[i].path = paths[i], bs.jobs[i].options = &options;
+
+	// contiguous ranges keep neighbouring files on one thread until it runs dry
+	for(size_t i = 0; i < workers; i++) {
+		bs.workers[i].range = _range((uint32_t) (count * i / workers), (uint32_t) (count * (i + 1) / workers));
+		bs.workers[i].lexer = lexer_new();
+	}
+	for(size_t i = 1; i < workers; i++)
+		error_if((errno = pthread_create(&bs.workers[i].thread, NULL, _work, &bs.workers[i])) != 0);
+	_work(&bs.workers[0]);
+	for(size_t i = 1; i < workers; i++) pthread_join(bs.workers[i].thread, NULL);
+
+	int status = EXIT_SUCCESS;
+	for(size_t i = 0; i < count && status == EXIT_SUCCESS; i++) status = bs.jobs[i].status;
+	for(size_t i = 0; i < workers; i++) lexer_free(bs.workers[i].lexer);
+	pthread_mutex_destroy(&bs.lock);
+	free(bs.workers);
+	free(bs.jobs);
+	arena_set_retain(0);
+	return status;
+}
+
+// Servers //
+
+// The lexer of the server's worker thread, which keeps its buffers warm
+// between requests
+static __thread lexer_t *worker_lexer = NULL;
+
+// Compiles a request like the command line with its arguments would, on top
+// of the options that the server was started with
+static void serve_request(server_request_t *request, server_response_t *response, void *data) {
+	options_t options = *(const options_t *) data;
+	const char *path = NULL;
+	bool valid = true;
+	int argc = (int) request->arg_count;
+	for(int i = 0; i < argc && valid; ) {
+		int taken = read_option(&options, argc, request->args, i);
+		if(taken == 0 && path == NULL) path = request->args[i], taken = 1;
+		valid = taken > 0;
+		i += taken;
+	}
+	// a request has either a path or the source, and the server's own
+	// standard input is no source
+	valid = valid && (path == NULL) != (request->source.string == NULL) && (path == NULL || strcmp(path, "-"));
+	if(!options.threads_given) options.lex_threads = options.parse_threads = 1;
+
+	job_t job = { .path = path ? path : "-", .source = EMPTY_STRING, .options = &options, .status = EXIT_SUCCESS };
+	job.out = open_memstream(&job.out_text, &job.out_size);
+	job.errors = open_memstream(&job.error_text, &job.error_size);
+	error_if(job.out == NULL || job.errors == NULL);
+	if(valid) {
+		// the lexer takes the source over
+		job.source = request->source;
+		request->source = EMPTY_STRING;
+		if(worker_lexer == NULL) worker_lexer = lexer_new();
+		compile(&job, worker_lexer, NULL, 0);
+	} else {
+		fprintf(job.errors, "Malformed request\n");
+		job.status = EXIT_FAILURE;
+	}
+	fclose(job.out);
+	fclose(job.errors);
+	response->status = job.status;
+	response->out = (string_t) { .size = job.out_size, .string = job.out_text };
+	response->errors = (string_t) { .size = job.error_size, .string = job.error_text };
+}
+
+// Answers requests on the socket until the server is stopped
+static void serve(const char *socket_path, size_t workers, options_t *options) {
+	int listener = server_listen(socket_path);
+	error_if(listener < 0);
+	// what one request leaves behind is picked up by the next
+	arena_set_retain(SERVER_RETAIN_BYTES);
+	cache_set_memory(SERVER_CACHE_BYTES);
+	vm_set_time_limit(SERVER_RUN_MILLISECONDS);
+	server_run(listener, workers ? workers : processors(), serve_request, options);
+	error_if(true);
+}
+
+static char *working_directory(void) {
+	for(size_t size = 256; ; size *= 2) {
+		char *path = malloc(size);
+		error_if(path == NULL);
+		if(getcwd(path, size)) return path;
+		free(path);
+		error_if(errno != ERANGE);
+	}
+}
+
+// Sends the files one after another to the server on the socket and prints
+// what comes back, the exit status is that of the first one that failed. A
+// path of "-" sends standard input along as the source.
+static int forward(const char *socket_path, char **args, size_t arg_count, const char **paths, size_t path_count) {
+	int fd = server_connect(socket_path);
+	error_if(fd < 0);
+	// relative paths are made absolute, the server has its own working directory
+	char *directory = working_directory();
+	int status = EXIT_SUCCESS;
+	for(size_t i = 0; i < path_count; i++) {
+		server_request_t request = { .args = args, .arg_count = arg_count + 1, .source = EMPTY_STRING };
+		source_t source = { .text = EMPTY_STRING, .mapped_size = 0 };
+		char *absolute = NULL;
+		if(!strcmp(paths[i], "-")) {
+			source = source_load("-");
+			error_if(source.text.string == NULL);
+			request.source = source.text;
+			request.arg_count = arg_count;
+		} else if(paths[i][0] != '/') {
+			absolute = malloc(strlen(directory) + strlen(paths[i]) + 2);
+			error_if(absolute == NULL);
+			sprintf(absolute, "%s/%s", directory, paths[i]);
+		}
+		args[arg_count] = absolute ? absolute : request.source.string ? NULL : (char *) paths[i];
+		args[arg_count + 1] = NULL;
+
+		server_response_t response;
+		error_if(!server_send(fd, &request) || !server_receive(fd, &response));
+		fwrite(response.out.string, 1, response.out.size, stdout);
+		fflush(stdout);
+		fwrite(response.errors.string, 1, response.errors.size, stderr);
+		fflush(stderr);
+		if(status == EXIT_SUCCESS) status = response.status;
+		server_response_free(&response);
+		source_release(&source);
+		free(absolute);
+	}
+	free(directory);
+	close(fd);
+	return status;
+}
+
+// Adds the paths in a response file, one per line, to the list. They point
+// into the returned text, which has to be freed after them.
+static char *read_response_file(const char *file_path, const char ***paths, size_t *count, size_t *capacity) {
+	FILE *file = fopen(file_path, "r");
+	error_if(file == NULL);
+	string_t text = str_read(file);
+	error_if(text.string == NULL);
+	fclose(file);
+	for(char *line = text.string; *line != '\0'; ) {
+		char *end = line + strcspn(line, "\n");
+		char *next = *end == '\n' ? end + 1 : end;
+		if(end > line && end[-1] == '\r') end--;
+		*end = '\0';
+		if(end > line) {
+			if(*count == *capacity) {
+				*capacity = *capacity ? *capacity * 2 : 16;
+				*paths = realloc(*paths, *capacity * sizeof(char *));
+				error_if(*paths == NULL);
+			}
+			(*paths)[(*count)++] = line;
+		}
+		line = next;
+	}
+	return text.string;
+}
 
 int main(int argc, char **argv) {
 	assert(sizeof(char) == 1);
-	if(argc != 2) exit(EXIT_FAILURE);
+	// before any thread lexes, which keeps the kernels the same for all of them
+	scan_init();
+
+	options_t options = default_options;
+	const char **paths = NULL;
+	const char *serve_path = NULL, *connect_path = NULL;
+	size_t path_count = 0, path_capacity = 0, workers = 0;
+	bool batch = false;
+	char **edits = malloc(argc * sizeof(char *));
+	char **responses = malloc(argc * sizeof(char *));
+	// the compile options that a client sends along, with room for a path
+	char **forwarded = malloc((argc + 1) * sizeof(char *));
+	size_t edit_count = 0, response_count = 0, forwarded_count = 0;
+	error_if(edits == NULL || responses == NULL || forwarded == NULL);
+	for(int i = 1; i < argc; i++) {
+		int taken = read_option(&options, argc, argv, i);
+		if(taken < 0) exit(EXIT_FAILURE);
+		else if(taken > 0) {
+			for(int j = 0; j < taken; j++) forwarded[forwarded_count++] = argv[i + j];
+			i += taken - 1;
+		}
+		else if(!strcmp(argv[i], "--stats") || !strcmp(argv[i], "--stats=text"))
+			stats_enable(STATS_TEXT);
+		else if(!strcmp(argv[i], "--stats=json")) stats_enable(STATS_JSON);
+		else if(!strcmp(argv[i], "--serve") && i + 1 < argc) serve_path = argv[++i];
+		else if(!strcmp(argv[i], "--connect") && i + 1 < argc) connect_path = argv[++i];
+		else if(!strcmp(argv[i], "--jobs") && i + 1 < argc) {
+			if(!read_threads(argv[++i], &workers)) exit(EXIT_FAILURE);
+		}
+		else if(!strcmp(argv[i], "--cache-dir") && i + 1 < argc)
+			cache_set_dir(argv[++i]);
+		else if(!strcmp(argv[i], "--edit") && i + 1 < argc)
+			edits[edit_count++] = argv[++i];
+		else if(argv[i][0] == '@') {
+			responses[response_count++] = read_response_file(argv[i] + 1, &paths, &path_count, &path_capacity);
+			batch = true;
+		} else {
+			if(path_count == path_capacity) {
+				path_capacity = path_capacity ? path_capacity * 2 : 16;
+				paths = realloc(paths, path_capacity * sizeof(char *));
+				error_if(paths == NULL);
+			}
+			paths[path_count++] = argv[i];
+		}
+	}
+	if(serve_path) {
+		if(path_count || edit_count || connect_path) exit(EXIT_FAILURE);
+		serve(serve_path, workers, &options);
+	}
+	batch = batch || path_count > 1;
+	if(path_count == 0 || ((batch || connect_path) && edit_count)) exit(EXIT_FAILURE);
 
-	lexer_init(argv[1]);
-	parser_start();
+	int status;
+	if(connect_path) status = forward(connect_path, forwarded, forwarded_count, paths, path_count);
+	else if(batch) status = compile_batch(paths, path_count, workers, options);
+	else {
+		job_t job = {
+			.path = paths[0], .source = EMPTY_STRING, .options = &options,
+			.out = stdout, .errors = stderr, .status = EXIT_SUCCESS
+		};
+		lexer_t *lexer = lexer_new();
+		compile(&job, lexer, edits, edit_count);
+		lexer_free(lexer);
+		status = job.status;
+	}
+	free(paths);
+	for(size_t i = 0; i < response_count; i++) free(responses[i]);
+	free(responses);
+	free(forwarded);
+	free(edits);
 
-	exit(EXIT_SUCCESS);
+	exit(status);
 }
@@ -0,0 +1,56 @@
+#include "buffer.h"
+
+#include "common/io.h"
+
+#include <stdlib.h>
+
+// External Functions //
+
+token_buffer_t token_buffer_new(size_t capacity) {
+	token_buffer_t buffer = {
+		.types = NULL, .offsets = NULL, .lengths = NULL, .symbols = NULL,
+		.numbers = NULL, .number_count = 0, .number_capacity = 0,
+		.count = 0, .capacity = 0
+	};
+	if(capacity) token_buffer_reserve(&buffer, capacity);
+	return buffer;
+}
+
+void token_buffer_reserve(token_buffer_t *buffer, size_t capacity) {
+	if(capacity <= buffer->capacity) return;
+	// grow geometrically so that pushing stays amortized constant time
+	if(capacity < buffer->capacity * 2) capacity = buffer->capacity * 2;
+
+	uint8_t *types = (uint8_t *) realloc(buffer->types, capacity * sizeof(*types));
+	error_if(types == NULL);
+	buffer->types = types;
+	uint32_t *offsets = (uint32_t *) realloc(buffer->offsets, capacity * sizeof(*offsets));
+	error_if(offsets == NULL);
+	buffer->offsets = offsets;
+	uint32_t *lengths = (uint32_t *) realloc(buffer->lengths, capacity * sizeof(*lengths));
+	error_if(lengths == NULL);
+	buffer->lengths = lengths;
+	symbol_t *symbols = (symbol_t *) realloc(buffer->symbols, capacity * sizeof(*symbols));
+	error_if(symbols == NULL);
+	buffer->symbols = symbols;
+	buffer->capacity = capacity;
+}
+
+void token_buffer_reserve_numbers(token_buffer_t *buffer, size_t capacity) {
+	if(capacity <= buffer->number_capacity) return;
+	if(capacity < buffer->number_capacity * 2) capacity = buffer->number_capacity * 2;
+
+	uint64_t *numbers = (uint64_t *) realloc(buffer->numbers, capacity * sizeof(*numbers));
+	error_if(numbers == NULL);
+	buffer->numbers = numbers;
+	buffer->number_capacity = capacity;
+}
+
+void token_buffer_free(token_buffer_t *buffer) {
+	free(buffer->types);
+	free(buffer->offsets);
+	free(buffer->lengths);
+	free(buffer->symbols);
+	free(buffer->numbers);
+	*buffer = token_buffer_new(0);
+}
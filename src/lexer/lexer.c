@@ -1,82 +1,91 @@
+#define _POSIX_C_SOURCE 200809L // sysconf
+
 #include "lexer.h"
+#include "buffer.h"
+#include "scan.h"
 
-#include "common/arena.h"
 #include "common/io.h"
+#include "common/source.h"
+#include "common/stats.h"
 
+#include <assert.h>
 #include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "hashmap.c"
+#include "dfa.c"
+
+// Inputs are only lexed in parallel if every thread gets at least this much
+#define LEX_MIN_CHUNK (256 * 1024)
+#define LEX_MAX_THREADS 64
 
-static struct lexer_state {
-	bool reinit;
+struct lexer {
+	lexer_mode_t mode;
+	size_t threads;
 
+	source_t source;
 	string_t input;
 	size_t input_ptr;
 
-	arena_t list;
-	token_list_t *next_ptr;
-	token_list_t *last_ptr;
-} ls;
+	token_buffer_t tokens;
+	bool lexed;
+	size_t next;
 
-// Internal Functions //
+	symbol_table_t symbols;
+};
 
-static bool _is_white_space(char c) {
-	switch(c) {
-		case ' ' : case '\t':
-		case '\r': case '\n':
-			return true;
-		default:
-			return false;
-	}
-}
+// Internal Functions //
 
 static bool _is_ident_part(char c) {
 	if(c == '_') return true;
 	return isalnum(c);
 }
 
-static char _get_char(bool consume) {
-	if(ls.input_ptr >= ls.input.size) return '\0';
-	char c = ls.input.string[ls.input_ptr];
-	if(consume) ls.input_ptr++;
+static char _get_char(lexer_t *lexer, bool consume) {
+	if(lexer->input_ptr >= lexer->input.size) return '\0';
+	char c = lexer->input.string[lexer->input_ptr];
+	if(consume) lexer->input_ptr++;
 	return c;
 }
 
-static char _skip_until(char c) {
-	while(true) {
-		char next = _get_char(true);
-		if(next == c) return _get_char(true);
-		else if(next == '\0') return next;
+static size_t _skip_blank(const char *src, size_t ptr, size_t end) {
+	// the null terminator sits at `end` so peeking one past the pointer is safe
+	while(ptr < end) {
+		// tokens are mostly separated by a single space or nothing at all,
+		// neither of which is worth a call into the vector kernels
+		if(src[ptr] == ' ') ptr++;
+		if((unsigned char) src[ptr] <= ' ') ptr = scan_skip_white(src, ptr, end);
+		if(src[ptr] != '/') break;
+		char lookahead = src[ptr + 1];
+		if(lookahead == '/') {
+			// the newline itself is skipped as whitespace on the next iteration
+			ptr = scan_find_byte(src, ptr + 2, end, '\n');
+		} else if(lookahead == '*') {
+			size_t close = scan_find_comment_end(src, ptr + 2, end);
+			ptr = close < end ? close + 2 : end;
+		} else break;
 	}
+	return ptr;
 }
 
-static void _cleanup_lexer(void) {
-	free(ls.input.string);
-	arena_free(&ls.list);
+static void _release(lexer_t *lexer) {
+	source_release(&lexer->source);
+	token_buffer_free(&lexer->tokens);
+	symbol_table_free(&lexer->symbols);
 }
 
 #define RET(x,n) return (token_t) { .type = x,\
-.content = { .size = n, .string = &ls.input.string[ls.input_ptr - n] } }
-static token_t _read_token(void) {
-	char current = _get_char(true);
-
+.content = { .size = n, .string = &lexer->input.string[lexer->input_ptr - n] } }
+static token_t _read_token_reference(lexer_t *lexer) {
 	// Skip whitespaces and comments
-	while(true) {
-		if(current == '/') {
-			char lookahead = _get_char(false);
-			if(lookahead == '/') current = _skip_until('\n');
-			else if(lookahead == '*') {
-				do current = _skip_until('*');
-				while(current != '/' && current != '\0');
-				current = _get_char(true);
-			} else break;
-		} else if(_is_white_space(current)) current = _get_char(true);
-		else break;
-	}
+	lexer->input_ptr = _skip_blank(lexer->input.string, lexer->input_ptr, lexer->input.size - 1);
+	char current = _get_char(lexer, true);
 
 	// Handle symbols and symbol sequences
 	switch(current) {
@@ -86,54 +95,54 @@ static token_t _read_token(void) {
 		case ':': RET(TOK_COLON, 1);
 		case ';': RET(TOK_SEMICOLON, 1);
 		case '=': {
-			if(_get_char(false) == '=') {
-				_get_char(true);
+			if(_get_char(lexer, false) == '=') {
+				_get_char(lexer, true);
 				RET(TOK_OP_COMPARE, 2);
 			} else RET(TOK_OP_ASSIGN, 1);
 		}
 		case '+': {
-			if(_get_char(false) == '=') {
-				_get_char(true);
+			if(_get_char(lexer, false) == '=') {
+				_get_char(lexer, true);
 				RET(TOK_OP_ASSIGN_ALT, 2);
 			} else RET(TOK_OP_PLUS, 1);
 		}
 		case '-': {
-			if(_get_char(false) == '=') {
-				_get_char(true);
+			if(_get_char(lexer, false) == '=') {
+				_get_char(lexer, true);
 				RET(TOK_OP_ASSIGN_ALT, 2);
 			} else RET(TOK_OP_MINUS, 1);
 		}
 		case '*': {
-			if(_get_char(false) == '=') {
-				_get_char(true);
+			if(_get_char(lexer, false) == '=') {
+				_get_char(lexer, true);
 				RET(TOK_OP_ASSIGN_ALT, 2);
 			} else RET(TOK_OP_MULT, 1);
 		}
 		case '/': {
-			if(_get_char(false) == '=') {
-				_get_char(true);
+			if(_get_char(lexer, false) == '=') {
+				_get_char(lexer, true);
 				RET(TOK_OP_ASSIGN_ALT, 2);
 			} else RET(TOK_OP_DIV, 1);
 		}
 		case '%': {
-			if(_get_char(false) == '=') {
-				_get_char(true);
+			if(_get_char(lexer, false) == '=') {
+				_get_char(lexer, true);
 				RET(TOK_OP_ASSIGN_ALT, 2);
 			} else RET(TOK_OP_MOD, 1);
 		}
 		case '>': {
-			if(_get_char(false) == '=') {
-				_get_char(true);
+			if(_get_char(lexer, false) == '=') {
+				_get_char(lexer, true);
 				RET(TOK_OP_COMPARE, 2);
 			} else RET(TOK_OP_COMPARE, 1);
 		}
 		case '<': {
-			char lookahead = _get_char(false);
+			char lookahead = _get_char(lexer, false);
 			if(lookahead == '=') {
-				_get_char(true);
+				_get_char(lexer, true);
 				RET(TOK_OP_COMPARE, 2);
 			} else if(lookahead == '>') {
-				_get_char(true);
+				_get_char(lexer, true);
 				RET(TOK_OP_COMPARE, 2);
 			} else RET(TOK_OP_COMPARE, 1);
 		}
@@ -143,80 +152,369 @@ static token_t _read_token(void) {
 		// Handle integer literals
 		size_t count = 1;
 		while(true) {
-			char lookahead = _get_char(false);
+			char lookahead = _get_char(lexer, false);
 			if(!_is_ident_part(lookahead)) break;
-			current = _get_char(true);
+			current = _get_char(lexer, true);
 			count++;
 		}
 		RET(TOK_LIT_NUM, count);
 	} else if(isalpha(current) || current == '_') {
 		// Handle identifiers and keywords
-		uint8_t hash = 0;
+		uint8_t hash = MAP_SEED;
 		size_t count = 1;
 		while(true) {
-			hash = map_sbox[hash ^ current];
-			char lookahead = _get_char(false);
+			hash = map_sbox[hash ^ (uint8_t) current];
+			char lookahead = _get_char(lexer, false);
 			if(!_is_ident_part(lookahead)) break;
-			current = _get_char(true);
+			current = _get_char(lexer, true);
 			count++;
 		}
-		hash &= MAP_SIZE - 1;
-		const char *content = &ls.input.string[ls.input_ptr - count];
-		const char *keyword = map_keys[hash];
-		if(strncmp(content, keyword, count)) RET(TOK_IDENT, count);
-		else RET(map_vals[hash], count);
+		const char *content = &lexer->input.string[lexer->input_ptr - count];
+		RET(map_lookup(content, count, hash), count);
 	} else if(current == '\0') RET(TOK_EOF, 1);
 	else RET(TOK_ERROR, 1);
 }
 #undef RET
 
-static token_list_t *_new_allocated_token(void) {
-	token_list_t *ret = (token_list_t *) arena_alloc(&ls.list, sizeof(token_list_t));
-	ret->token = _read_token(), ret->next = NULL;
-	return ret;
+// Reads the token starting at the given non-blank character of the input and
+// moves the pointer past it. Identifiers get the hash to intern them with.
+static token_type_t _read_token(const char *input, size_t *ptr, symbol_t *symbol) {
+	// the null terminator stops every state but the start state, so the
+	// loop never runs past the end of the input
+	const uint8_t *src = (const uint8_t *) input;
+	size_t start = *ptr, end = start;
+	uint8_t state = DFA_START, next, hash = MAP_SEED;
+	uint32_t wide_hash = SYMBOL_HASH_SEED;
+	while((next = dfa_next[state][dfa_class[src[end]]]) != DFA_STOP) {
+		hash = map_sbox[hash ^ src[end]];
+		wide_hash = symbol_hash_step(wide_hash, src[end]);
+		state = next, end++;
+	}
+
+	*ptr = end;
+	token_type_t type = dfa_accept[state];
+	if(type == TOK_IDENT) type = map_lookup(&input[start], end - start, hash);
+	*symbol = type == TOK_IDENT ? wide_hash : SYMBOL_NONE;
+	return type;
+}
+
+// Appends a number literal with its value, or an error token if it has
+// other characters than digits or is out of range
+static void _push_number(token_buffer_t *tokens, const char *src, size_t start, size_t end) {
+	uint64_t value;
+	scan_number_result_t result = scan_number(src, start, end, &value);
+	if(result == SCAN_NUMBER_MALFORMED)
+		token_buffer_push(tokens, TOK_ERROR, (uint32_t) start, (uint32_t) (end - start), SYMBOL_NONE);
+	else {
+		// the parser reports every literal that's too large the same way
+		if(result == SCAN_NUMBER_OVERFLOW || value > LEXER_MAX_NUMBER) value = LEXER_TOO_LARGE;
+		token_buffer_push_number(tokens, (uint32_t) start, (uint32_t) (end - start), value);
+	}
+}
+
+// Replaces the hashes that the identifiers were lexed with by their symbols
+// and the indices of number literals within their chunk by global ones
+static void _intern(token_buffer_t *tokens, symbol_table_t *symbols, const char *src) {
+	symbol_t number = 0;
+	for(size_t i = 0; i < tokens->count; i++) {
+		if(tokens->types[i] == TOK_LIT_NUM) tokens->symbols[i] = number++;
+		if(tokens->types[i] != TOK_IDENT) continue;
+		string_t name = { .size = tokens->lengths[i], .string = (char *) &src[tokens->offsets[i]] };
+		tokens->symbols[i] = symbol_intern(symbols, name, tokens->symbols[i]);
+	}
+}
+
+/** Lexes all tokens that start in the given range of the input. Lexing can
+  * only start outside of a comment and never stops inside of one, so the
+  * returned position can be past the end of the range. A null character
+  * inside the input ends lexing with an EOF token like the end of the input.
+  * @param tokens The buffer to append the tokens to.
+  * @param src The input to lex.
+  * @param ptr Index of the first character to lex.
+  * @param end Index one past the last character that a token may start at.
+  * @param input_end Index of the null terminator of the input.
+  * @param symbols Where to intern identifiers right away, or NULL to leave
+  * their hashes in the buffer for `_intern`.
+  * @return Index of the first character after the last token and any blanks
+  * following it, or `SIZE_MAX` if an EOF token was appended.
+  */
+static size_t _lex_range(
+	token_buffer_t *tokens, const char *src, size_t ptr, size_t end, size_t input_end,
+	symbol_table_t *symbols
+) {
+	while(true) {
+		ptr = _skip_blank(src, ptr, input_end);
+		if(ptr >= end) return ptr;
+		size_t start = ptr;
+		symbol_t symbol;
+		token_type_t type = _read_token(src, &ptr, &symbol);
+		if(type == TOK_LIT_NUM) {
+			_push_number(tokens, src, start, ptr);
+			continue;
+		}
+		if(type == TOK_IDENT && symbols != NULL) {
+			string_t name = { .size = ptr - start, .string = (char *) &src[start] };
+			symbol = symbol_intern(symbols, name, symbol);
+		}
+		token_buffer_push(tokens, type, (uint32_t) start, (uint32_t) (ptr - start), symbol);
+		if(type == TOK_EOF) return SIZE_MAX;
+	}
+}
+
+typedef struct lex_chunk {
+	const char *src;
+	size_t begin, end, input_end;
+	// Where lexing started after skipping the blanks at the beginning
+	size_t first;
+	// The result of `_lex_range` for this chunk
+	size_t stop;
+	token_buffer_t tokens;
+	pthread_t thread;
+} lex_chunk_t;
+
+static void *_lex_chunk(void *data) {
+	lex_chunk_t *chunk = (lex_chunk_t *) data;
+	token_buffer_reserve(&chunk->tokens, (chunk->end - chunk->begin) / 4 + 1);
+	chunk->first = _skip_blank(chunk->src, chunk->begin, chunk->input_end);
+	chunk->stop = _lex_range(&chunk->tokens, chunk->src, chunk->begin, chunk->end, chunk->input_end, NULL);
+	return NULL;
+}
+
+static size_t _pick_threads(const lexer_t *lexer) {
+	size_t input_size = lexer->input.size;
+	size_t threads = lexer->threads;
+	if(threads == 0) {
+		long online = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = online > 0 ? (size_t) online : 1;
+	}
+	size_t max_chunks = input_size / LEX_MIN_CHUNK;
+	if(threads > max_chunks) threads = max_chunks;
+	if(threads > LEX_MAX_THREADS) threads = LEX_MAX_THREADS;
+	return threads ? threads : 1;
+}
+
+/** Lexes the input on multiple threads. The input is cut into chunks at
+  * newlines, which tokens never span. Newlines inside of block comments aren't
+  * safe to cut at, but finding out requires lexing everything before them, so
+  * the cuts are made speculatively assuming they are safe. Stitching the chunks
+  * back together verifies that every chunk started lexing exactly where the
+  * previous one stopped and relexes the chunk from there if not.
+  * @param lexer The lexer to lex the input of.
+  * @param threads How many chunks to cut the input into.
+  */
+static void _lex_parallel(lexer_t *lexer, size_t threads) {
+	const char *src = lexer->input.string;
+	size_t input_end = lexer->input.size - 1;
+	lex_chunk_t chunks[LEX_MAX_THREADS];
+	size_t chunk_count = 0, begin = 0;
+
+	// pre-pass: cut after the first newline past every evenly spaced offset
+	for(size_t i = 1; i <= threads; i++) {
+		size_t end = input_end;
+		if(i < threads) {
+			size_t newline = scan_find_byte(src, i * input_end / threads, input_end, '\n');
+			end = newline < input_end ? newline + 1 : input_end;
+		}
+		if(end <= begin && i < threads) continue;
+		chunks[chunk_count++] = (lex_chunk_t) {
+			.src = src, .begin = begin, .end = end, .input_end = input_end,
+			.tokens = token_buffer_new(0)
+		};
+		begin = end;
+	}
+
+	// the first chunk is lexed on this thread and always starts out right
+	bool spawned[LEX_MAX_THREADS] = { false };
+	for(size_t i = 1; i < chunk_count; i++)
+		spawned[i] = !pthread_create(&chunks[i].thread, NULL, _lex_chunk, &chunks[i]);
+	_lex_chunk(&chunks[0]);
+
+	size_t total = 0, stop = 0;
+	for(size_t i = 0; i < chunk_count; i++) {
+		lex_chunk_t *chunk = &chunks[i];
+		// fall back to lexing here if the thread couldn't be created
+		if(spawned[i]) pthread_join(chunk->thread, NULL);
+		else if(i) _lex_chunk(chunk);
+
+		// everything after an EOF token is never looked at
+		if(stop == SIZE_MAX) {
+			token_buffer_free(&chunk->tokens);
+			continue;
+		}
+		if(i && chunk->first != stop) {
+			// the speculation failed, most likely due to a comment spanning the cut
+			chunk->tokens.count = chunk->tokens.number_count = 0;
+			chunk->stop = _lex_range(&chunk->tokens, src, stop, chunk->end, input_end, NULL);
+		}
+		stop = chunk->stop, total += chunk->tokens.count;
+	}
+
+	token_buffer_reserve(&lexer->tokens, total + 1);
+	for(size_t i = 0; i < chunk_count; i++) {
+		token_buffer_t *tokens = &chunks[i].tokens;
+		if(!tokens->types) continue;
+		token_buffer_reserve_numbers(&lexer->tokens, lexer->tokens.number_count + tokens->number_count);
+		memcpy(&lexer->tokens.numbers[lexer->tokens.number_count], tokens->numbers, tokens->number_count * sizeof(uint64_t));
+		lexer->tokens.number_count += tokens->number_count;
+		memcpy(&lexer->tokens.types[lexer->tokens.count], tokens->types, tokens->count * sizeof(uint8_t));
+		memcpy(&lexer->tokens.offsets[lexer->tokens.count], tokens->offsets, tokens->count * sizeof(uint32_t));
+		memcpy(&lexer->tokens.lengths[lexer->tokens.count], tokens->lengths, tokens->count * sizeof(uint32_t));
+		memcpy(&lexer->tokens.symbols[lexer->tokens.count], tokens->symbols, tokens->count * sizeof(symbol_t));
+		lexer->tokens.count += tokens->count;
+		token_buffer_free(tokens);
+	}
+	if(stop != SIZE_MAX) token_buffer_push(&lexer->tokens, TOK_EOF, (uint32_t) input_end, 1, SYMBOL_NONE);
+	// the symbols are numbered in source order like when lexing on one thread,
+	// and the literals are numbered as they come after the stitched ones
+	_intern(&lexer->tokens, &lexer->symbols, src);
+}
+
+static void _lex_tokens(lexer_t *lexer) {
+	if(lexer->mode == LEXER_MODE_REFERENCE) {
+		// most tokens are a few characters long plus some separating whitespace
+		token_buffer_reserve(&lexer->tokens, lexer->input.size / 4 + 1);
+		const char *src = lexer->input.string;
+		token_t token;
+		do {
+			token = _read_token_reference(lexer);
+			uint32_t offset = (uint32_t) (token.content.string - src);
+			if(token.type == TOK_LIT_NUM) {
+				_push_number(&lexer->tokens, src, offset, offset + token.content.size);
+				continue;
+			}
+			symbol_t symbol = token.type == TOK_IDENT ? lexer_intern(lexer, token.content) : SYMBOL_NONE;
+			token_buffer_push(&lexer->tokens, token.type, offset, (uint32_t) token.content.size, symbol);
+		} while(token.type != TOK_EOF);
+		return;
+	}
+
+	size_t threads = _pick_threads(lexer);
+	if(threads > 1) {
+		_lex_parallel(lexer, threads);
+		return;
+	}
+
+	size_t input_end = lexer->input.size - 1;
+	token_buffer_reserve(&lexer->tokens, lexer->input.size / 4 + 1);
+	if(_lex_range(&lexer->tokens, lexer->input.string, 0, input_end, input_end, &lexer->symbols) != SIZE_MAX)
+		token_buffer_push(&lexer->tokens, TOK_EOF, (uint32_t) input_end, 1, SYMBOL_NONE);
+}
+
+static void _lex_all(lexer_t *lexer) {
+	lexer->lexed = true;
+	stats_phase_t phase = stats_enter(STATS_LEX);
+	_lex_tokens(lexer);
+	stats_count_tokens(lexer->tokens.types, lexer->tokens.count);
+	stats_leave(phase);
 }
 
 // External Functions //
 
-void lexer_init(const char *file_path) {
-	if(ls.reinit) _cleanup_lexer();
-	else atexit(_cleanup_lexer), ls.reinit = true;
-
-	FILE *fdesc = fopen(file_path, "r");
-	error_if(!fdesc);
-	string_t file = str_read(fdesc);
-	error_if(!file.string);
-	fclose(fdesc);
-
-	ls.input = file;
-	ls.input_ptr = 0;
-	ls.list = arena_new(64 * sizeof(token_list_t));
-	ls.last_ptr = _new_allocated_token();
-	ls.next_ptr = ls.last_ptr;
-}
-
-void lexer_backtrack(token_t *next_ptr) {
-	uintptr_t struct_addr = (uintptr_t) next_ptr - offsetof(token_list_t, token);
-	ls.next_ptr = (token_list_t *) struct_addr;
-}
-
-token_t *lexer_next(void) {
-	token_list_t *ret;
-	if(ls.next_ptr == ls.last_ptr) {
-		ret = ls.last_ptr;
-		ls.last_ptr = _new_allocated_token();
-		ret->next = ls.next_ptr = ls.last_ptr;
-	} else {
-		ret = ls.next_ptr;
-		ls.next_ptr = ls.next_ptr->next;
+lexer_t *lexer_new(void) {
+	lexer_t *lexer = (lexer_t *) malloc(sizeof(lexer_t));
+	error_if(lexer == NULL);
+	*lexer = (lexer_t) {
+		.mode = LEXER_MODE_TABLE, .threads = 0,
+		.source = { .text = EMPTY_STRING, .mapped_size = 0 },
+		.input = EMPTY_STRING, .input_ptr = 0,
+		.tokens = token_buffer_new(0), .lexed = false, .next = 0,
+		.symbols = symbol_table_new()
+	};
+	return lexer;
+}
+
+void lexer_free(lexer_t *lexer) {
+	_release(lexer);
+	free(lexer);
+}
+
+void lexer_set_mode(lexer_t *lexer, lexer_mode_t mode) {
+	lexer->mode = mode;
+}
+
+void lexer_set_threads(lexer_t *lexer, size_t threads) {
+	lexer->threads = threads;
+}
+
+bool lexer_load(lexer_t *lexer, const char *file_path) {
+	source_t source = source_load(file_path);
+	if(!source.text.string) {
+		int error = errno;
+		lexer_load_source(lexer, source);
+		errno = error;
+		return false;
+	}
+	return lexer_load_source(lexer, source);
+}
+
+bool lexer_load_source(lexer_t *lexer, source_t source) {
+	// the token buffer keeps its capacity for the next source
+	source_release(&lexer->source);
+	lexer->tokens.count = lexer->tokens.number_count = 0;
+	symbol_table_free(&lexer->symbols);
+	lexer->source = source;
+	if(!lexer->source.text.string) return false;
+	// token offsets and lengths are stored in 32 bits
+	if(lexer->source.text.size > UINT32_MAX) {
+		source_release(&lexer->source);
+		errno = EFBIG;
+		return false;
 	}
-	return &ret->token;
+
+	lexer->input = lexer->source.text;
+	lexer->input_ptr = 0;
+	lexer->lexed = false;
+	lexer->next = 0;
+	return true;
+}
+
+bool lexer_init(lexer_t *lexer, const char *file_path) {
+	if(!lexer_load(lexer, file_path)) return false;
+	_lex_all(lexer);
+	return true;
+}
+
+void lexer_lex(struct token_buffer *tokens, symbol_table_t *symbols, string_t text, size_t begin) {
+	size_t input_end = text.size - 1;
+	if(_lex_range(tokens, text.string, begin, input_end, input_end, symbols) != SIZE_MAX)
+		token_buffer_push(tokens, TOK_EOF, (uint32_t) input_end, 1, SYMBOL_NONE);
+}
+
+size_t lexer_position(const lexer_t *lexer) {
+	return lexer->next;
+}
+
+void lexer_backtrack(lexer_t *lexer, size_t position) {
+	assert(position < lexer->tokens.count);
+	lexer->next = position;
+}
+
+token_t lexer_next(lexer_t *lexer) {
+	if(!lexer->lexed) _lex_all(lexer);
+	token_t ret = token_buffer_get(&lexer->tokens, lexer->input.string, lexer->next);
+	// the stream ends with an EOF token that is returned indefinitely
+	if(lexer->next + 1 < lexer->tokens.count) lexer->next++;
+	return ret;
+}
+
+token_t lexer_peek(lexer_t *lexer) {
+	if(!lexer->lexed) _lex_all(lexer);
+	return token_buffer_get(&lexer->tokens, lexer->input.string, lexer->next);
+}
+
+const token_buffer_t *lexer_get_tokens(lexer_t *lexer) {
+	if(!lexer->lexed) _lex_all(lexer);
+	return &lexer->tokens;
+}
+
+string_t lexer_get_src(const lexer_t *lexer) {
+	return lexer->input;
 }
 
-token_t *lexer_peek(void) {
-	return &ls.last_ptr->token;
+symbol_table_t *lexer_get_symbols(lexer_t *lexer) {
+	return &lexer->symbols;
 }
 
-string_t lexer_get_src(void) {
-	return ls.input;
+symbol_t lexer_intern(lexer_t *lexer, string_t name) {
+	return symbol_intern(&lexer->symbols, name, symbol_hash(name.string, name.size));
 }
@@ -0,0 +1,230 @@
+#include "scan.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#define SCAN_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(SCAN_SSE2) && defined(__GNUC__)
+#define SCAN_AVX2
+#include <immintrin.h>
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+// Internal Functions //
+
+static bool _is_white_space(char c) {
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Loads 8 bytes so that the first one ends up in the low byte of the word
+static uint64_t _load_word(const char *src) {
+	uint64_t word;
+	memcpy(&word, src, sizeof(word));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	word = __builtin_bswap64(word);
+#endif
+	return word;
+}
+
+// Whether every byte is within '0' to '9', which is when both the byte and
+// the byte plus 6 have a high nibble of 3
+static bool _is_eight_digits(uint64_t word) {
+	const uint64_t high = 0xF0F0F0F0F0F0F0F0, threes = 0x3030303030303030;
+	return (word & high) == threes && ((word + 0x0606060606060606) & high) == threes;
+}
+
+// Combines the digits in pairs, then in fours and finally into one number,
+// with the first digit in the low byte as the most significant one
+static uint64_t _parse_eight_digits(uint64_t word) {
+	word -= 0x3030303030303030;
+	word = word * 10 + (word >> 8);
+	const uint64_t pairs = 0x000000FF000000FF;
+	return ((word & pairs) * (100 + (1000000ULL << 32))
+		+ ((word >> 16) & pairs) * (1 + (10000ULL << 32))) >> 32;
+}
+
+// Appends digits to a number, failing if it no longer fits
+static bool _append_digits(uint64_t *value, uint64_t scale, uint64_t digits) {
+	return !__builtin_mul_overflow(*value, scale, value) && !__builtin_add_overflow(*value, digits, value);
+}
+
+// The scalar kernels double as the tails of the vectorized ones
+
+static size_t _skip_white_scalar(const char *src, size_t begin, size_t end) {
+	while(begin < end && _is_white_space(src[begin])) begin++;
+	return begin;
+}
+
+static size_t _find_byte_scalar(const char *src, size_t begin, size_t end, char c) {
+	while(begin < end && src[begin] != c) begin++;
+	return begin;
+}
+
+static size_t _find_comment_end_scalar(const char *src, size_t begin, size_t end) {
+	for(; begin + 1 < end; begin++)
+		if(src[begin] == '*' && src[begin + 1] == '/') return begin;
+	return end;
+}
+
+#ifdef SCAN_SSE2
+
+static size_t _skip_white_sse2(const char *src, size_t begin, size_t end) {
+	const __m128i space = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\t');
+	const __m128i cr = _mm_set1_epi8('\r'), lf = _mm_set1_epi8('\n');
+	for(; begin + 16 <= end; begin += 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i *) &src[begin]);
+		__m128i white = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(chunk, space), _mm_cmpeq_epi8(chunk, tab)),
+			_mm_or_si128(_mm_cmpeq_epi8(chunk, cr), _mm_cmpeq_epi8(chunk, lf)));
+		unsigned mask = ~(unsigned) _mm_movemask_epi8(white) & 0xFFFF;
+		if(mask) return begin + __builtin_ctz(mask);
+	}
+	return _skip_white_scalar(src, begin, end);
+}
+
+static size_t _find_byte_sse2(const char *src, size_t begin, size_t end, char c) {
+	const __m128i needle = _mm_set1_epi8(c);
+	for(; begin + 16 <= end; begin += 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i *) &src[begin]);
+		unsigned mask = (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+		if(mask) return begin + __builtin_ctz(mask);
+	}
+	return _find_byte_scalar(src, begin, end, c);
+}
+
+static size_t _find_comment_end_sse2(const char *src, size_t begin, size_t end) {
+	const __m128i star = _mm_set1_epi8('*'), slash = _mm_set1_epi8('/');
+	// the second load reaches one byte further than the first
+	for(; begin + 17 <= end; begin += 16) {
+		__m128i first = _mm_loadu_si128((const __m128i *) &src[begin]);
+		__m128i second = _mm_loadu_si128((const __m128i *) &src[begin + 1]);
+		unsigned mask = (unsigned) _mm_movemask_epi8(_mm_and_si128(
+			_mm_cmpeq_epi8(first, star), _mm_cmpeq_epi8(second, slash)));
+		if(mask) return begin + __builtin_ctz(mask);
+	}
+	return _find_comment_end_scalar(src, begin, end);
+}
+
+#endif // SCAN_SSE2
+
+#ifdef SCAN_AVX2
+
+TARGET_AVX2 static size_t _skip_white_avx2(const char *src, size_t begin, size_t end) {
+	const __m256i space = _mm256_set1_epi8(' '), tab = _mm256_set1_epi8('\t');
+	const __m256i cr = _mm256_set1_epi8('\r'), lf = _mm256_set1_epi8('\n');
+	for(; begin + 32 <= end; begin += 32) {
+		__m256i chunk = _mm256_loadu_si256((const __m256i *) &src[begin]);
+		__m256i white = _mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpeq_epi8(chunk, space), _mm256_cmpeq_epi8(chunk, tab)),
+			_mm256_or_si256(_mm256_cmpeq_epi8(chunk, cr), _mm256_cmpeq_epi8(chunk, lf)));
+		uint32_t mask = ~(uint32_t) _mm256_movemask_epi8(white);
+		if(mask) return begin + __builtin_ctz(mask);
+	}
+	return _skip_white_sse2(src, begin, end);
+}
+
+TARGET_AVX2 static size_t _find_byte_avx2(const char *src, size_t begin, size_t end, char c) {
+	const __m256i needle = _mm256_set1_epi8(c);
+	for(; begin + 32 <= end; begin += 32) {
+		__m256i chunk = _mm256_loadu_si256((const __m256i *) &src[begin]);
+		uint32_t mask = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle));
+		if(mask) return begin + __builtin_ctz(mask);
+	}
+	return _find_byte_sse2(src, begin, end, c);
+}
+
+TARGET_AVX2 static size_t _find_comment_end_avx2(const char *src, size_t begin, size_t end) {
+	const __m256i star = _mm256_set1_epi8('*'), slash = _mm256_set1_epi8('/');
+	for(; begin + 33 <= end; begin += 32) {
+		__m256i first = _mm256_loadu_si256((const __m256i *) &src[begin]);
+		__m256i second = _mm256_loadu_si256((const __m256i *) &src[begin + 1]);
+		uint32_t mask = (uint32_t) _mm256_movemask_epi8(_mm256_and_si256(
+			_mm256_cmpeq_epi8(first, star), _mm256_cmpeq_epi8(second, slash)));
+		if(mask) return begin + __builtin_ctz(mask);
+	}
+	return _find_comment_end_sse2(src, begin, end);
+}
+
+#endif // SCAN_AVX2
+
+// Kernel Selection //
+
+#if defined(SCAN_SSE2)
+static size_t (*skip_white)(const char *, size_t, size_t) = _skip_white_sse2;
+static size_t (*find_byte)(const char *, size_t, size_t, char) = _find_byte_sse2;
+static size_t (*find_comment_end)(const char *, size_t, size_t) = _find_comment_end_sse2;
+#else
+static size_t (*skip_white)(const char *, size_t, size_t) = _skip_white_scalar;
+static size_t (*find_byte)(const char *, size_t, size_t, char) = _find_byte_scalar;
+static size_t (*find_comment_end)(const char *, size_t, size_t) = _find_comment_end_scalar;
+#endif
+
+// The kernels are only ever selected once
+static pthread_once_t selected = PTHREAD_ONCE_INIT;
+
+static void _select_kernels(void) {
+#ifdef SCAN_AVX2
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2")) {
+		skip_white = _skip_white_avx2;
+		find_byte = _find_byte_avx2;
+		find_comment_end = _find_comment_end_avx2;
+	}
+#endif
+}
+
+// External Functions //
+
+void scan_init(void) {
+	pthread_once(&selected, _select_kernels);
+}
+
+size_t scan_skip_white(const char *src, size_t begin, size_t end) {
+	return skip_white(src, begin, end);
+}
+
+size_t scan_find_byte(const char *src, size_t begin, size_t end, char c) {
+	return find_byte(src, begin, end, c);
+}
+
+size_t scan_find_comment_end(const char *src, size_t begin, size_t end) {
+	return find_comment_end(src, begin, end);
+}
+
+scan_number_result_t scan_number(const char *src, size_t begin, size_t end, uint64_t *value) {
+	static const uint64_t powers[8] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000 };
+	uint64_t result = 0;
+	// the rest is still checked for non-digits once the number overflowed
+	bool fits = true;
+	for(; begin + 8 <= end; begin += 8) {
+		uint64_t word = _load_word(&src[begin]);
+		if(!_is_eight_digits(word)) return SCAN_NUMBER_MALFORMED;
+		fits = fits && _append_digits(&result, 100000000, _parse_eight_digits(word));
+	}
+
+	size_t count = end - begin;
+	if(count && end >= 8) {
+		// load the word ending with the last digit and pad the bytes before the
+		// remaining digits with zeros
+		uint64_t word = _load_word(&src[end - 8]);
+		size_t shift = (8 - count) * 8;
+		word = (word >> shift << shift) | (0x3030303030303030 >> count * 8);
+		if(!_is_eight_digits(word)) return SCAN_NUMBER_MALFORMED;
+		fits = fits && _append_digits(&result, powers[count], _parse_eight_digits(word));
+	} else {
+		for(; begin < end; begin++) {
+			uint8_t digit = (uint8_t) (src[begin] - '0');
+			if(digit > 9) return SCAN_NUMBER_MALFORMED;
+			fits = fits && _append_digits(&result, 10, digit);
+		}
+	}
+	if(!fits) return SCAN_NUMBER_OVERFLOW;
+	*value = result;
+	return SCAN_NUMBER_OK;
+}
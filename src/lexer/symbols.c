@@ -0,0 +1,82 @@
+#include "symbols.h"
+
+#include "common/io.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Size of the regions of the arena, which mostly holds names
+#define SYMBOL_REGION_SIZE 4096
+// Slots the table starts out with, a power of two
+#define SYMBOL_MIN_SLOTS 256
+
+// Internal Functions //
+
+static struct symbol_slot *_find(const symbol_table_t *table, string_t name, uint32_t hash) {
+	size_t mask = table->slot_capacity - 1;
+	for(size_t index = hash & mask; ; index = (index + 1) & mask) {
+		struct symbol_slot *slot = &table->slots[index];
+		if(slot->symbol == 0) return slot;
+		if(slot->hash != hash) continue;
+		string_t other = table->names[slot->symbol - 1];
+		if(other.size == name.size && !memcmp(other.string, name.string, name.size)) return slot;
+	}
+}
+
+static void _grow_slots(symbol_table_t *table) {
+	struct symbol_slot *old = table->slots;
+	size_t old_capacity = table->slot_capacity;
+	table->slot_capacity = old_capacity ? old_capacity * 2 : SYMBOL_MIN_SLOTS;
+	table->slots = arena_alloc_zeroed(&table->arena, table->slot_capacity * sizeof(struct symbol_slot));
+	// the names are all different, so every one goes into the first empty slot
+	size_t mask = table->slot_capacity - 1;
+	for(size_t i = 0; i < old_capacity; i++) {
+		if(old[i].symbol == 0) continue;
+		size_t index = old[i].hash & mask;
+		while(table->slots[index].symbol != 0) index = (index + 1) & mask;
+		table->slots[index] = old[i];
+	}
+}
+
+// External Functions //
+
+symbol_table_t symbol_table_new(void) {
+	return (symbol_table_t) {
+		.arena = arena_new(SYMBOL_REGION_SIZE),
+		.slots = NULL, .slot_capacity = 0,
+		.names = NULL, .count = 0, .name_capacity = 0
+	};
+}
+
+uint32_t symbol_hash(const char *name, size_t size) {
+	uint32_t hash = SYMBOL_HASH_SEED;
+	for(size_t i = 0; i < size; i++) hash = symbol_hash_step(hash, (uint8_t) name[i]);
+	return hash;
+}
+
+symbol_t symbol_intern(symbol_table_t *table, string_t name, uint32_t hash) {
+	// keep the table at most half full
+	if(table->count * 2 >= table->slot_capacity) _grow_slots(table);
+	struct symbol_slot *slot = _find(table, name, hash);
+	if(slot->symbol != 0) return slot->symbol - 1;
+
+	if(table->count == table->name_capacity) {
+		table->name_capacity = table->name_capacity ? table->name_capacity * 2 : SYMBOL_MIN_SLOTS;
+		string_t *names = (string_t *) realloc(table->names, table->name_capacity * sizeof(string_t));
+		error_if(names == NULL);
+		table->names = names;
+	}
+	char *copy = arena_alloc(&table->arena, name.size + 1);
+	memcpy(copy, name.string, name.size);
+	copy[name.size] = '\0';
+	table->names[table->count] = (string_t) { .size = name.size, .string = copy };
+
+	*slot = (struct symbol_slot) { .hash = hash, .symbol = (uint32_t) ++table->count };
+	return slot->symbol - 1;
+}
+
+void symbol_table_free(symbol_table_t *table) {
+	arena_free(&table->arena);
+	free(table->names);
+	*table = symbol_table_new();
+}
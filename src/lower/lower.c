@@ -0,0 +1,165 @@
+#include "lower.h"
+
+#include "common/array.h"
+#include "common/io.h"
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Stands in for the target that lower_branch was given
+#define NO_ENTRY SIZE_MAX
+
+// The right operand of an `and` or `or` that lower_branch comes back to once
+// the left one is lowered
+typedef struct pending_branch {
+	Node *node;
+	bool when;
+	/// Index of the entry whose skip the jumps go to or NO_ENTRY.
+	size_t target;
+	/// Where jumps go that decide the operation without the right operand.
+	size_t skip;
+	bool skips;
+} pending_branch_t;
+
+// Internal Functions //
+
+static bool _is_logical(OpType op) {
+	return op == OP_AND || op == OP_OR;
+}
+
+// External Functions //
+
+void lower_error(lower_t *lower, const char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	vfprintf(lower->errors, fmt, args);
+	va_end(args);
+	longjmp(lower->fail, 1);
+}
+
+const lower_var_t *lower_lookup(lower_t *lower, const IdentNode *ident) {
+	size_t index = ident->symbol < lower->binding_capacity ? lower->bindings[ident->symbol] : 0;
+	if(index == 0) lower_error(lower, "Undeclared variable %.*s\n", (int) ident->name.size, ident->name.string);
+	return &lower->vars[index - 1];
+}
+
+void lower_declare(lower_t *lower, lower_var_t var) {
+	if(lower->var_count == lower->var_capacity) {
+		lower->vars = array_grow(lower->vars, &lower->var_capacity, sizeof(lower_var_t));
+	}
+	if(var.symbol >= lower->binding_capacity) {
+		size_t old_capacity = lower->binding_capacity;
+		lower->binding_capacity = var.symbol + 1 > old_capacity * 2 ? var.symbol + 1 : old_capacity * 2;
+		lower->bindings = realloc(lower->bindings, lower->binding_capacity * sizeof(size_t));
+		error_if(lower->bindings == NULL);
+		memset(&lower->bindings[old_capacity], 0, (lower->binding_capacity - old_capacity) * sizeof(size_t));
+	}
+	var.shadowed = lower->bindings[var.symbol];
+	lower->vars[lower->var_count++] = var;
+	lower->bindings[var.symbol] = lower->var_count;
+}
+
+void lower_leave_scope(lower_t *lower, size_t var_count) {
+	while(lower->var_count > var_count) {
+		const lower_var_t *var = &lower->vars[--lower->var_count];
+		lower->bindings[var->symbol] = var->shadowed;
+	}
+}
+
+void lower_free(lower_t *lower) {
+	free(lower->vars);
+	free(lower->bindings);
+	lower->vars = NULL, lower->var_count = lower->var_capacity = 0;
+	lower->bindings = NULL, lower->binding_capacity = 0;
+	ast_stack_free(&lower->chain);
+}
+
+bool lower_is_leaf(const Node *node) {
+	return node->type == NODE_NUMBER || node->type == NODE_IDENT
+		|| node->type == NODE_BOOL || node->type == NODE_NIL;
+}
+
+bool lower_writes_late(const Node *node) {
+	switch(node->type) {
+		case NODE_NUMBER:
+		case NODE_BOOL:
+		case NODE_NIL:
+		case NODE_IDENT:
+		case NODE_CALL:
+			return true;
+		case NODE_UNARY_OP: {
+			const UnaryOpNode *unary_op = (const UnaryOpNode *) node;
+			return unary_op->op != OP_POS || lower_writes_late(unary_op->operand);
+		}
+		case NODE_BINARY_OP: {
+			OpType op = ((const BinaryOpNode *) node)->op;
+			return op > OP_ASSIGN_MOD && op != OP_AND && op != OP_OR;
+		}
+		default:
+			return false;
+	}
+}
+
+bool lower_literal(const Node *node, int64_t *value) {
+	if(node->type == NODE_NUMBER) {
+		*value = (int64_t) ((const NumberNode *) node)->value;
+		return true;
+	}
+	const UnaryOpNode *unary_op = (const UnaryOpNode *) node;
+	if(node->type != NODE_UNARY_OP || unary_op->op != OP_NEG) return false;
+	if(unary_op->operand->type != NODE_NUMBER) return false;
+	*value = (int64_t) (0 - ((const NumberNode *) unary_op->operand)->value);
+	return true;
+}
+
+bool lower_copies_left(const BinaryOpNode *node) {
+	return node->left->type == NODE_IDENT && !lower_is_leaf(node->right);
+}
+
+void lower_push_chain(lower_t *lower, BinaryOpNode *node) {
+	bool logical = _is_logical(node->op);
+	while(true) {
+		ast_stack_push(&lower->chain, (Node *) node);
+		if(node->left->type != NODE_BINARY_OP) return;
+		node = (BinaryOpNode *) node->left;
+		if(node->op <= OP_ASSIGN_MOD || _is_logical(node->op) != logical) return;
+	}
+}
+
+void lower_branch(const lower_jumps_t *jumps, Node *node, bool when, size_t *target) {
+	// goes down the left operands first and comes back for the right ones
+	pending_branch_t *pending = NULL;
+	size_t count = 0, capacity = 0, to = NO_ENTRY;
+	while(true) {
+		if(node->type == NODE_UNARY_OP && ((UnaryOpNode *) node)->op == OP_NOT) {
+			node = ((UnaryOpNode *) node)->operand, when = !when;
+			continue;
+		}
+		BinaryOpNode *binary_op = (BinaryOpNode *) node;
+		if(node->type != NODE_BINARY_OP || !_is_logical(binary_op->op)) break;
+		if(count == capacity) pending = array_grow(pending, &capacity, sizeof(pending_branch_t));
+		// `a and b` is false as soon as a is, `a or b` true as soon as a is
+		bool shortcut = binary_op->op == OP_OR;
+		pending[count] = (pending_branch_t) {
+			.node = binary_op->right, .when = when, .target = to, .skip = 0, .skips = when != shortcut
+		};
+		if(when != shortcut) {
+			pending[count].skip = jumps->new_target();
+			to = count, when = !when;
+		}
+		count++;
+		node = binary_op->left;
+	}
+
+	size_t *first = to == NO_ENTRY ? target : &pending[to].skip;
+	if(node->type != NODE_BOOL) jumps->test(node, when, first);
+	else if(((BoolNode *) node)->value == when) jumps->jump(first);
+	while(count > 0) {
+		pending_branch_t *entry = &pending[--count];
+		lower_branch(jumps, entry->node, entry->when,
+			entry->target == NO_ENTRY ? target : &pending[entry->target].skip);
+		if(entry->skips) jumps->place(entry->skip);
+	}
+	free(pending);
+}
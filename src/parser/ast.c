@@ -2,25 +2,32 @@
 #include "parser/ast.h"
 
 #include <stdlib.h>
+#include <string.h>
 
-Node* ast_new_block(void* children, size_t size) {
-  BlockNode* block = malloc(sizeof(BlockNode));
+const char* op_type_strs[] = {
+  FOREACH_OP(GENERATE_OP_STRS)
+};
+
+Node* ast_new_block(arena_t* arena, Node** children, size_t size) {
+  BlockNode* block = arena_alloc(arena, sizeof(BlockNode));
   block->base.type = NODE_BLOCK;
   block->size = size;
-  block->children = children;
+  // the children are copied, so they can be built in temporary storage
+  block->children = size ? arena_alloc(arena, size * sizeof(Node*)) : NULL;
+  if (size) memcpy(block->children, children, size * sizeof(Node*));
   return (Node*)block;
 }
 
-Node* ast_new_number(unsigned int value) {
-  NumberNode* number = malloc(sizeof(NumberNode));
+Node* ast_new_number(arena_t* arena, uint64_t value) {
+  NumberNode* number = arena_alloc(arena, sizeof(NumberNode));
   number->base.type = NODE_NUMBER;
   number->value = value;
   return (Node*)number;
 }
 
 
-Node* ast_new_binary_op(Node* left, Node* right, token_type_t op) {
-  BinaryOpNode* binary_op = malloc(sizeof(BinaryOpNode));
+Node* ast_new_binary_op(arena_t* arena, Node* left, Node* right, OpType op) {
+  BinaryOpNode* binary_op = arena_alloc(arena, sizeof(BinaryOpNode));
   binary_op->base.type = NODE_BINARY_OP;
   binary_op->left = left;
   binary_op->right = right;
@@ -28,16 +35,90 @@ Node* ast_new_binary_op(Node* left, Node* right, token_type_t op) {
   return (Node*)binary_op;
 }
 
-void ast_node_append(void** children, size_t* size, Node* node) {
-  *children = realloc(*children, (*size + 1) * sizeof(Node*));
-  ((Node**)*children)[*size] = node;
-  (*size)++;
+Node* ast_new_ident(arena_t* arena, string_t name, symbol_t symbol) {
+  IdentNode* ident = arena_alloc(arena, sizeof(IdentNode));
+  ident->base.type = NODE_IDENT;
+  ident->name = name;
+  ident->symbol = symbol;
+  return (Node*)ident;
+}
+
+Node* ast_new_var(arena_t* arena, token_type_t var_type, string_t name, symbol_t symbol, Node* value) {
+  VarNode* var = arena_alloc(arena, sizeof(VarNode));
+  var->base.type = NODE_VAR;
+  var->var_type = var_type;
+  var->name = name;
+  var->symbol = symbol;
+  var->value = value;
+  return (Node*)var;
+}
+
+Node* ast_new_if(arena_t* arena, Node* condition, Node* then, Node* otherwise) {
+  IfNode* if_node = arena_alloc(arena, sizeof(IfNode));
+  if_node->base.type = NODE_IF;
+  if_node->condition = condition;
+  if_node->then = then;
+  if_node->otherwise = otherwise;
+  return (Node*)if_node;
 }
 
-void ast_node_erase(void** children, size_t* size, size_t index) {
-  for (size_t i = index; i < *size - 1; i++) {
-    ((Node**)*children)[i] = ((Node**)*children)[i + 1];
+Node* ast_new_while(arena_t* arena, Node* condition, Node* body) {
+  WhileNode* while_node = arena_alloc(arena, sizeof(WhileNode));
+  while_node->base.type = NODE_WHILE;
+  while_node->condition = condition;
+  while_node->body = body;
+  return (Node*)while_node;
+}
+
+Node* ast_new_return(arena_t* arena, Node* value) {
+  ReturnNode* return_node = arena_alloc(arena, sizeof(ReturnNode));
+  return_node->base.type = NODE_RETURN;
+  return_node->value = value;
+  return (Node*)return_node;
+}
+
+Node* ast_new_unary_op(arena_t* arena, Node* operand, OpType op) {
+  UnaryOpNode* unary_op = arena_alloc(arena, sizeof(UnaryOpNode));
+  unary_op->base.type = NODE_UNARY_OP;
+  unary_op->op = op;
+  unary_op->operand = operand;
+  return (Node*)unary_op;
+}
+
+Node* ast_new_call(arena_t* arena, string_t name, symbol_t symbol, Node** args, size_t size) {
+  CallNode* call = arena_alloc(arena, sizeof(CallNode));
+  call->base.type = NODE_CALL;
+  call->name = name;
+  call->symbol = symbol;
+  call->size = size;
+  call->args = size ? arena_alloc(arena, size * sizeof(Node*)) : NULL;
+  if (size) memcpy(call->args, args, size * sizeof(Node*));
+  return (Node*)call;
+}
+
+Node* ast_new_bool(arena_t* arena, bool value) {
+  BoolNode* boolean = arena_alloc(arena, sizeof(BoolNode));
+  boolean->base.type = NODE_BOOL;
+  boolean->value = value;
+  return (Node*)boolean;
+}
+
+Node* ast_new_nil(arena_t* arena) {
+  Node* nil = arena_alloc(arena, sizeof(Node));
+  nil->type = NODE_NIL;
+  return nil;
+}
+
+void ast_stack_push(NodeStack* stack, Node* node) {
+  if (stack->size == stack->capacity) {
+    stack->capacity = stack->capacity ? stack->capacity * 2 : 16;
+    stack->nodes = realloc(stack->nodes, stack->capacity * sizeof(Node*));
+    error_if(stack->nodes == NULL);
   }
-  *children = realloc(*children, (*size - 1) * sizeof(Node*));
-  (*size)--;
+  stack->nodes[stack->size++] = node;
+}
+
+void ast_stack_free(NodeStack* stack) {
+  free(stack->nodes);
+  *stack = (NodeStack) { .nodes = NULL, .size = 0, .capacity = 0 };
 }
@@ -0,0 +1,283 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "cache.h"
+
+#include "common/hash.h"
+#include "common/io.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Bump whenever the layout of FlatAst or the meaning of its fields changes.
+// Adding node kinds or operators changes the version on its own.
+#define CACHE_VERSION 2
+#define CACHE_FORMAT ((uint32_t)CACHE_VERSION << 16 | (NODE_NIL + 1) << 8 | (OP_NEG + 1))
+
+#define CACHE_MAGIC "MARTAST"
+// The tree follows the header, so the header keeps it 8-byte aligned
+#define CACHE_HEADER_SIZE 64
+
+typedef struct {
+	char magic[8];
+	uint32_t format;
+	uint32_t size;
+	uint32_t link_count;
+	uint32_t reserved;
+	uint64_t key;
+	uint64_t src_size;
+	// Hash of the tree, which catches files damaged after they were written
+	uint64_t checksum;
+	uint8_t padding[16];
+} CacheHeader;
+
+// Fails to compile if the condition doesn't hold
+typedef char cache_header_check[sizeof(CacheHeader) == CACHE_HEADER_SIZE ? 1 : -1];
+
+// A tree kept in memory, found by its key and ordered by its last use
+typedef struct MemoryEntry {
+	uint64_t key;
+	uint64_t src_size;
+	FlatAst ast;
+	// Loaded entries that haven't been closed, and whether it was evicted since
+	size_t refs;
+	bool evicted;
+	struct MemoryEntry *next;
+	struct MemoryEntry *newer;
+	struct MemoryEntry *older;
+} MemoryEntry;
+
+static struct cache_state {
+	const char *dir;
+	// Guards everything below, which any thread may load from or store to
+	pthread_mutex_t lock;
+	size_t max_bytes;
+	size_t bytes;
+	// Power of two count of chains of entries with the same low bits of the key
+	MemoryEntry **buckets;
+	size_t bucket_count;
+	size_t count;
+	MemoryEntry *newest;
+	MemoryEntry *oldest;
+} cs = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+// Path of the file for the key, with room for a suffix of up to 31 characters
+static char* cache_path(uint64_t key) {
+	size_t length = strlen(cs.dir) + 64;
+	char *path = malloc(length);
+	error_if(path == NULL);
+	snprintf(path, length, "%s/%016llx.ast", cs.dir, (unsigned long long)key);
+	return path;
+}
+
+static bool write_all(int fd, const void *data, size_t size) {
+	const char *cursor = data;
+	while (size) {
+		ssize_t written = write(fd, cursor, size);
+		if (written < 0 && errno == EINTR) continue;
+		if (written <= 0) return false;
+		cursor += written, size -= (size_t)written;
+	}
+	return true;
+}
+
+static void memory_unlink(MemoryEntry *entry) {
+	if (entry->newer) entry->newer->older = entry->older;
+	else cs.newest = entry->older;
+	if (entry->older) entry->older->newer = entry->newer;
+	else cs.oldest = entry->newer;
+	entry->newer = entry->older = NULL;
+}
+
+static void memory_push(MemoryEntry *entry) {
+	entry->older = cs.newest, entry->newer = NULL;
+	if (cs.newest) cs.newest->newer = entry;
+	else cs.oldest = entry;
+	cs.newest = entry;
+}
+
+static MemoryEntry** memory_chain(uint64_t key) {
+	return &cs.buckets[key & (cs.bucket_count - 1)];
+}
+
+static MemoryEntry* memory_find(uint64_t key, uint64_t src_size) {
+	if (!cs.bucket_count) return NULL;
+	for (MemoryEntry *entry = *memory_chain(key); entry; entry = entry->next)
+		if (entry->key == key && entry->src_size == src_size) return entry;
+	return NULL;
+}
+
+// Takes the entry out of the cache, it goes once the last user closes it
+static void memory_evict(MemoryEntry *entry) {
+	MemoryEntry **link = memory_chain(entry->key);
+	while (*link != entry) link = &(*link)->next;
+	*link = entry->next;
+	memory_unlink(entry);
+	cs.bytes -= entry->ast.bytes;
+	cs.count--;
+	entry->evicted = true;
+	if (!entry->refs) {
+		flat_free(&entry->ast);
+		free(entry);
+	}
+}
+
+static void memory_grow(void) {
+	size_t count = cs.bucket_count ? cs.bucket_count * 2 : 64;
+	MemoryEntry **buckets = calloc(count, sizeof(MemoryEntry*));
+	error_if(buckets == NULL);
+	for (size_t i = 0; i < cs.bucket_count; i++) {
+		for (MemoryEntry *entry = cs.buckets[i], *next; entry; entry = next) {
+			next = entry->next;
+			entry->next = buckets[entry->key & (count - 1)];
+			buckets[entry->key & (count - 1)] = entry;
+		}
+	}
+	free(cs.buckets);
+	cs.buckets = buckets, cs.bucket_count = count;
+}
+
+// Copies the tree into memory unless it's there already or too big
+static void memory_store(uint64_t key, string_t src, const FlatAst *ast) {
+	pthread_mutex_lock(&cs.lock);
+	if (ast->bytes <= cs.max_bytes && !memory_find(key, src.size)) {
+		MemoryEntry *entry = malloc(sizeof(MemoryEntry));
+		void *data = malloc(ast->bytes);
+		error_if(entry == NULL || data == NULL);
+		memcpy(data, ast->data, ast->bytes);
+		*entry = (MemoryEntry){ .key = key, .src_size = src.size, .refs = 0, .evicted = false };
+		flat_attach(&entry->ast, data, ast->size, ast->link_count);
+		if (cs.count >= cs.bucket_count) memory_grow();
+		entry->next = *memory_chain(key);
+		*memory_chain(key) = entry;
+		memory_push(entry);
+		cs.bytes += ast->bytes;
+		cs.count++;
+		while (cs.bytes > cs.max_bytes) memory_evict(cs.oldest);
+	}
+	pthread_mutex_unlock(&cs.lock);
+}
+
+static bool memory_load(uint64_t key, string_t src, CacheEntry *entry) {
+	pthread_mutex_lock(&cs.lock);
+	MemoryEntry *found = memory_find(key, src.size);
+	if (found) {
+		memory_unlink(found);
+		memory_push(found);
+		found->refs++;
+		entry->ast = found->ast, entry->shared = found;
+		entry->map = NULL, entry->map_size = 0;
+	}
+	pthread_mutex_unlock(&cs.lock);
+	return found != NULL;
+}
+
+void cache_set_dir(const char *dir) {
+	cs.dir = dir;
+}
+
+void cache_set_memory(size_t max_bytes) {
+	pthread_mutex_lock(&cs.lock);
+	__atomic_store_n(&cs.max_bytes, max_bytes, __ATOMIC_RELAXED);
+	while (cs.bytes > cs.max_bytes) memory_evict(cs.oldest);
+	pthread_mutex_unlock(&cs.lock);
+}
+
+bool cache_enabled(void) {
+	return cs.dir != NULL || __atomic_load_n(&cs.max_bytes, __ATOMIC_RELAXED) != 0;
+}
+
+uint64_t cache_key(string_t src) {
+	return hash_bytes(src.string, src.size, CACHE_FORMAT);
+}
+
+bool cache_load(uint64_t key, string_t src, CacheEntry *entry) {
+	entry->shared = NULL;
+	if (memory_load(key, src, entry)) return true;
+	if (!cs.dir) return false;
+	char *path = cache_path(key);
+	int fd = open(path, O_RDONLY);
+	free(path);
+	if (fd < 0) return false;
+
+	struct stat info;
+	void *map = MAP_FAILED;
+	size_t map_size = 0;
+	if (!fstat(fd, &info) && info.st_size >= CACHE_HEADER_SIZE) {
+		map_size = (size_t)info.st_size;
+		map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	close(fd);
+	if (map == MAP_FAILED) return false;
+
+	// anything unexpected is treated like a stale entry
+	const CacheHeader *header = map;
+	bool valid = !memcmp(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC))
+		&& header->format == CACHE_FORMAT && header->key == key
+		&& header->src_size == src.size
+		&& map_size == CACHE_HEADER_SIZE + flat_bytes(header->size, header->link_count);
+	if (valid) {
+		flat_attach(&entry->ast, (char *)map + CACHE_HEADER_SIZE, header->size, header->link_count);
+		valid = hash_bytes(entry->ast.data, entry->ast.bytes, key) == header->checksum
+			&& flat_validate(&entry->ast, src.size);
+	}
+	if (!valid) {
+		munmap(map, map_size);
+		return false;
+	}
+	entry->map = map, entry->map_size = map_size;
+	// the next load of the same tree doesn't have to go to the file
+	if (__atomic_load_n(&cs.max_bytes, __ATOMIC_RELAXED)) memory_store(key, src, &entry->ast);
+	return true;
+}
+
+void cache_close(CacheEntry *entry) {
+	if (entry->map) munmap(entry->map, entry->map_size);
+	if (entry->shared) {
+		pthread_mutex_lock(&cs.lock);
+		MemoryEntry *shared = entry->shared;
+		if (!--shared->refs && shared->evicted) {
+			flat_free(&shared->ast);
+			free(shared);
+		}
+		pthread_mutex_unlock(&cs.lock);
+	}
+	entry->map = NULL, entry->map_size = 0, entry->shared = NULL;
+}
+
+void cache_store(uint64_t key, string_t src, const FlatAst *ast) {
+	if (__atomic_load_n(&cs.max_bytes, __ATOMIC_RELAXED)) memory_store(key, src, ast);
+	if (!cs.dir) return;
+	CacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+	header.format = CACHE_FORMAT;
+	header.size = ast->size, header.link_count = ast->link_count;
+	header.key = key, header.src_size = src.size;
+	header.checksum = hash_bytes(ast->data, ast->bytes, key);
+
+	// written next to the entry and renamed over it, so that readers never
+	// see a partial file
+	char *path = cache_path(key);
+	char *temp = malloc(strlen(path) + 32);
+	error_if(temp == NULL);
+	// threads of one process storing the same entry each have their own file
+	static unsigned long stores = 0;
+	unsigned long store = __atomic_fetch_add(&stores, 1, __ATOMIC_RELAXED);
+	sprintf(temp, "%s.%ld.%lu.tmp", path, (long)getpid(), store % 1000000);
+	mkdir(cs.dir, 0777);
+	int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd >= 0) {
+		bool written = write_all(fd, &header, sizeof(header))
+			&& write_all(fd, ast->data, ast->bytes);
+		if (close(fd) || !written || rename(temp, path)) unlink(temp);
+	}
+	free(temp);
+	free(path);
+}
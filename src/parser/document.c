@@ -0,0 +1,297 @@
+
+#include "parser/document.h"
+#include "parser/parser.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Statements are grouped into segments of at least this many tokens
+#define SEGMENT_MIN_TOKENS 64
+// Minimum size of the regions the nodes of a segment are allocated in
+#define SEGMENT_REGION_SIZE 1024
+
+static size_t token_end(const token_buffer_t* tokens, size_t index) {
+  return (size_t)tokens->offsets[index] + tokens->lengths[index];
+}
+
+static void segment_free(Segment* segment) {
+  free(segment->text);
+  token_buffer_free(&segment->tokens);
+  arena_free(&segment->arena);
+}
+
+// Copies text[begin, end) and the tokens first..last into a segment and parses them
+static Segment segment_new(const char* text, size_t begin, size_t end,
+  const token_buffer_t* tokens, size_t first, size_t last) {
+  Segment segment;
+  segment.size = end - begin;
+  segment.text = malloc(segment.size + 1);
+  error_if(segment.text == NULL);
+  memcpy(segment.text, &text[begin], segment.size);
+  segment.text[segment.size] = '\0';
+
+  segment.tokens = token_buffer_new(last - first + 1);
+  for (size_t i = first; i < last; i++) {
+    token_buffer_push_copy(&segment.tokens, tokens, i, tokens->offsets[i] - (uint32_t)begin);
+  }
+  token_buffer_push(&segment.tokens, TOK_EOF, (uint32_t)segment.size, 1, SYMBOL_NONE);
+
+  segment.arena = arena_new(SEGMENT_REGION_SIZE);
+  segment.block = (BlockNode*)parser_parse_tokens(&segment.tokens, segment.text, &segment.arena);
+  return segment;
+}
+
+/** Checks whether the tokens of a region that isn't the end of the document
+  * have synchronized with the old token stream again, which is when the last
+  * token ends a statement right at the end of the region. Lexing the text
+  * after the region then starts in the same state as before the edit.
+  * @param tokens The tokens of the region followed by EOF.
+  * @param size The size of the region.
+  * @param next The first character after the region.
+  * @return Whether the region can replace its old segments on its own.
+  */
+static bool region_synchronized(const token_buffer_t* tokens, size_t size, char next) {
+  if (tokens->count < 2) return false;
+  size_t last = tokens->count - 2;
+  if (token_end(tokens, last) != size) return false;
+  switch ((token_type_t)tokens->types[last]) {
+    case TOK_SEMICOLON:
+      return true;
+    case TOK_KW_END:
+      // an identifier right after would have been lexed as part of it
+      return next != '_' && !isalnum((unsigned char)next);
+    default:
+      return false;
+  }
+}
+
+typedef enum {
+  REGION_PARSED,
+  // The region ends in the middle of something that continues after it
+  REGION_UNSYNCHRONIZED,
+  // The region is kept as a single segment that doesn't parse
+  REGION_BROKEN
+} RegionResult;
+
+/** Lexes a region of the document and turns it into segments. Tokens in
+  * `tokens` before `begin` are kept as they are.
+  * @param text The text of the region, which is freed.
+  * @param doc The document whose symbols the identifiers are interned into.
+  * @param size The size of the region.
+  * @param tokens The tokens to keep, which are freed.
+  * @param begin Where lexing continues after the kept tokens.
+  * @param final Whether the region is the end of the document.
+  * @param next The first character after the region if it isn't final.
+  * @param out Where to store the new segments.
+  * @param out_count Where to store the number of new segments.
+  * @return How the region turned out, there are no new segments if it
+  * didn't synchronize.
+  */
+static RegionResult build_region(Document* doc, char* text, size_t size, token_buffer_t* tokens,
+  size_t begin, bool final, char next, Segment** out, size_t* out_count) {
+  lexer_lex(tokens, &doc->symbols, (string_t){ .size = size + 1, .string = text }, begin);
+  size_t count = tokens->count - 1;
+  RegionResult result = final || region_synchronized(tokens, size, next)
+    ? REGION_PARSED : REGION_UNSYNCHRONIZED;
+
+  size_t* ends = malloc((count + 1) * sizeof(size_t));
+  error_if(ends == NULL);
+  size_t runs = 0;
+  if (result == REGION_PARSED) {
+    runs = parser_split_statements(tokens, ends, count + 1, SEGMENT_MIN_TOKENS);
+    // trailing blanks after the last statement stay with it
+    if (runs > 1 && ends[runs - 2] == count) runs--;
+    if (runs == 0) result = REGION_BROKEN;
+  }
+
+  Segment* segments = malloc((runs ? runs : 1) * sizeof(Segment));
+  error_if(segments == NULL);
+  size_t built = 0;
+  for (size_t first = 0; built < runs; first = ends[built++]) {
+    size_t last = ends[built];
+    size_t text_begin = first ? token_end(tokens, first - 1) : 0;
+    size_t text_end = built + 1 == runs ? size : token_end(tokens, last - 1);
+    segments[built] = segment_new(text, text_begin, text_end, tokens, first, last);
+    if (!segments[built].block) {
+      result = REGION_BROKEN, built++;
+      break;
+    }
+  }
+  if (result != REGION_PARSED) {
+    for (size_t i = 0; i < built; i++) segment_free(&segments[i]);
+    built = 0;
+    if (result == REGION_BROKEN) segments[built++] = segment_new(text, 0, size, tokens, 0, count);
+  }
+
+  free(ends);
+  free(text);
+  token_buffer_free(tokens);
+  *out = segments, *out_count = built;
+  return result;
+}
+
+// Replaces the removed segments starting at first with new ones
+static void replace_segments(Document* doc, size_t first, size_t removed, Segment* segments, size_t count) {
+  for (size_t i = first; i < first + removed; i++) {
+    doc->size -= doc->segments[i].size;
+    doc->broken -= !doc->segments[i].block;
+    segment_free(&doc->segments[i]);
+  }
+  size_t total = doc->count - removed + count;
+  if (total > doc->capacity) {
+    doc->capacity = doc->capacity * 2 > total ? doc->capacity * 2 : total;
+    doc->segments = realloc(doc->segments, doc->capacity * sizeof(Segment));
+    error_if(doc->segments == NULL);
+  }
+  memmove(&doc->segments[first + count], &doc->segments[first + removed],
+    (doc->count - first - removed) * sizeof(Segment));
+  for (size_t i = 0; i < count; i++) {
+    doc->segments[first + i] = segments[i];
+    doc->size += segments[i].size;
+    doc->broken += !segments[i].block;
+  }
+  doc->count = total;
+}
+
+// Index of the segment holding the byte at offset, the last one for the end of the source
+static size_t find_segment(const Document* doc, size_t offset, size_t* start) {
+  size_t begin = 0, i = 0;
+  for (; i + 1 < doc->count && offset >= begin + doc->segments[i].size; i++) {
+    begin += doc->segments[i].size;
+  }
+  *start = begin;
+  return i;
+}
+
+// Copies the text of the segments first..last with an edit applied to it
+static char* edited_text(const Document* doc, size_t first, size_t last, size_t old_size,
+  size_t edit, size_t removed, string_t text) {
+  char* old = malloc(old_size + 1);
+  char* region = malloc(old_size - removed + text.size + 1);
+  error_if(old == NULL || region == NULL);
+  size_t cursor = 0;
+  for (size_t i = first; i <= last; i++) {
+    memcpy(&old[cursor], doc->segments[i].text, doc->segments[i].size);
+    cursor += doc->segments[i].size;
+  }
+  memcpy(region, old, edit);
+  memcpy(&region[edit], text.string, text.size);
+  memcpy(&region[edit + text.size], &old[edit + removed], old_size - edit - removed);
+  region[old_size - removed + text.size] = '\0';
+  free(old);
+  return region;
+}
+
+Document document_open(string_t text) {
+  Document doc = { .segments = NULL, .count = 0, .capacity = 0, .size = 0, .broken = 0,
+    .symbols = symbol_table_new() };
+  char* copy = malloc(text.size + 1);
+  error_if(copy == NULL);
+  memcpy(copy, text.string, text.size);
+  copy[text.size] = '\0';
+
+  Segment* segments;
+  size_t count;
+  token_buffer_t tokens = token_buffer_new(text.size / 4 + 1);
+  build_region(&doc, copy, text.size, &tokens, 0, true, '\0', &segments, &count);
+  replace_segments(&doc, 0, 0, segments, count);
+  free(segments);
+  return doc;
+}
+
+bool document_edit(Document* doc, size_t offset, size_t removed, string_t text) {
+  if (offset > doc->size) offset = doc->size;
+  if (removed > doc->size - offset) removed = doc->size - offset;
+
+  // a token ending right at the edit might grow into it
+  size_t start, end;
+  size_t first = find_segment(doc, offset ? offset - 1 : 0, &start);
+  size_t last = find_segment(doc, offset + removed, &end);
+  end += doc->segments[last].size;
+  bool joined = false;
+
+  while (true) {
+    size_t edit = offset - start;
+    char* region = edited_text(doc, first, last, end - start, edit, removed, text);
+
+    // tokens of the first segment that end before the edit stay the same
+    const token_buffer_t* head = &doc->segments[first].tokens;
+    token_buffer_t tokens = token_buffer_new(head->count + text.size / 4 + 1);
+    size_t kept = 0;
+    while (kept + 1 < head->count && token_end(head, kept) < edit) {
+      token_buffer_push_copy(&tokens, head, kept, head->offsets[kept]);
+      kept++;
+    }
+    size_t begin = kept ? token_end(head, kept - 1) : 0;
+
+    bool final = last + 1 == doc->count;
+    char next = final ? '\0' : doc->segments[last + 1].text[0];
+    Segment* segments;
+    size_t count;
+    RegionResult result = build_region(doc, region, end - start - removed + text.size,
+      &tokens, begin, final, next, &segments, &count);
+
+    if (result == REGION_UNSYNCHRONIZED) {
+      // take in geometrically more of the following segments until the token
+      // stream synchronizes again or the end of the document is reached
+      size_t grow = last - first + 1;
+      for (size_t i = 0; i < grow && last + 1 < doc->count; i++) {
+        end += doc->segments[++last].size;
+      }
+      free(segments);
+      continue;
+    }
+    if (result == REGION_BROKEN && !joined && doc->broken) {
+      // text that didn't parse before might only have been waiting for this
+      // edit, so try once more together with the nearest of it on either side
+      joined = true;
+      size_t before = first, after = last + 1;
+      while (before > 0 && doc->segments[before - 1].block) before--;
+      while (after < doc->count && doc->segments[after].block) after++;
+      bool widened = false;
+      if (before > 0) {
+        while (first >= before) start -= doc->segments[--first].size;
+        widened = true;
+      }
+      if (after < doc->count) {
+        while (last < after) end += doc->segments[++last].size;
+        widened = true;
+      }
+      if (widened) {
+        for (size_t i = 0; i < count; i++) segment_free(&segments[i]);
+        free(segments);
+        continue;
+      }
+    }
+    replace_segments(doc, first, last - first + 1, segments, count);
+    free(segments);
+    return document_valid(doc);
+  }
+}
+
+bool document_valid(const Document* doc) {
+  return doc->broken == 0;
+}
+
+Node* document_ast(const Document* doc, arena_t* arena) {
+  NodeStack children = { .nodes = NULL, .size = 0, .capacity = 0 };
+  for (size_t i = 0; i < doc->count; i++) {
+    const BlockNode* block = doc->segments[i].block;
+    if (!block) continue;
+    for (size_t j = 0; j < block->size; j++) {
+      ast_stack_push(&children, ((Node**)block->children)[j]);
+    }
+  }
+  Node* ast = ast_new_block(arena, children.nodes, children.size);
+  ast_stack_free(&children);
+  return ast;
+}
+
+void document_free(Document* doc) {
+  for (size_t i = 0; i < doc->count; i++) segment_free(&doc->segments[i]);
+  free(doc->segments);
+  symbol_table_free(&doc->symbols);
+  *doc = (Document){ .segments = NULL, .count = 0, .capacity = 0, .size = 0, .broken = 0,
+    .symbols = symbol_table_new() };
+}
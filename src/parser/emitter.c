@@ -0,0 +1,477 @@
+#define _POSIX_C_SOURCE 200809L // fileno
+
+#include "parser/emitter.h"
+
+#include "common/io.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define EMIT_BUFFER_SIZE (1 << 20)
+
+// A node on the walk and how far it has been written
+typedef struct {
+  Node*     node;
+  unsigned  depth;
+  size_t    step;
+} Frame;
+
+// Writes the next part of the frame's node and returns the child to write
+// after it, or NULL once the node is complete
+typedef Node* (*EmitStep)(Frame* frame, unsigned* child_depth);
+
+// Every thread that writes a tree has its own state, and keeps the buffer
+// and the stack from one tree to the next
+static __thread struct {
+  char*   buffer;
+  size_t  size;
+  FILE*   out;
+  // The descriptor of the stream, or -1 if it has none like memory streams
+  int     fd;
+  Frame*  frames;
+  size_t  capacity;
+} em;
+
+static void write_all(const char* data, size_t size) {
+  if (em.fd < 0) {
+    error_if(fwrite(data, 1, size, em.out) != size);
+    return;
+  }
+  while (size) {
+    ssize_t written = write(em.fd, data, size);
+    if (written < 0 && errno == EINTR) continue;
+    error_if(written < 0);
+    data += written, size -= (size_t)written;
+  }
+}
+
+static void flush(void) {
+  write_all(em.buffer, em.size);
+  em.size = 0;
+}
+
+static void put(const char* text, size_t size) {
+  if (em.size + size > EMIT_BUFFER_SIZE) {
+    flush();
+    // anything that doesn't fit an empty buffer is written as is
+    if (size > EMIT_BUFFER_SIZE) {
+      write_all(text, size);
+      return;
+    }
+  }
+  memcpy(em.buffer + em.size, text, size);
+  em.size += size;
+}
+
+#define PUT(literal) put(literal, sizeof(literal) - 1)
+
+static void put_str(const char* text) {
+  put(text, strlen(text));
+}
+
+static void put_name(string_t name) {
+  put(name.string, name.size);
+}
+
+static void put_number(uint64_t value) {
+  char digits[20];
+  size_t start = sizeof(digits);
+  do {
+    digits[--start] = '0' + value % 10;
+    value /= 10;
+  } while (value);
+  put(digits + start, sizeof(digits) - start);
+}
+
+static void put_indent(unsigned depth) {
+  static const char spaces[] = "                                                                ";
+  size_t size = 2 * (size_t)depth;
+  while (size) {
+    size_t part = size < sizeof(spaces) - 1 ? size : sizeof(spaces) - 1;
+    put(spaces, part);
+    size -= part;
+  }
+}
+
+static const char* type_name(token_type_t type) {
+  switch (type) {
+    case TOK_TYPE_NAT:
+      return "nat";
+    case TOK_TYPE_INT:
+      return "int";
+    case TOK_TYPE_BOOL:
+      return "bool";
+    default:
+      return "?";
+  }
+}
+
+static Node* pretty_step(Frame* frame, unsigned* child_depth) {
+  Node* node = frame->node;
+  size_t step = frame->step++;
+  switch (node->type) {
+    case NODE_BLOCK: {
+      BlockNode* block = (BlockNode*)node;
+      if (step == 0) PUT("BLOCK {\n");
+      else if (step < block->size) PUT(",\n");
+      if (step < block->size) {
+        put_indent(frame->depth + 1);
+        *child_depth = frame->depth + 1;
+        return ((Node**)block->children)[step];
+      }
+      PUT("\n");
+      put_indent(frame->depth);
+      PUT("}");
+      return NULL;
+    }
+    case NODE_NUMBER:
+      put_number(((NumberNode*)node)->value);
+      return NULL;
+    case NODE_BINARY_OP: {
+      BinaryOpNode* binary_op = (BinaryOpNode*)node;
+      if (step == 0) {
+        PUT("(");
+        return binary_op->left;
+      }
+      if (step == 1) {
+        PUT(" ");
+        put_str(op_type_strs[binary_op->op]);
+        PUT(" ");
+        return binary_op->right;
+      }
+      PUT(")");
+      return NULL;
+    }
+    case NODE_IDENT:
+      put_name(((IdentNode*)node)->name);
+      return NULL;
+    case NODE_VAR: {
+      VarNode* var = (VarNode*)node;
+      if (step > 0) return NULL;
+      PUT("var ");
+      put_str(type_name(var->var_type));
+      PUT(" ");
+      put_name(var->name);
+      PUT(" = ");
+      return var->value;
+    }
+    case NODE_IF: {
+      IfNode* if_node = (IfNode*)node;
+      if (step == 0) {
+        PUT("if ");
+        return if_node->condition;
+      }
+      if (step == 1) {
+        PUT(": ");
+        return if_node->then;
+      }
+      if (step == 2 && if_node->otherwise) {
+        PUT(" else ");
+        return if_node->otherwise;
+      }
+      PUT(" end");
+      return NULL;
+    }
+    case NODE_WHILE: {
+      WhileNode* while_node = (WhileNode*)node;
+      if (step == 0) {
+        PUT("while ");
+        return while_node->condition;
+      }
+      if (step == 1) {
+        PUT(": ");
+        return while_node->body;
+      }
+      PUT(" end");
+      return NULL;
+    }
+    case NODE_RETURN:
+      if (step > 0) return NULL;
+      PUT("return ");
+      return ((ReturnNode*)node)->value;
+    case NODE_UNARY_OP: {
+      UnaryOpNode* unary_op = (UnaryOpNode*)node;
+      if (step > 0) {
+        PUT(")");
+        return NULL;
+      }
+      PUT("(");
+      put_str(op_type_strs[unary_op->op]);
+      if (unary_op->op == OP_NOT) PUT(" ");
+      return unary_op->operand;
+    }
+    case NODE_CALL: {
+      CallNode* call = (CallNode*)node;
+      if (step == 0) {
+        put_name(call->name);
+        PUT("(");
+      } else if (step < call->size) {
+        PUT(", ");
+      }
+      if (step < call->size) return ((Node**)call->args)[step];
+      PUT(")");
+      return NULL;
+    }
+    case NODE_BOOL:
+      put_str(((BoolNode*)node)->value ? "true" : "false");
+      return NULL;
+    case NODE_NIL:
+      PUT("nil");
+      return NULL;
+  }
+  return NULL;
+}
+
+static Node* json_step(Frame* frame, unsigned* child_depth) {
+  Node* node = frame->node;
+  size_t step = frame->step++;
+  (void)child_depth;
+  switch (node->type) {
+    case NODE_BLOCK: {
+      BlockNode* block = (BlockNode*)node;
+      if (step == 0) PUT("{\"type\":\"block\",\"children\":[");
+      else if (step < block->size) PUT(",");
+      if (step < block->size) return ((Node**)block->children)[step];
+      PUT("]}");
+      return NULL;
+    }
+    case NODE_NUMBER:
+      PUT("{\"type\":\"number\",\"value\":");
+      put_number(((NumberNode*)node)->value);
+      PUT("}");
+      return NULL;
+    case NODE_BINARY_OP: {
+      BinaryOpNode* binary_op = (BinaryOpNode*)node;
+      if (step == 0) {
+        PUT("{\"type\":\"binary_op\",\"op\":\"");
+        put_str(op_type_strs[binary_op->op]);
+        PUT("\",\"left\":");
+        return binary_op->left;
+      }
+      if (step == 1) {
+        PUT(",\"right\":");
+        return binary_op->right;
+      }
+      PUT("}");
+      return NULL;
+    }
+    case NODE_IDENT:
+      PUT("{\"type\":\"ident\",\"name\":\"");
+      put_name(((IdentNode*)node)->name);
+      PUT("\"}");
+      return NULL;
+    case NODE_VAR: {
+      VarNode* var = (VarNode*)node;
+      if (step > 0) {
+        PUT("}");
+        return NULL;
+      }
+      PUT("{\"type\":\"var\",\"var_type\":\"");
+      put_str(type_name(var->var_type));
+      PUT("\",\"name\":\"");
+      put_name(var->name);
+      PUT("\",\"value\":");
+      return var->value;
+    }
+    case NODE_IF: {
+      IfNode* if_node = (IfNode*)node;
+      if (step == 0) {
+        PUT("{\"type\":\"if\",\"condition\":");
+        return if_node->condition;
+      }
+      if (step == 1) {
+        PUT(",\"then\":");
+        return if_node->then;
+      }
+      if (step == 2) {
+        PUT(",\"otherwise\":");
+        if (if_node->otherwise) return if_node->otherwise;
+        PUT("null");
+      }
+      PUT("}");
+      return NULL;
+    }
+    case NODE_WHILE: {
+      WhileNode* while_node = (WhileNode*)node;
+      if (step == 0) {
+        PUT("{\"type\":\"while\",\"condition\":");
+        return while_node->condition;
+      }
+      if (step == 1) {
+        PUT(",\"body\":");
+        return while_node->body;
+      }
+      PUT("}");
+      return NULL;
+    }
+    case NODE_RETURN:
+      if (step > 0) {
+        PUT("}");
+        return NULL;
+      }
+      PUT("{\"type\":\"return\",\"value\":");
+      return ((ReturnNode*)node)->value;
+    case NODE_UNARY_OP: {
+      UnaryOpNode* unary_op = (UnaryOpNode*)node;
+      if (step > 0) {
+        PUT("}");
+        return NULL;
+      }
+      PUT("{\"type\":\"unary_op\",\"op\":\"");
+      put_str(op_type_strs[unary_op->op]);
+      PUT("\",\"operand\":");
+      return unary_op->operand;
+    }
+    case NODE_CALL: {
+      CallNode* call = (CallNode*)node;
+      if (step == 0) {
+        PUT("{\"type\":\"call\",\"name\":\"");
+        put_name(call->name);
+        PUT("\",\"args\":[");
+      } else if (step < call->size) {
+        PUT(",");
+      }
+      if (step < call->size) return ((Node**)call->args)[step];
+      PUT("]}");
+      return NULL;
+    }
+    case NODE_BOOL:
+      PUT("{\"type\":\"bool\",\"value\":");
+      put_str(((BoolNode*)node)->value ? "true" : "false");
+      PUT("}");
+      return NULL;
+    case NODE_NIL:
+      PUT("{\"type\":\"nil\"}");
+      return NULL;
+  }
+  return NULL;
+}
+
+// Writes the head of a list and returns its first element
+static Node* sexpr_open(const char* head, Node* first) {
+  PUT("(");
+  put_str(head);
+  PUT(" ");
+  return first;
+}
+
+// Continues a list with the next of its elements or closes it
+static Node* sexpr_next(Node* next) {
+  if (next) PUT(" ");
+  else PUT(")");
+  return next;
+}
+
+static Node* sexpr_step(Frame* frame, unsigned* child_depth) {
+  Node* node = frame->node;
+  size_t step = frame->step++;
+  (void)child_depth;
+  switch (node->type) {
+    case NODE_BLOCK: {
+      BlockNode* block = (BlockNode*)node;
+      if (step == 0) PUT("(block");
+      if (step < block->size) return sexpr_next(((Node**)block->children)[step]);
+      return sexpr_next(NULL);
+    }
+    case NODE_NUMBER:
+      put_number(((NumberNode*)node)->value);
+      return NULL;
+    case NODE_BINARY_OP: {
+      BinaryOpNode* binary_op = (BinaryOpNode*)node;
+      if (step == 0) return sexpr_open(op_type_strs[binary_op->op], binary_op->left);
+      return sexpr_next(step == 1 ? binary_op->right : NULL);
+    }
+    case NODE_IDENT:
+      put_name(((IdentNode*)node)->name);
+      return NULL;
+    case NODE_VAR: {
+      VarNode* var = (VarNode*)node;
+      if (step > 0) return sexpr_next(NULL);
+      PUT("(var ");
+      put_str(type_name(var->var_type));
+      PUT(" ");
+      put_name(var->name);
+      PUT(" ");
+      return var->value;
+    }
+    case NODE_IF: {
+      IfNode* if_node = (IfNode*)node;
+      if (step == 0) return sexpr_open("if", if_node->condition);
+      return sexpr_next(step == 1 ? if_node->then : step == 2 ? if_node->otherwise : NULL);
+    }
+    case NODE_WHILE: {
+      WhileNode* while_node = (WhileNode*)node;
+      if (step == 0) return sexpr_open("while", while_node->condition);
+      return sexpr_next(step == 1 ? while_node->body : NULL);
+    }
+    case NODE_RETURN:
+      if (step == 0) return sexpr_open("return", ((ReturnNode*)node)->value);
+      return sexpr_next(NULL);
+    case NODE_UNARY_OP: {
+      UnaryOpNode* unary_op = (UnaryOpNode*)node;
+      if (step == 0) return sexpr_open(op_type_strs[unary_op->op], unary_op->operand);
+      return sexpr_next(NULL);
+    }
+    case NODE_CALL: {
+      CallNode* call = (CallNode*)node;
+      if (step == 0) {
+        PUT("(call ");
+        put_name(call->name);
+      }
+      return sexpr_next(step < call->size ? ((Node**)call->args)[step] : NULL);
+    }
+    case NODE_BOOL:
+      put_str(((BoolNode*)node)->value ? "true" : "false");
+      return NULL;
+    case NODE_NIL:
+      PUT("nil");
+      return NULL;
+  }
+  return NULL;
+}
+
+void ast_emit(Node* root, EmitFormat format, FILE* out) {
+  static const EmitStep steps[] = { pretty_step, json_step, sexpr_step };
+  EmitStep step = steps[format];
+  if (em.buffer == NULL) {
+    em.buffer = malloc(EMIT_BUFFER_SIZE);
+    error_if(em.buffer == NULL);
+  }
+  em.size = 0;
+  em.out = out;
+  // what the stream holds goes out before what's written past it
+  error_if(fflush(out) != 0);
+  em.fd = fileno(out);
+
+  size_t count = 0;
+  Frame frame = { .node = root, .depth = 0, .step = 0 };
+  while (true) {
+    unsigned child_depth = frame.depth;
+    Node* child = step(&frame, &child_depth);
+    if (child) {
+      // the frame is parked on the stack until the child is written
+      if (count == em.capacity) {
+        em.capacity = em.capacity ? em.capacity * 2 : 256;
+        em.frames = realloc(em.frames, em.capacity * sizeof(Frame));
+        error_if(em.frames == NULL);
+      }
+      em.frames[count++] = frame;
+      frame = (Frame){ .node = child, .depth = child_depth, .step = 0 };
+    } else if (count) {
+      frame = em.frames[--count];
+    } else {
+      break;
+    }
+  }
+  PUT("\n");
+  flush();
+}
+
+void ast_emit_release(void) {
+  free(em.buffer);
+  free(em.frames);
+  em.buffer = NULL, em.frames = NULL, em.capacity = 0;
+}
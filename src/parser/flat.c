@@ -0,0 +1,338 @@
+
+#include "parser/flat.h"
+#include "common/array.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// A pending node of a traversal and where to note its handle
+typedef struct {
+  Node* node;
+  uint32_t slot;
+} FlatWork;
+
+typedef struct {
+  NodeRef node;
+  bool left;
+} WalkWork;
+
+// Lists the children of a node in field order, absent ones as NULL
+static Node** tree_children(Node* node, Node** fixed, uint32_t* count) {
+  switch (node->type) {
+    case NODE_BLOCK: {
+      BlockNode* block = (BlockNode*)node;
+      *count = block->size;
+      return (Node**)block->children;
+    }
+    case NODE_CALL: {
+      CallNode* call = (CallNode*)node;
+      *count = call->size;
+      return (Node**)call->args;
+    }
+    case NODE_BINARY_OP: {
+      BinaryOpNode* binary_op = (BinaryOpNode*)node;
+      fixed[0] = binary_op->left, fixed[1] = binary_op->right;
+      *count = 2;
+      return fixed;
+    }
+    case NODE_UNARY_OP:
+      fixed[0] = ((UnaryOpNode*)node)->operand;
+      *count = 1;
+      return fixed;
+    case NODE_VAR:
+      fixed[0] = ((VarNode*)node)->value;
+      *count = 1;
+      return fixed;
+    case NODE_IF: {
+      IfNode* if_node = (IfNode*)node;
+      fixed[0] = if_node->condition, fixed[1] = if_node->then;
+      fixed[2] = if_node->otherwise;
+      *count = 3;
+      return fixed;
+    }
+    case NODE_WHILE: {
+      WhileNode* while_node = (WhileNode*)node;
+      fixed[0] = while_node->condition, fixed[1] = while_node->body;
+      *count = 2;
+      return fixed;
+    }
+    case NODE_RETURN:
+      fixed[0] = ((ReturnNode*)node)->value;
+      *count = 1;
+      return fixed;
+    default:
+      *count = 0;
+      return fixed;
+  }
+}
+
+// Number of children a node of the kind has or UINT32_MAX if it varies
+static uint32_t flat_arity(NodeType kind) {
+  switch (kind) {
+    case NODE_BLOCK:
+    case NODE_CALL:
+      return UINT32_MAX;
+    case NODE_IF:
+      return 3;
+    case NODE_BINARY_OP:
+    case NODE_WHILE:
+      return 2;
+    case NODE_VAR:
+    case NODE_RETURN:
+    case NODE_UNARY_OP:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+static uint64_t pack_name(string_t name, const char* src) {
+  return (uint32_t)(name.string - src) | (uint64_t)name.size << 32;
+}
+
+// Stores everything about a node except for its children
+static void flatten_node(FlatAst* ast, NodeRef index, Node* node, const char* src) {
+  uint8_t op = 0;
+  uint64_t value = 0;
+  symbol_t symbol = SYMBOL_NONE;
+  switch (node->type) {
+    case NODE_NUMBER:
+      value = ((NumberNode*)node)->value;
+      break;
+    case NODE_BOOL:
+      value = ((BoolNode*)node)->value;
+      break;
+    case NODE_IDENT:
+      value = pack_name(((IdentNode*)node)->name, src);
+      symbol = ((IdentNode*)node)->symbol;
+      break;
+    case NODE_CALL:
+      value = pack_name(((CallNode*)node)->name, src);
+      symbol = ((CallNode*)node)->symbol;
+      break;
+    case NODE_VAR:
+      op = (uint8_t)((VarNode*)node)->var_type;
+      value = pack_name(((VarNode*)node)->name, src);
+      symbol = ((VarNode*)node)->symbol;
+      break;
+    case NODE_BINARY_OP:
+      op = (uint8_t)((BinaryOpNode*)node)->op;
+      break;
+    case NODE_UNARY_OP:
+      op = (uint8_t)((UnaryOpNode*)node)->op;
+      break;
+    default:
+      break;
+  }
+  ast->kinds[index] = (uint8_t)node->type;
+  ast->ops[index] = op;
+  ast->values[index] = value;
+  ast->symbols[index] = symbol;
+}
+
+// Builds a pointer node from a flat one whose children are built already
+static Node* unflatten_node(const FlatAst* ast, NodeRef index, Node** built,
+  NodeStack* scratch, arena_t* arena, const char* src) {
+  Node* children[3] = { NULL, NULL, NULL };
+  uint32_t count = flat_child_count(ast, index);
+  NodeType kind = flat_kind(ast, index);
+  bool named = kind == NODE_CALL || kind == NODE_IDENT || kind == NODE_VAR;
+  string_t name = named ? flat_name(ast, src, index) : EMPTY_STRING;
+  symbol_t symbol = ast->symbols[index];
+  if (kind != NODE_BLOCK && kind != NODE_CALL) {
+    for (uint32_t i = 0; i < count && i < 3; i++) {
+      NodeRef child = flat_child(ast, index, i);
+      children[i] = child == NODE_NONE ? NULL : built[child];
+    }
+  }
+  switch (kind) {
+    case NODE_BLOCK:
+    case NODE_CALL: {
+      scratch->size = 0;
+      for (uint32_t i = 0; i < count; i++) {
+        ast_stack_push(scratch, built[flat_child(ast, index, i)]);
+      }
+      return kind == NODE_BLOCK
+        ? ast_new_block(arena, scratch->nodes, count)
+        : ast_new_call(arena, name, symbol, scratch->nodes, count);
+    }
+    case NODE_NUMBER:
+      return ast_new_number(arena, ast->values[index]);
+    case NODE_BINARY_OP:
+      return ast_new_binary_op(arena, children[0], children[1], (OpType)ast->ops[index]);
+    case NODE_IDENT:
+      return ast_new_ident(arena, name, symbol);
+    case NODE_VAR:
+      return ast_new_var(arena, (token_type_t)ast->ops[index], name, symbol, children[0]);
+    case NODE_IF:
+      return ast_new_if(arena, children[0], children[1], children[2]);
+    case NODE_WHILE:
+      return ast_new_while(arena, children[0], children[1]);
+    case NODE_RETURN:
+      return ast_new_return(arena, children[0]);
+    case NODE_UNARY_OP:
+      return ast_new_unary_op(arena, children[0], (OpType)ast->ops[index]);
+    case NODE_BOOL:
+      return ast_new_bool(arena, ast->values[index] != 0);
+    case NODE_NIL:
+      return ast_new_nil(arena);
+  }
+  return NULL;
+}
+
+size_t flat_bytes(uint32_t size, uint32_t link_count) {
+  return (size_t)size * (sizeof(uint64_t) + 2 * sizeof(uint32_t) + sizeof(symbol_t) + 2 * sizeof(uint8_t))
+    + (size_t)link_count * sizeof(NodeRef);
+}
+
+void flat_attach(FlatAst* ast, void* data, uint32_t size, uint32_t link_count) {
+  // widest first so that every array stays aligned
+  char* cursor = data;
+  ast->data = data;
+  ast->bytes = flat_bytes(size, link_count);
+  ast->size = size, ast->link_count = link_count;
+  ast->values = (uint64_t*)cursor, cursor += size * sizeof(uint64_t);
+  ast->firsts = (uint32_t*)cursor, cursor += size * sizeof(uint32_t);
+  ast->counts = (uint32_t*)cursor, cursor += size * sizeof(uint32_t);
+  ast->symbols = (symbol_t*)cursor, cursor += size * sizeof(symbol_t);
+  ast->links = (NodeRef*)cursor, cursor += link_count * sizeof(NodeRef);
+  ast->kinds = (uint8_t*)cursor, cursor += size;
+  ast->ops = (uint8_t*)cursor;
+}
+
+FlatAst flat_from_tree(Node* root, const char* src) {
+  Node* fixed[3];
+  uint32_t count;
+
+  // count first so that every array fits into one allocation
+  NodeStack pending = { .nodes = NULL, .size = 0, .capacity = 0 };
+  uint32_t size = 0, link_count = 0;
+  ast_stack_push(&pending, root);
+  while (pending.size) {
+    Node** children = tree_children(pending.nodes[--pending.size], fixed, &count);
+    size++, link_count += count;
+    for (uint32_t i = 0; i < count; i++) {
+      if (children[i]) ast_stack_push(&pending, children[i]);
+    }
+  }
+  ast_stack_free(&pending);
+
+  FlatAst ast;
+  void* data = malloc(flat_bytes(size, link_count));
+  error_if(data == NULL);
+  flat_attach(&ast, data, size, link_count);
+
+  // children are pushed in reverse so that they are numbered in order
+  size_t work_size = 0, work_capacity = 0;
+  FlatWork* work = NULL;
+  NodeRef next = 0;
+  uint32_t links = 0;
+  work = array_grow(work, &work_capacity, sizeof(FlatWork));
+  work[work_size++] = (FlatWork){ .node = root, .slot = NODE_NONE };
+  while (work_size) {
+    FlatWork item = work[--work_size];
+    NodeRef index = next++;
+    if (item.slot != NODE_NONE) ast.links[item.slot] = index;
+    flatten_node(&ast, index, item.node, src);
+
+    Node** children = tree_children(item.node, fixed, &count);
+    ast.firsts[index] = links, ast.counts[index] = count;
+    for (uint32_t i = count; i-- > 0;) {
+      ast.links[links + i] = NODE_NONE;
+      if (!children[i]) continue;
+      if (work_size == work_capacity) work = array_grow(work, &work_capacity, sizeof(FlatWork));
+      work[work_size++] = (FlatWork){ .node = children[i], .slot = links + i };
+    }
+    links += count;
+  }
+  free(work);
+  return ast;
+}
+
+Node* flat_to_tree(const FlatAst* ast, arena_t* arena, const char* src) {
+  if (ast->size == 0) return NULL;
+  Node** built = malloc(ast->size * sizeof(Node*));
+  error_if(built == NULL);
+  NodeStack scratch = { .nodes = NULL, .size = 0, .capacity = 0 };
+  // children come after their parents, so going backwards builds them first
+  for (NodeRef i = ast->size; i-- > 0;) {
+    built[i] = unflatten_node(ast, i, built, &scratch, arena, src);
+  }
+  Node* root = built[0];
+  ast_stack_free(&scratch);
+  free(built);
+  return root;
+}
+
+void flat_free(FlatAst* ast) {
+  free(ast->data);
+  flat_attach(ast, NULL, 0, 0);
+}
+
+// Whether the operator or type of a node is one that its kind can carry,
+// as the passes after this switch on them without a default
+static bool valid_op(NodeType kind, uint8_t op) {
+  switch (kind) {
+    case NODE_BINARY_OP:
+      // not sits among the binary operators of PREC_2
+      return op <= OP_MOD && op != OP_NOT;
+    case NODE_UNARY_OP:
+      return op == OP_NOT || op == OP_POS || op == OP_NEG;
+    case NODE_VAR:
+      return op == TOK_TYPE_NAT || op == TOK_TYPE_INT || op == TOK_TYPE_BOOL;
+    default:
+      return true;
+  }
+}
+
+bool flat_validate(const FlatAst* ast, size_t src_size) {
+  if (ast->size == 0) return false;
+  for (NodeRef i = 0; i < ast->size; i++) {
+    if (ast->kinds[i] > NODE_NIL) return false;
+    if (ast->firsts[i] > ast->link_count || ast->counts[i] > ast->link_count - ast->firsts[i]) {
+      return false;
+    }
+    NodeType kind = flat_kind(ast, i);
+    uint32_t arity = flat_arity(kind);
+    if (arity != UINT32_MAX && ast->counts[i] != arity) return false;
+    // children come strictly after their parent, which also rules out cycles
+    for (uint32_t j = 0; j < ast->counts[i]; j++) {
+      NodeRef child = flat_child(ast, i, j);
+      bool optional = kind == NODE_IF && j == 2;
+      if (child == NODE_NONE && optional) continue;
+      if (child <= i || child >= ast->size) return false;
+    }
+    if (kind == NODE_IDENT || kind == NODE_VAR || kind == NODE_CALL) {
+      uint64_t offset = (uint32_t)ast->values[i], length = ast->values[i] >> 32;
+      if (offset + length > src_size) return false;
+      // every symbol has an identifier of its own in the source, and the
+      // passes after this index arrays by symbol
+      if (ast->symbols[i] >= src_size) return false;
+    }
+    if (!valid_op(kind, ast->ops[i])) return false;
+  }
+  return true;
+}
+
+void flat_walk(const FlatAst* ast, NodeRef root, FlatVisitor enter, FlatVisitor leave, void* data) {
+  size_t work_size = 0, work_capacity = 0;
+  WalkWork* work = array_grow(NULL, &work_capacity, sizeof(WalkWork));
+  work[work_size++] = (WalkWork){ .node = root, .left = false };
+  while (work_size) {
+    WalkWork item = work[--work_size];
+    if (item.left) {
+      if (leave) leave(ast, item.node, data);
+      continue;
+    }
+    if (enter) enter(ast, item.node, data);
+    // the node comes back up to be left once all of its children were
+    uint32_t count = flat_child_count(ast, item.node);
+    while (work_size + count + 1 > work_capacity) work = array_grow(work, &work_capacity, sizeof(WalkWork));
+    work[work_size++] = (WalkWork){ .node = item.node, .left = true };
+    for (uint32_t i = count; i-- > 0;) {
+      NodeRef child = flat_child(ast, item.node, i);
+      if (child != NODE_NONE) work[work_size++] = (WalkWork){ .node = child, .left = false };
+    }
+  }
+  free(work);
+}
@@ -0,0 +1,524 @@
+
+#include "parser/fold.h"
+#include "common/array.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum {
+  CONST_NONE,
+  CONST_NUMBER,
+  CONST_BOOL
+} ConstKind;
+
+typedef struct {
+  ConstKind kind;
+  int64_t value;
+} Constant;
+
+// A node of the traversal, which comes back up once its children are folded
+typedef struct {
+  Node** slot;
+  bool left;
+  // Variables in scope when it was entered, which a block leaves again
+  size_t var_count;
+} FoldWork;
+
+// What a folded subtree tells its parent
+typedef struct {
+  // Whether it's free of side effects
+  bool pure;
+  // Whether it's a number or a bool, even if it isn't constant, or
+  // CONST_NONE if that depends on things folding can't see
+  ConstKind kind;
+  // Divisions by a constant zero in it, which trap whenever it runs
+  size_t traps;
+} Folded;
+
+// A variable in scope and the one of the same name it hides as its index + 1
+typedef struct {
+  symbol_t symbol;
+  ConstKind kind;
+  size_t shadowed;
+} FoldVar;
+
+typedef struct {
+  arena_t* arena;
+  // The folded subtrees that wait for their parent
+  Folded* folded;
+  size_t folded_size;
+  size_t folded_capacity;
+  // Variables in scope, innermost last
+  FoldVar* vars;
+  size_t var_count;
+  size_t var_capacity;
+  // Innermost variable in scope of every symbol as its index + 1 or 0
+  size_t* bindings;
+  size_t binding_capacity;
+} FoldState;
+
+// Number of child fields of a node, absent ones included
+static size_t child_count(const Node* node) {
+  switch (node->type) {
+    case NODE_BLOCK:
+      return ((const BlockNode*)node)->size;
+    case NODE_CALL:
+      return ((const CallNode*)node)->size;
+    case NODE_IF:
+      return 3;
+    case NODE_BINARY_OP:
+    case NODE_WHILE:
+      return 2;
+    case NODE_UNARY_OP:
+    case NODE_VAR:
+    case NODE_RETURN:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+static Node** child_slot(Node* node, size_t index) {
+  switch (node->type) {
+    case NODE_BLOCK:
+      return &((Node**)((BlockNode*)node)->children)[index];
+    case NODE_CALL:
+      return &((Node**)((CallNode*)node)->args)[index];
+    case NODE_BINARY_OP: {
+      BinaryOpNode* binary_op = (BinaryOpNode*)node;
+      return index ? &binary_op->right : &binary_op->left;
+    }
+    case NODE_UNARY_OP:
+      return &((UnaryOpNode*)node)->operand;
+    case NODE_VAR:
+      return &((VarNode*)node)->value;
+    case NODE_IF: {
+      IfNode* if_node = (IfNode*)node;
+      return index == 0 ? &if_node->condition : index == 1 ? &if_node->then : &if_node->otherwise;
+    }
+    case NODE_WHILE: {
+      WhileNode* while_node = (WhileNode*)node;
+      return index ? &while_node->body : &while_node->condition;
+    }
+    case NODE_RETURN:
+      return &((ReturnNode*)node)->value;
+    default:
+      return NULL;
+  }
+}
+
+static Constant constant_of(const Node* node);
+
+// Whether the operation divides by a constant zero
+static bool divides_by_zero(const BinaryOpNode* node) {
+  switch (node->op) {
+    case OP_DIV:
+    case OP_MOD:
+    case OP_ASSIGN_DIV:
+    case OP_ASSIGN_MOD: {
+      Constant right = constant_of(node->right);
+      return right.kind == CONST_NUMBER && right.value == 0;
+    }
+    default:
+      return false;
+  }
+}
+
+// Whether evaluating the node itself has effects beyond its value, which
+// includes divisions that may trap
+static bool has_effects(const Node* node) {
+  switch (node->type) {
+    case NODE_VAR:
+    case NODE_WHILE:
+    case NODE_RETURN:
+    case NODE_CALL:
+      return true;
+    case NODE_BINARY_OP: {
+      const BinaryOpNode* binary_op = (const BinaryOpNode*)node;
+      if (binary_op->op == OP_DIV || binary_op->op == OP_MOD) {
+        return constant_of(binary_op->right).kind != CONST_NUMBER || divides_by_zero(binary_op);
+      }
+      return binary_op->op <= OP_ASSIGN_MOD;
+    }
+    default:
+      return false;
+  }
+}
+
+static Constant constant_of(const Node* node) {
+  switch (node->type) {
+    case NODE_NUMBER:
+      return (Constant){ .kind = CONST_NUMBER, .value = (int64_t)((const NumberNode*)node)->value };
+    case NODE_BOOL:
+      return (Constant){ .kind = CONST_BOOL, .value = ((const BoolNode*)node)->value };
+    case NODE_UNARY_OP: {
+      const UnaryOpNode* unary_op = (const UnaryOpNode*)node;
+      if (unary_op->op == OP_NEG && unary_op->operand->type == NODE_NUMBER) {
+        return (Constant){ .kind = CONST_NUMBER,
+          .value = (int64_t)(0 - ((const NumberNode*)unary_op->operand)->value) };
+      }
+      break;
+    }
+    default:
+      break;
+  }
+  return (Constant){ .kind = CONST_NONE, .value = 0 };
+}
+
+static bool is_number(Constant constant, int64_t value) {
+  return constant.kind == CONST_NUMBER && constant.value == value;
+}
+
+static bool is_bool(Constant constant, bool value) {
+  return constant.kind == CONST_BOOL && (constant.value != 0) == value;
+}
+
+// Whether the operator only takes numbers, for assignments the right operand
+static bool takes_numbers(OpType op) {
+  switch (op) {
+    case OP_ASSIGN_ADD:
+    case OP_ASSIGN_SUB:
+    case OP_ASSIGN_MUL:
+    case OP_ASSIGN_DIV:
+    case OP_ASSIGN_MOD:
+    case OP_LT:
+    case OP_LE:
+    case OP_GT:
+    case OP_GE:
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV:
+    case OP_MOD:
+    case OP_POS:
+    case OP_NEG:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Whether a folded child of the node never runs, because a constant decides
+// which branch is taken or that an operator short-circuits
+static bool is_dead(const Node* node, size_t index) {
+  switch (node->type) {
+    case NODE_IF: {
+      Constant condition = constant_of(((const IfNode*)node)->condition);
+      if (condition.kind != CONST_BOOL || index == 0) return false;
+      return index == (condition.value ? 2 : 1);
+    }
+    case NODE_WHILE:
+      return index == 1 && is_bool(constant_of(((const WhileNode*)node)->condition), false);
+    case NODE_BINARY_OP: {
+      const BinaryOpNode* binary_op = (const BinaryOpNode*)node;
+      Constant left = constant_of(binary_op->left);
+      if (binary_op->op == OP_AND) return index == 1 && is_bool(left, false);
+      if (binary_op->op == OP_OR) return index == 1 && is_bool(left, true);
+      return false;
+    }
+    default:
+      return false;
+  }
+}
+
+static void declare(FoldState* state, symbol_t symbol, ConstKind kind) {
+  if (state->var_count == state->var_capacity) {
+    state->vars = array_grow(state->vars, &state->var_capacity, sizeof(FoldVar));
+  }
+  while (symbol >= state->binding_capacity) {
+    size_t old_capacity = state->binding_capacity;
+    state->bindings = array_grow(state->bindings, &state->binding_capacity, sizeof(size_t));
+    memset(&state->bindings[old_capacity], 0, (state->binding_capacity - old_capacity) * sizeof(size_t));
+  }
+  state->vars[state->var_count++] = (FoldVar){ .symbol = symbol, .kind = kind, .shadowed = state->bindings[symbol] };
+  state->bindings[symbol] = state->var_count;
+}
+
+static void leave_scope(FoldState* state, size_t var_count) {
+  while (state->var_count > var_count) {
+    const FoldVar* var = &state->vars[--state->var_count];
+    state->bindings[var->symbol] = var->shadowed;
+  }
+}
+
+// The kind of the variable a name refers to, undeclared ones are left for
+// the backends to report
+static ConstKind kind_of_name(const FoldState* state, const IdentNode* ident) {
+  size_t index = ident->symbol < state->binding_capacity ? state->bindings[ident->symbol] : 0;
+  return index ? state->vars[index - 1].kind : CONST_NONE;
+}
+
+/** Tells whether a node is a number or a bool the way the backends do. An
+  * assignment has the kind of its variable, `and` and `or` have the kind of
+  * their left operand and `+x` that of `x`.
+  * @param kinds The kinds of the node's first two children.
+  */
+static ConstKind kind_of(const FoldState* state, const Node* node, const ConstKind kinds[2]) {
+  switch (node->type) {
+    case NODE_NUMBER:
+      return CONST_NUMBER;
+    case NODE_BOOL:
+      return CONST_BOOL;
+    case NODE_IDENT:
+      return kind_of_name(state, (const IdentNode*)node);
+    case NODE_VAR:
+      return ((const VarNode*)node)->var_type == TOK_TYPE_BOOL ? CONST_BOOL : CONST_NUMBER;
+    case NODE_UNARY_OP: {
+      OpType op = ((const UnaryOpNode*)node)->op;
+      return op == OP_POS ? kinds[0] : op == OP_NEG ? CONST_NUMBER : CONST_BOOL;
+    }
+    case NODE_BINARY_OP: {
+      OpType op = ((const BinaryOpNode*)node)->op;
+      if (op <= OP_OR) return kinds[0];
+      return op < OP_ADD ? CONST_BOOL : CONST_NUMBER;
+    }
+    default:
+      return CONST_NONE;
+  }
+}
+
+// Builds the node of a constant, negative numbers are negated literals
+static Node* new_constant(arena_t* arena, Constant constant) {
+  if (constant.kind == CONST_BOOL) return ast_new_bool(arena, constant.value != 0);
+  if (constant.value >= 0) return ast_new_number(arena, (uint64_t)constant.value);
+  return ast_new_unary_op(arena, ast_new_number(arena, 0 - (uint64_t)constant.value), OP_NEG);
+}
+
+// Evaluates an operator on two constants, returns false if it can't be
+static bool evaluate_binary(OpType op, Constant left, Constant right, Constant* result) {
+  // wrapping arithmetic goes through unsigned integers, which don't overflow
+  uint64_t l = (uint64_t)left.value, r = (uint64_t)right.value;
+  bool numbers = left.kind == CONST_NUMBER && right.kind == CONST_NUMBER;
+  bool bools = left.kind == CONST_BOOL && right.kind == CONST_BOOL;
+  result->kind = CONST_NUMBER;
+  switch (op) {
+    case OP_ADD:
+      result->value = (int64_t)(l + r);
+      return numbers;
+    case OP_SUB:
+      result->value = (int64_t)(l - r);
+      return numbers;
+    case OP_MUL:
+      result->value = (int64_t)(l * r);
+      return numbers;
+    case OP_DIV:
+    case OP_MOD:
+      if (!numbers || right.value == 0) return false;
+      // the only quotient that overflows is INT64_MIN / -1
+      if (right.value == -1) result->value = op == OP_DIV ? (int64_t)(0 - l) : 0;
+      else result->value = op == OP_DIV ? left.value / right.value : left.value % right.value;
+      return true;
+    case OP_EQ:
+    case OP_NE:
+      result->kind = CONST_BOOL;
+      result->value = (left.value == right.value) == (op == OP_EQ);
+      return left.kind != CONST_NONE && left.kind == right.kind;
+    case OP_LT:
+      result->kind = CONST_BOOL, result->value = left.value < right.value;
+      return numbers;
+    case OP_LE:
+      result->kind = CONST_BOOL, result->value = left.value <= right.value;
+      return numbers;
+    case OP_GT:
+      result->kind = CONST_BOOL, result->value = left.value > right.value;
+      return numbers;
+    case OP_GE:
+      result->kind = CONST_BOOL, result->value = left.value >= right.value;
+      return numbers;
+    case OP_AND:
+      result->kind = CONST_BOOL, result->value = left.value && right.value;
+      return bools;
+    case OP_OR:
+      result->kind = CONST_BOOL, result->value = left.value || right.value;
+      return bools;
+    default:
+      return false;
+  }
+}
+
+/** Folds a binary operation whose operands are folded already. A division by
+  * zero stays as it is, for the program to trap on if it ever gets there, and
+  * so does an operation on constants of the wrong kind. An operand only
+  * replaces the operation if it has the kind the operation would, as a bool
+  * that is added to 0 prints as a number.
+  * @param pure Whether the left and the right operand are free of side effects.
+  * @param kinds The kinds of the left and the right operand.
+  * @return The node to replace the operation with, which may be the operation
+  * itself or one of its operands.
+  */
+static Node* fold_binary_op(FoldState* state, BinaryOpNode* node, const bool pure[2], const ConstKind kinds[2]) {
+  Constant left = constant_of(node->left), right = constant_of(node->right);
+  OpType op = node->op;
+  bool mixed = left.kind != CONST_NONE && right.kind != CONST_NONE && left.kind != right.kind;
+  if ((takes_numbers(op) && (left.kind == CONST_BOOL || right.kind == CONST_BOOL))
+      || ((op == OP_EQ || op == OP_NE) && mixed)) {
+    return (Node*)node;
+  }
+
+  Constant result;
+  if (evaluate_binary(op, left, right, &result)) return new_constant(state->arena, result);
+
+  switch (op) {
+    case OP_ADD:
+      if (is_number(right, 0) && kinds[0] == CONST_NUMBER) return node->left;
+      if (is_number(left, 0) && kinds[1] == CONST_NUMBER) return node->right;
+      break;
+    case OP_SUB:
+      if (is_number(right, 0) && kinds[0] == CONST_NUMBER) return node->left;
+      // a negation makes a number of bools too
+      if (is_number(left, 0)) return ast_new_unary_op(state->arena, node->right, OP_NEG);
+      break;
+    case OP_MUL:
+      if (is_number(right, 1) && kinds[0] == CONST_NUMBER) return node->left;
+      if (is_number(left, 1) && kinds[1] == CONST_NUMBER) return node->right;
+      if (is_number(right, 0) && pure[0]) return node->right;
+      if (is_number(left, 0) && pure[1]) return node->left;
+      break;
+    case OP_DIV:
+      if (is_number(right, 1) && kinds[0] == CONST_NUMBER) return node->left;
+      break;
+    case OP_MOD:
+      if ((is_number(right, 1) || is_number(right, -1)) && pure[0]) {
+        return ast_new_number(state->arena, 0);
+      }
+      break;
+    case OP_AND:
+      // the right operand is only evaluated if the left one is true, the
+      // result has the kind of the left one whichever decides it
+      if (is_bool(left, true)) return kinds[1] == CONST_BOOL ? node->right : (Node*)node;
+      if (is_bool(left, false)) return node->left;
+      if (kinds[0] != CONST_BOOL) break;
+      if (is_bool(right, true)) return node->left;
+      if (is_bool(right, false) && pure[0]) return node->right;
+      break;
+    case OP_OR:
+      if (is_bool(left, false)) return kinds[1] == CONST_BOOL ? node->right : (Node*)node;
+      if (is_bool(left, true)) return node->left;
+      if (kinds[0] != CONST_BOOL) break;
+      if (is_bool(right, false)) return node->left;
+      if (is_bool(right, true) && pure[0]) return node->right;
+      break;
+    default:
+      break;
+  }
+  return (Node*)node;
+}
+
+static Node* fold_unary_op(FoldState* state, UnaryOpNode* node) {
+  Constant operand = constant_of(node->operand);
+  // operands of the wrong kind are left for the program to run into
+  if ((takes_numbers(node->op) && operand.kind == CONST_BOOL)
+      || (node->op == OP_NOT && operand.kind == CONST_NUMBER)) {
+    return (Node*)node;
+  }
+  switch (node->op) {
+    case OP_POS:
+      return node->operand;
+    case OP_NEG:
+      // the negation of a number is how negative constants are stored
+      if (operand.kind != CONST_NUMBER || node->operand->type == NODE_NUMBER) break;
+      operand.value = (int64_t)(0 - (uint64_t)operand.value);
+      return new_constant(state->arena, operand);
+    case OP_NOT:
+      if (operand.kind == CONST_BOOL) return ast_new_bool(state->arena, !operand.value);
+      break;
+    default:
+      break;
+  }
+  return (Node*)node;
+}
+
+// Folds a node whose children are folded and replaces what they tell it with
+// what it tells its own parent
+static void fold_node(FoldState* state, Node** slot) {
+  Node* node = *slot;
+  size_t count = child_count(node), present = 0;
+  for (size_t i = 0; i < count; i++) present += *child_slot(node, i) != NULL;
+  state->folded_size -= present;
+  const Folded* folded = &state->folded[state->folded_size];
+  bool pure[2] = { true, true };
+  ConstKind kinds[2] = { CONST_NONE, CONST_NONE };
+  bool result_pure = !has_effects(node);
+  size_t traps = 0;
+  for (size_t i = 0, child = 0; i < count; i++) {
+    if (!*child_slot(node, i)) continue;
+    if (i < 2) pure[i] = folded[child].pure, kinds[i] = folded[child].kind;
+    result_pure = result_pure && folded[child].pure;
+    // traps in code that never runs are no reason to complain
+    if (!is_dead(node, i)) traps += folded[child].traps;
+    child++;
+  }
+
+  Node* result = node;
+  switch (node->type) {
+    case NODE_BINARY_OP: {
+      BinaryOpNode* binary_op = (BinaryOpNode*)node;
+      traps += divides_by_zero(binary_op);
+      result = fold_binary_op(state, binary_op, pure, kinds);
+      if (result == binary_op->left) result_pure = pure[0];
+      else if (result == binary_op->right) result_pure = pure[1];
+      break;
+    }
+    case NODE_UNARY_OP:
+      result = fold_unary_op(state, (UnaryOpNode*)node);
+      break;
+    case NODE_VAR: {
+      // the variable only comes into scope after its value
+      const VarNode* var = (const VarNode*)node;
+      declare(state, var->symbol, kind_of(state, node, kinds));
+      break;
+    }
+    default:
+      break;
+  }
+  if (constant_of(result).kind != CONST_NONE) result_pure = true;
+  // an operand that replaces its operation keeps its own kind
+  ConstKind kind = kind_of(state, result, kinds);
+  for (size_t i = 0; result != node && i < count && i < 2; i++) {
+    if (result == *child_slot(node, i)) kind = kinds[i];
+  }
+
+  *slot = result;
+  state->folded[state->folded_size++] = (Folded){ .pure = result_pure, .kind = kind, .traps = traps };
+}
+
+Node* ast_fold(Node* root, arena_t* arena, FILE* out) {
+  FoldState state = {
+    .arena = arena, .folded = NULL, .folded_size = 0, .folded_capacity = 0,
+    .vars = NULL, .var_count = 0, .var_capacity = 0, .bindings = NULL, .binding_capacity = 0
+  };
+  size_t work_size = 0, work_capacity = 0;
+  FoldWork* work = array_grow(NULL, &work_capacity, sizeof(FoldWork));
+  work[work_size++] = (FoldWork){ .slot = &root, .left = false, .var_count = 0 };
+  while (work_size) {
+    FoldWork item = work[--work_size];
+    if (item.left) {
+      // a node adds one entry at most as often as its children took theirs
+      if (state.folded_size == state.folded_capacity) {
+        state.folded = array_grow(state.folded, &state.folded_capacity, sizeof(Folded));
+      }
+      // the variables declared in a block go out of scope with it
+      bool block = (*item.slot)->type == NODE_BLOCK;
+      fold_node(&state, item.slot);
+      if (block) leave_scope(&state, item.var_count);
+      continue;
+    }
+    Node* node = *item.slot;
+    size_t count = child_count(node);
+    while (work_size + count + 1 > work_capacity) work = array_grow(work, &work_capacity, sizeof(FoldWork));
+    work[work_size++] = (FoldWork){ .slot = item.slot, .left = true, .var_count = state.var_count };
+    for (size_t i = count; i-- > 0;) {
+      Node** slot = child_slot(node, i);
+      if (*slot) work[work_size++] = (FoldWork){ .slot = slot, .left = false, .var_count = 0 };
+    }
+  }
+  // the root is the one subtree left, and everything in it may run
+  for (size_t i = 0; i < state.folded[0].traps; i++) fprintf(out, "Warning: Division by zero\n");
+  free(work);
+  free(state.folded);
+  free(state.vars);
+  free(state.bindings);
+  return root;
+}
@@ -1,170 +1,762 @@
+#define _POSIX_C_SOURCE 200809L // sysconf
+
 #include "ast.h"
+#include "cache.h"
+#include "fold.h"
 #include "parser.h"
 #include "printer.h"
 
 #include "common/io.h"
+#include "common/stats.h"
+#include "lexer/buffer.h"
 #include "lexer/lexer.h"
 
+#include <pthread.h>
+#include <setjmp.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <ctype.h>
+#include <unistd.h>
 
-#define NEXT() (lexer_next())
-#define CURRENT() (lexer_peek())
+#define NEXT() (next_token())
+#define CURRENT() (peek_token())
 
-#define IS(t) (CURRENT()->type == t)
+#define IS(t) (CURRENT().type == t)
 
 #define KILL_ME() assert(false);
 
+// Top-level statements are only parsed in parallel if every thread gets at
+// least this many tokens, and are handed out in tasks of at least this size
+#define PARSE_MIN_TOKENS (64 * 1024)
+#define PARSE_MIN_TASK_TOKENS 1024
+#define PARSE_MAX_THREADS 64
+// Expressions and statements nested deeper than this are rejected, so that
+// neither the parser nor the passes after it run out of stack. A chain of
+// operators like `a + b + c` is built in a loop and nests only to the left,
+// which is why every pass walks down left operands without recursing.
+#define PARSE_MAX_DEPTH 1024
+// Minimum size of the regions AST nodes are allocated in
+#define AST_REGION_SIZE (64 * 1024)
+
+// Binding powers of the precedence levels in grammar.bnf, an operator only
+// takes operands that bind at least as tightly as its own level
+typedef enum {
+	BIND_NONE,
+	BIND_PREC_0,
+	BIND_PREC_1,
+	BIND_PREC_2,
+	BIND_PREC_3,
+	BIND_PREC_4,
+	BIND_PREC_5
+} BindingPower;
+
+// Every thread that parses has its own state
+static __thread struct parser_state {
+	const token_buffer_t *tokens;
+	const char *src;
+	// Index of the current token
+	size_t next;
+	// Tokens at and after this index read as EOF
+	size_t end;
+
+	// Where nodes are allocated, which outlives the parse
+	arena_t *arena;
+	// Child lists under construction, each list on top of its parent's
+	NodeStack stack;
+
+	// Count of expressions and statements that the current one is nested in
+	size_t depth;
+	// Where an error jumps to after it's reported
+	jmp_buf *abort;
+	// Where errors are reported, parses without one fail quietly
+	FILE *errors;
+} ps;
+
 static Node* 		parse_block(void);
-static Node* 		parse_statement(void);
+static void			parse_var(void);
+static Node* 		parse_outer_stmt(void);
+static Node* 		parse_inner_stmt(void);
+static Node* 		parse_common_stmt(void);
+static Node* 		parse_else(void);
+static Node* 		parse_outer_stmt_expr(void);
+static Node* 		parse_delim_stmt_expr(void);
+static Node* 		parse_inner_stmt_expr(void);
 static Node* 		parse_expression(void);
-static Node* 		parse_number(void);
-static unsigned get_precedence(token_type_t type);
-static Node* 		fix_expression(void** children, size_t* size);
-bool				 		parse_operator(void** children, size_t* size);
+static Node* 		parse_precedence(BindingPower min);
+static Node* 		parse_infix(Node* left, BindingPower min);
+static Node* 		parse_unary(void);
+static Node* 		parse_term(void);
+static Node* 		parse_call(token_t name);
+static Node* 		parse_number(bool negated);
 
 static void error(const char *fmt, ...);
 
+static token_t peek_token(void) {
+	// the token stream always ends with an EOF token
+	size_t index = ps.next < ps.end ? ps.next : ps.tokens->count - 1;
+	return token_buffer_get(ps.tokens, ps.src, index);
+}
+
+static token_t next_token(void) {
+	token_t token = peek_token();
+	if (ps.next < ps.end) ps.next++;
+	return token;
+}
+
 static void error(const char *fmt, ...) {
-	va_list args;
-	va_start(args, fmt);
-	vfprintf(stderr, fmt, args);
-	va_end(args);
-	exit(1);
+	if (ps.errors) {
+		va_list args;
+		va_start(args, fmt);
+		vfprintf(ps.errors, fmt, args);
+		va_end(args);
+	}
+	longjmp(*ps.abort, 1);
+}
+
+// Enters a nested expression or statement, failing the whole parse when there
+// are too many, as no other alternative would nest any less
+static void nest(void) {
+	if (++ps.depth <= PARSE_MAX_DEPTH) return;
+	if (ps.errors) fprintf(ps.errors, "Nesting is too deep\n");
+	longjmp(*ps.abort, 1);
 }
 
-static unsigned int get_precedence(token_type_t type) {
+static token_t expect(token_type_t type) {
+	if (!IS(type)) {
+		error("Expected %s but got %s\n", token_type_strs[type], token_type_strs[CURRENT().type]);
+	}
+	return NEXT();
+}
+
+// Binding power of an operator token between two operands
+static BindingPower get_binding(token_type_t type) {
 	switch (type) {
-		case TOK_OP_MULT:
-		case TOK_OP_DIV:
-			return 1;
+		case TOK_OP_ASSIGN:
+		case TOK_OP_ASSIGN_ALT:
+			return BIND_PREC_0;
+		case TOK_KW_AND:
+		case TOK_KW_OR:
+			return BIND_PREC_1;
+		case TOK_OP_COMPARE:
+			return BIND_PREC_2;
 		case TOK_OP_PLUS:
 		case TOK_OP_MINUS:
-			return 2;
+			return BIND_PREC_3;
+		case TOK_OP_MULT:
+		case TOK_OP_DIV:
+		case TOK_OP_MOD:
+			return BIND_PREC_4;
 		default:
-			error("Invalid operator %s\n", token_type_strs[type]);
-	}
-}
-
-static Node* fix_expression(void** children, size_t* size) {
-	if (*size == 1) {
-		return ((Node**)*children)[0];
-	}
-	while (*size > 1) {
-		int next = -1;
-		int min_precedence = 0xFFFFF;
-		bool unary = false;
-		for (size_t i = 0; i < *size; i++) {
-			Node* node = ((Node**)*children)[i];
-			if (node->type == NODE_BINARY_OP) {
-				BinaryOpNode* binary_op = (BinaryOpNode*)node;
-				if (!binary_op->is_op) continue;
-				unsigned int precedence = get_precedence(binary_op->op);
-				if (precedence < min_precedence) {
-					min_precedence = precedence;
-					next = i;
-					unary = false; // TODO: unary operators
-				}
-			}
-		}
-		assert(next != -1);
-		assert(!unary && "Unary operators not supported yet");
-		assert(next >= 1 && next < *size - 1);
-		BinaryOpNode* binary_op = (BinaryOpNode*)((Node**)*children)[next];
-		Node* left = ((Node**)*children)[next - 1];
-		Node* right = ((Node**)*children)[next + 1];
-		binary_op->left = left;
-		binary_op->right = right;
-		binary_op->is_op = false;
-		// Remove elements at next - 1 and next + 1
-		ast_node_erase(children, size, next + 1);
-		ast_node_erase(children, size, next - 1);
-	}
-	return ((Node**)*children)[0];
-}
-
-bool parse_operator(void** children, size_t* size) {
-	bool valid = true;
-	switch (CURRENT()->type) {
+			return BIND_NONE;
+	}
+}
+
+// Finds the operator among first..last that is spelled like the token
+static OpType match_spelling(token_t token, OpType first, OpType last) {
+	for (OpType op = first; op <= last; op++) {
+		const char* spelling = op_type_strs[op];
+		if (strlen(spelling) == token.content.size
+			&& !memcmp(spelling, token.content.string, token.content.size)) return op;
+	}
+	error("Invalid operator %.*s\n", (int)token.content.size, token.content.string);
+	return first;
+}
+
+static OpType get_binary_op(token_t token) {
+	switch (token.type) {
+		case TOK_OP_ASSIGN:
+			return OP_ASSIGN;
+		case TOK_OP_ASSIGN_ALT:
+			return match_spelling(token, OP_ASSIGN_ADD, OP_ASSIGN_MOD);
+		case TOK_KW_AND:
+			return OP_AND;
+		case TOK_KW_OR:
+			return OP_OR;
+		case TOK_OP_COMPARE:
+			return match_spelling(token, OP_EQ, OP_GE);
 		case TOK_OP_PLUS:
+			return OP_ADD;
 		case TOK_OP_MINUS:
+			return OP_SUB;
 		case TOK_OP_MULT:
+			return OP_MUL;
 		case TOK_OP_DIV:
-			break;
+			return OP_DIV;
+		case TOK_OP_MOD:
+			return OP_MOD;
 		default:
-			valid = false;
+			error("Invalid operator %s\n", token_type_strs[token.type]);
+			return OP_ASSIGN;
 	}
-	if (valid) {
-		Node* op = ast_new_binary_op(NULL, NULL, CURRENT()->type);
-		((BinaryOpNode*)op)->is_op = true;
-		ast_node_append(children, size, op);
-		NEXT();
-	}
-	return !valid;
 }
 
-static Node* parse_number(void) {
+// The lexer decodes the literal, the largest one fits only once it's negated
+static Node* parse_number(bool negated) {
 	assert(IS(TOK_LIT_NUM));
-	unsigned int value = atoi(CURRENT()->content.string);
-	return ast_new_number(value);
+	token_t literal = NEXT();
+	if (literal.number > (negated ? LEXER_MAX_NUMBER : INT64_MAX)) {
+		error("Number %.*s is out of range\n", (int)literal.content.size, literal.content.string);
+	}
+	return ast_new_number(ps.arena, literal.number);
 }
 
-static Node* parse_expression(void) {
-	void* children = NULL;
-	size_t size = 0;
-	while(true) {
-		Node* expr = NULL;
-		switch (CURRENT()->type) {
-			case TOK_LIT_NUM:
-				expr = parse_number();
-				break;
-			default:
-				error("Unexpected token %s\n", token_type_strs[CURRENT()->type]);
+// TERM' ::= ( FUNC ) | ''
+// FUNC ::= DELIM_STMT_EXPR FUNC' | ''
+// FUNC' ::= , DELIM_STMT_EXPR FUNC' | ''
+static Node* parse_call(token_t name) {
+	expect(TOK_OPEN_ROUND);
+	size_t base = ps.stack.size;
+	if (!IS(TOK_CLOSE_ROUND)) {
+		while (true) {
+			ast_stack_push(&ps.stack, parse_delim_stmt_expr());
+			if (!IS(TOK_COMMA)) break;
+			NEXT();
 		}
+	}
+	expect(TOK_CLOSE_ROUND);
+	Node* call = ast_new_call(ps.arena, name.content, name.symbol,
+		ps.stack.nodes + base, ps.stack.size - base);
+	ps.stack.size = base;
+	return call;
+}
+
+// TERM ::= ( PREC_0 ) | id TERM' | num | true | false | nil
+static Node* parse_term(void) {
+	switch (CURRENT().type) {
+		case TOK_OPEN_ROUND: {
+			NEXT();
+			Node* expr = parse_precedence(BIND_PREC_0);
+			expect(TOK_CLOSE_ROUND);
+			return expr;
+		}
+		case TOK_IDENT: {
+			token_t name = NEXT();
+			if (IS(TOK_OPEN_ROUND)) return parse_call(name);
+			return ast_new_ident(ps.arena, name.content, name.symbol);
+		}
+		case TOK_LIT_NUM:
+			return parse_number(false);
+		case TOK_KW_TRUE:
+		case TOK_KW_FALSE:
+			return ast_new_bool(ps.arena, NEXT().type == TOK_KW_TRUE);
+		case TOK_KW_NIL:
+			NEXT();
+			return ast_new_nil(ps.arena);
+		default: {
+			// number literals with letters in them are lexed as errors
+			string_t content = CURRENT().content;
+			if (IS(TOK_ERROR) && isdigit((unsigned char)content.string[0])) {
+				error("Invalid number %.*s\n", (int)content.size, content.string);
+			}
+			error("Unexpected token %s\n", token_type_strs[CURRENT().type]);
+			return NULL;
+		}
+	}
+}
+
+// PREC_5 ::= UNARIES_5 TERM
+static Node* parse_unary(void) {
+	switch (CURRENT().type) {
+		case TOK_OP_PLUS:
+		case TOK_OP_MINUS: {
+			OpType op = NEXT().type == TOK_OP_PLUS ? OP_POS : OP_NEG;
+			Node* operand = op == OP_NEG && IS(TOK_LIT_NUM) ? parse_number(true) : parse_term();
+			return ast_new_unary_op(ps.arena, operand, op);
+		}
+		default:
+			return parse_term();
+	}
+}
+
+/** Folds every following operator that binds at least as tightly as `min`
+  * into the tree in one left to right pass. Operators of the same level
+  * associate to the left, except for assignments which associate to the right.
+  * The chain this builds to the left can be of any length, only the right
+  * operands count towards PARSE_MAX_DEPTH.
+  * @param left The operand before the first operator.
+  * @param min The loosest binding power to take operators of.
+  * @return The root of the tree.
+  */
+static Node* parse_infix(Node* left, BindingPower min) {
+	while (true) {
+		BindingPower binding = get_binding(CURRENT().type);
+		if (binding == BIND_NONE || binding < min) return left;
+		OpType op = get_binary_op(NEXT());
+		Node* right = parse_precedence(binding == BIND_PREC_0 ? binding : binding + 1);
+		left = ast_new_binary_op(ps.arena, left, right, op);
+	}
+}
+
+// PREC_2 ::= UNARIES_2 PREC_3 PREC_2', where not covers the comparisons
+static Node* parse_precedence(BindingPower min) {
+	nest();
+	Node* left;
+	if (IS(TOK_KW_NOT) && min <= BIND_PREC_2) {
 		NEXT();
-		while (true) {
-			/*if (IS(TOK_OPEN_ROUND)) {
-// parse calls and shit here
-			}	else*/ {
-				break;
-			}		
+		Node* operand = parse_infix(parse_unary(), BIND_PREC_2);
+		left = ast_new_unary_op(ps.arena, operand, OP_NOT);
+	} else {
+		left = parse_unary();
+	}
+	Node* expr = parse_infix(left, min);
+	ps.depth--;
+	return expr;
+}
+
+// PREC_0 ::= PREC_1 PREC_0'
+static Node* parse_expression(void) {
+	return parse_precedence(BIND_PREC_0);
+}
+
+// Whether the current token starts an OUTER_STMT or an INNER_STMT, which is
+// never how a PREC_0 starts
+static bool at_stmt(void) {
+	switch (CURRENT().type) {
+		case TOK_KW_DO:
+		case TOK_KW_RETURN:
+		case TOK_KW_IF:
+		case TOK_KW_WHILE:
+			return true;
+		default:
+			return false;
+	}
+}
+
+// Parses a statement that is nested in the current one
+static Node* parse_nested(Node* (*parse)(void)) {
+	nest();
+	Node* stmt = parse();
+	ps.depth--;
+	return stmt;
+}
+
+// OUTER_STMT_EXPR ::= OUTER_STMT | PREC_0 ;
+static Node* parse_outer_stmt_expr(void) {
+	if (at_stmt()) return parse_nested(parse_outer_stmt);
+	Node* expr = parse_expression();
+	expect(TOK_SEMICOLON);
+	return expr;
+}
+
+// DELIM_STMT_EXPR ::= OUTER_STMT | PREC_0
+static Node* parse_delim_stmt_expr(void) {
+	return at_stmt() ? parse_nested(parse_outer_stmt) : parse_expression();
+}
+
+// INNER_STMT_EXPR ::= INNER_STMT | PREC_0
+static Node* parse_inner_stmt_expr(void) {
+	return at_stmt() ? parse_nested(parse_inner_stmt) : parse_expression();
+}
+
+// ELSE ::= else INNER_STMT_EXPR | elif DELIM_STMT_EXPR : INNER_STMT_EXPR ELSE | ''
+static Node* parse_else(void) {
+	switch (CURRENT().type) {
+		case TOK_KW_ELSE:
+			NEXT();
+			return parse_inner_stmt_expr();
+		case TOK_KW_ELIF: {
+			NEXT();
+			Node* condition = parse_delim_stmt_expr();
+			expect(TOK_COLON);
+			Node* then = parse_inner_stmt_expr();
+			// every elif is an if nested in the one before
+			return ast_new_if(ps.arena, condition, then, parse_nested(parse_else));
 		}
-		ast_node_append(&children, &size, expr);
-		if (parse_operator(&children, &size)) {
-			break;
+		default:
+			return NULL;
+	}
+}
+
+// STMT_COMMON ::= if DELIM_STMT_EXPR : INNER_STMT_EXPR ELSE end
+// STMT_COMMON ::= while DELIM_STMT_EXPR : INNER_STMT_EXPR end
+static Node* parse_common_stmt(void) {
+	bool is_if = IS(TOK_KW_IF);
+	assert(is_if || IS(TOK_KW_WHILE));
+	NEXT();
+	Node* condition = parse_delim_stmt_expr();
+	expect(TOK_COLON);
+	Node* body = parse_inner_stmt_expr();
+	Node* stmt = is_if
+		? ast_new_if(ps.arena, condition, body, parse_else())
+		: ast_new_while(ps.arena, condition, body);
+	expect(TOK_KW_END);
+	return stmt;
+}
+
+// OUTER_STMT ::= do BLOCK end | return OUTER_STMT_EXPR | STMT_COMMON
+static Node* parse_outer_stmt(void) {
+	switch (CURRENT().type) {
+		case TOK_KW_DO: {
+			NEXT();
+			Node* block = parse_block();
+			expect(TOK_KW_END);
+			return block;
 		}
+		case TOK_KW_RETURN:
+			NEXT();
+			return ast_new_return(ps.arena, parse_outer_stmt_expr());
+		case TOK_KW_IF:
+		case TOK_KW_WHILE:
+			return parse_common_stmt();
+		default:
+			error("Expected a statement but got %s\n", token_type_strs[CURRENT().type]);
+			return NULL;
 	}
-	return fix_expression(&children, &size);
 }
 
-static Node* parse_statement(void) {
-	switch (CURRENT()->type) {
+// INNER_STMT ::= do BLOCK | return INNER_STMT_EXPR | STMT_COMMON
+static Node* parse_inner_stmt(void) {
+	switch (CURRENT().type) {
+		case TOK_KW_DO:
+			NEXT();
+			return parse_block();
+		case TOK_KW_RETURN:
+			NEXT();
+			return ast_new_return(ps.arena, parse_inner_stmt_expr());
+		case TOK_KW_IF:
+		case TOK_KW_WHILE:
+			return parse_common_stmt();
 		default:
-			return parse_expression();
+			error("Expected a statement but got %s\n", token_type_strs[CURRENT().type]);
+			return NULL;
 	}
 }
 
+// var TYPE id = VAR_INIT, appending one VarNode per declared name
+static void parse_var(void) {
+	expect(TOK_KW_VAR);
+	token_type_t var_type = CURRENT().type;
+	if (var_type != TOK_TYPE_NAT && var_type != TOK_TYPE_INT && var_type != TOK_TYPE_BOOL) {
+		error("Expected a type but got %s\n", token_type_strs[var_type]);
+	}
+	NEXT();
+	while (true) {
+		token_t name = expect(TOK_IDENT);
+		expect(TOK_OP_ASSIGN);
+		// VAR_INIT ::= OUTER_STMT VAR_STMT_NEXT | PREC_0 VAR_EXPR_NEXT
+		bool is_stmt = at_stmt();
+		Node* value = is_stmt ? parse_nested(parse_outer_stmt) : parse_expression();
+		ast_stack_push(&ps.stack, ast_new_var(ps.arena, var_type, name.content, name.symbol, value));
+		if (IS(TOK_COMMA)) {
+			NEXT();
+			continue;
+		}
+		if (!is_stmt) expect(TOK_SEMICOLON);
+		return;
+	}
+}
+
+// Makes a block of the children on the stack above base and pops them
+static Node* pop_block(size_t base) {
+	Node* block = ast_new_block(ps.arena, ps.stack.nodes + base, ps.stack.size - base);
+	ps.stack.size = base;
+	return block;
+}
+
 static Node* parse_block(void) {
-	size_t size = 0;
-	void *children = NULL;
+	size_t base = ps.stack.size;
 	while(true) {
-		switch (CURRENT()->type) {
+		switch (CURRENT().type) {
 			case TOK_KW_END:
+			case TOK_KW_ELSE:
+			case TOK_KW_ELIF:
 			case TOK_EOF:
-				return ast_new_block(children, size);
+				return pop_block(base);
+			case TOK_KW_VAR:
+				parse_var();
+				break;
 			default:
-				ast_node_append(&children, &size, parse_statement());
+				ast_stack_push(&ps.stack, parse_outer_stmt_expr());
 		}
 	}
 	KILL_ME();
 }
 
-void parser_start(void) {
-	Parser *parser = malloc(sizeof(Parser));
-	parser->ast = parse_block();
-	ast_print(parser->ast);
+// Parallel Parsing //
+
+typedef struct {
+	size_t first, last;
+	// The statements in the range or NULL if parsing them failed
+	BlockNode* block;
+} ParseTask;
+
+typedef struct {
+	ParseTask* tasks;
+	size_t task_count;
+	// Index of the next task that no worker took yet
+	size_t next_task;
+	// Every worker allocates its nodes in its own arena of the group
+	arena_group_t nodes;
+	const token_buffer_t* tokens;
+	const char* src;
+} ParseJob;
+
+static void parser_state_init(arena_t* arena, const token_buffer_t* tokens, const char* src,
+	size_t first, size_t last) {
+	ps.tokens = tokens;
+	ps.src = src;
+	ps.next = first, ps.end = last;
+	ps.arena = arena;
+}
+
+// Frees what the state of this thread holds on to between parses
+static void parser_state_release(void) {
+	ast_stack_free(&ps.stack);
+}
+
+/** Splits the token stream at the ends of top-level statements, which are a
+  * ";" or an "end" that isn't nested in any other "do", "if" or "while" and
+  * isn't followed by a "," continuing a var declaration. An inner "do" right
+  * after ":", "else" or an inner "return" shares the "end" of its enclosing
+  * statement and doesn't nest. Consecutive statements are grouped into tasks
+  * of at least `grain` tokens.
+  * @param tasks Array to store the tasks in, at least `max_tasks` long.
+  * @param max_tasks The maximum number of tasks to split into.
+  * @param grain The minimum number of tokens per task.
+  * @return The number of tasks or 0 if the stream doesn't nest properly.
+  */
+static size_t find_statements(ParseTask* tasks, size_t max_tasks, size_t grain) {
+	const uint8_t* types = ps.tokens->types;
+	size_t count = ps.tokens->count - 1;
+	size_t task_count = 0, first = 0;
+	long depth = 0, parens = 0;
+	bool inner = false;
+	for (size_t i = 0; i < count; i++) {
+		token_type_t type = (token_type_t) types[i];
+		switch (type) {
+			case TOK_KW_DO:
+				if (!inner) depth++;
+				break;
+			case TOK_KW_IF:
+			case TOK_KW_WHILE:
+				depth++;
+				break;
+			case TOK_KW_END:
+				depth--;
+				break;
+			case TOK_OPEN_ROUND:
+				parens++;
+				break;
+			case TOK_CLOSE_ROUND:
+				parens--;
+				break;
+			default:
+				break;
+		}
+		if (depth < 0 || parens < 0) return 0;
+		inner = type == TOK_COLON || type == TOK_KW_ELSE || (type == TOK_KW_RETURN && inner);
+
+		bool ends = depth == 0 && parens == 0 && (type == TOK_SEMICOLON
+			|| (type == TOK_KW_END && types[i + 1] != TOK_COMMA));
+		if (!ends || i + 1 - first < grain || task_count + 1 == max_tasks) continue;
+		tasks[task_count++] = (ParseTask) { .first = first, .last = i + 1, .block = NULL };
+		first = i + 1;
+	}
+	if (depth != 0 || parens != 0) return 0;
+	tasks[task_count++] = (ParseTask) { .first = first, .last = count, .block = NULL };
+	return task_count;
+}
+
+static void* parse_worker(void* data) {
+	ParseJob* job = (ParseJob*) data;
+	ps = (struct parser_state) { 0 };
+	parser_state_init(arena_join(&job->nodes), job->tokens, job->src, 0, 0);
+	while (true) {
+		size_t index = __atomic_fetch_add(&job->next_task, 1, __ATOMIC_RELAXED);
+		if (index >= job->task_count) break;
+		ParseTask* task = &job->tasks[index];
+
+		// any error leaves the block NULL and gets reported by the serial parser
+		jmp_buf env;
+		ps.next = task->first, ps.end = task->last;
+		ps.abort = &env;
+		if (!setjmp(env)) {
+			Node* block = parse_block();
+			expect(TOK_EOF);
+			task->block = (BlockNode*) block;
+		}
+		ps.abort = NULL, ps.depth = 0, ps.stack.size = 0;
+	}
+	parser_state_release();
+	arena_leave(&job->nodes);
+	return NULL;
+}
+
+static size_t pick_threads(const Parser* parser, size_t token_count) {
+	size_t threads = parser->threads;
+	if (threads == 0) {
+		long online = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = online > 0 ? (size_t) online : 1;
+	}
+	if (threads > token_count / PARSE_MIN_TOKENS) threads = token_count / PARSE_MIN_TOKENS;
+	if (threads > PARSE_MAX_THREADS) threads = PARSE_MAX_THREADS;
+	return threads ? threads : 1;
+}
+
+/** Parses the top-level block by handing ranges of its statements to a pool
+  * of threads and concatenating their blocks in source order.
+  * @param threads The number of threads to parse with.
+  * @return The top-level block or NULL if any statement failed to parse.
+  */
+static Node* parse_parallel(arena_t* arena, size_t threads) {
+	// a few tasks per thread to even out differently sized statements
+	size_t max_tasks = threads * 8;
+	size_t grain = (ps.tokens->count - 1) / max_tasks;
+	if (grain < PARSE_MIN_TASK_TOKENS) grain = PARSE_MIN_TASK_TOKENS;
+	ParseJob job = {
+		.tasks = malloc(max_tasks * sizeof(ParseTask)), .next_task = 0,
+		.nodes = arena_group_new(AST_REGION_SIZE),
+		.tokens = ps.tokens, .src = ps.src
+	};
+	error_if(job.tasks == NULL);
+	job.task_count = find_statements(job.tasks, max_tasks, grain);
+	if (job.task_count < 2) {
+		free(job.tasks);
+		return NULL;
+	}
+
+	pthread_t workers[PARSE_MAX_THREADS];
+	bool spawned[PARSE_MAX_THREADS] = { false };
+	for (size_t i = 1; i < threads; i++) {
+		spawned[i] = !pthread_create(&workers[i], NULL, parse_worker, &job);
+	}
+	// the worker on this thread gets its own state, so save ours
+	struct parser_state saved = ps;
+	parse_worker(&job);
+	ps = saved;
+	for (size_t i = 1; i < threads; i++) {
+		if (spawned[i]) pthread_join(workers[i], NULL);
+	}
+	// the nodes of the workers live as long as the ones parsed here
+	arena_group_take(arena, &job.nodes);
+
+	size_t base = ps.stack.size;
+	for (size_t i = 0; i < job.task_count; i++) {
+		BlockNode* block = job.tasks[i].block;
+		if (!block) {
+			ps.stack.size = base;
+			free(job.tasks);
+			return NULL;
+		}
+		for (size_t j = 0; j < block->size; j++) {
+			ast_stack_push(&ps.stack, ((Node**)block->children)[j]);
+		}
+	}
+	free(job.tasks);
+	ps.next = ps.end;
+	return pop_block(base);
+}
+
+Node* parser_parse_tokens(const token_buffer_t* tokens, const char* src, arena_t* arena) {
+	parser_state_init(arena, tokens, src, 0, tokens->count - 1);
+	ps.errors = NULL;
+	jmp_buf env;
+	Node* volatile ast = NULL;
+	ps.abort = &env;
+	if (!setjmp(env)) {
+		Node* block = parse_block();
+		expect(TOK_EOF);
+		ast = block;
+	}
+	ps.abort = NULL, ps.depth = 0, ps.stack.size = 0;
+	parser_state_release();
+	return ast;
+}
+
+size_t parser_split_statements(const token_buffer_t* tokens, size_t* ends, size_t max_runs, size_t grain) {
+	ParseTask* tasks = malloc(max_runs * sizeof(ParseTask));
+	error_if(tasks == NULL);
+	ps.tokens = tokens;
+	size_t runs = find_statements(tasks, max_runs, grain);
+	for (size_t i = 0; i < runs; i++) ends[i] = tasks[i].last;
+	free(tasks);
+	return runs;
 }
 
+Parser parser_new(lexer_t* lexer) {
+	return (Parser) {
+		.lexer = lexer, .fold = true, .threads = 0, .errors = stderr,
+		.ast = NULL
+	};
+}
+
+void parser_set_fold(Parser* parser, bool enabled) {
+	parser->fold = enabled;
+}
+
+void parser_set_threads(Parser* parser, size_t threads) {
+	parser->threads = threads;
+}
+
+void parser_set_errors(Parser* parser, FILE* errors) {
+	parser->errors = errors;
+}
+
+// Lexes and parses the whole source into the arena, NULL if it doesn't parse
+static Node* parse_source(Parser* parser, arena_t* arena) {
+	const token_buffer_t* tokens = lexer_get_tokens(parser->lexer);
+	parser_state_init(arena, tokens, lexer_get_src(parser->lexer).string, 0, tokens->count - 1);
+	ps.errors = parser->errors;
+	jmp_buf env;
+	Node* volatile ast = NULL;
+	ps.abort = &env;
+	if (!setjmp(env)) {
+		size_t threads = pick_threads(parser, ps.end);
+		Node* block = threads > 1 ? parse_parallel(arena, threads) : NULL;
+		// the serial parser also reports errors found while parsing in parallel
+		if (!block) {
+			ps.next = 0;
+			block = parse_block();
+			expect(TOK_EOF);
+		}
+		ast = block;
+	}
+	ps.abort = NULL, ps.depth = 0, ps.stack.size = 0;
+	parser_state_release();
+	return ast;
+}
+
+bool parser_start(Parser* parser, void (*consume)(Node* ast, void* data), void* data) {
+	parser->arena = arena_new(AST_REGION_SIZE);
+	string_t src = lexer_get_src(parser->lexer);
+	stats_phase_t phase = stats_enter(STATS_PARSE);
+
+	// a hit never asks the lexer for tokens, so the source isn't even lexed
+	CacheEntry entry = { .map = NULL, .map_size = 0, .shared = NULL };
+	uint64_t key = cache_enabled() ? cache_key(src) : 0;
+	if (cache_enabled() && cache_load(key, src, &entry)) {
+		// the tree points into the source and not into the entry, and its
+		// symbols are the ones that lexing would have interned
+		parser->ast = flat_to_tree(&entry.ast, &parser->arena, src.string);
+		stats_count_nodes(entry.ast.kinds, entry.ast.size);
+		cache_close(&entry);
+	} else {
+		parser->ast = parse_source(parser, &parser->arena);
+		if (!parser->ast) {
+			arena_free(&parser->arena);
+			stats_leave(phase);
+			return false;
+		}
+		// only the cache and the node counts need the compact copy
+		if (cache_enabled() || stats_enabled) {
+			FlatAst flat = flat_from_tree(parser->ast, src.string);
+			if (cache_enabled()) cache_store(key, src, &flat);
+			stats_count_nodes(flat.kinds, flat.size);
+			flat_free(&flat);
+		}
+	}
+	stats_enter(STATS_FOLD);
+	if (parser->fold) parser->ast = ast_fold(parser->ast, &parser->arena, parser->errors);
+	stats_enter(STATS_OUTPUT);
+	consume(parser->ast, data);
+	stats_leave(phase);
+
+	// the whole tree goes at once
+	arena_free(&parser->arena);
+	parser->ast = NULL;
+	return true;
+}
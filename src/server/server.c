@@ -0,0 +1,508 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "server.h"
+
+#include "common/array.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+// Limits that keep a broken client from making the server allocate a lot
+#define SERVER_MAX_ARGS 4096
+#define SERVER_MAX_ARG_SIZE 4096
+// Sources go up to what the lexer takes, including the null terminator
+#define SERVER_MAX_SOURCE ((uint64_t) UINT32_MAX - 1)
+// Size of the inline source of a request that doesn't have one
+#define SERVER_NO_SOURCE UINT64_MAX
+// Connections that may wait to be accepted
+#define SERVER_BACKLOG 128
+// Bytes read from a connection at once, unless more are known to come
+#define SERVER_READ_SIZE 4096
+// Milliseconds a client may leave its connection idle or a request or its
+// response unfinished before the connection is closed
+#define SERVER_TIMEOUT_MS 30000
+// Milliseconds the listener is left alone after running out of descriptors
+// or memory to accept with, while the open connections are still served
+#define SERVER_ACCEPT_PAUSE_MS 100
+
+typedef struct response_header {
+	int32_t status;
+	uint32_t reserved;
+	uint64_t out_size;
+	uint64_t error_size;
+} response_header_t;
+
+// A client the server is talking to
+typedef struct connection {
+	int fd;
+	/// What was read but isn't a request yet.
+	char *buffer;
+	size_t size;
+	size_t capacity;
+	/// The size the buffer has to reach before the request in it can be whole.
+	size_t wanted;
+	/// When the connection is closed unless the client sends something.
+	uint64_t deadline;
+	/// Whether a worker answers its request, until which the next one waits.
+	bool busy;
+	/// Whether the worker couldn't send the response.
+	bool broken;
+	server_request_t request;
+	/// The next connection in the queue it's in.
+	struct connection *next;
+} connection_t;
+
+// What the workers serve and how they get requests from the thread that
+// reads the connections
+static struct server_state {
+	server_handler_t handler;
+	void *data;
+	pthread_mutex_t lock;
+	/// Signaled when a request is queued or the server stops.
+	pthread_cond_t ready;
+	/// Connections with a request for the workers, oldest first.
+	connection_t *first;
+	connection_t *last;
+	/// Connections whose response was sent, which go back to being read.
+	connection_t *answered;
+	/// A byte written to the pipe wakes the thread that reads connections.
+	int wake[2];
+	bool stopping;
+	/// The connections left open once reading them stopped.
+	connection_t **connections;
+	size_t connection_count;
+} ss = { .lock = PTHREAD_MUTEX_INITIALIZER, .ready = PTHREAD_COND_INITIALIZER };
+
+// Internal Functions //
+
+static bool _address(struct sockaddr_un *address, const char *socket_path) {
+	memset(address, 0, sizeof(*address));
+	address->sun_family = AF_UNIX;
+	if(strlen(socket_path) >= sizeof(address->sun_path)) {
+		errno = ENAMETOOLONG;
+		return false;
+	}
+	strcpy(address->sun_path, socket_path);
+	return true;
+}
+
+// Milliseconds on a clock that only goes forward
+static uint64_t _now(void) {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (uint64_t) time.tv_sec * 1000 + (uint64_t) time.tv_nsec / 1000000;
+}
+
+static bool _set_nonblocking(int fd) {
+	int flags = fcntl(fd, F_GETFL);
+	return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+// Fills the block from the descriptor, the other end closing early is an error
+static bool _read_exact(int fd, void *data, size_t size) {
+	char *cursor = (char *) data;
+	while(size) {
+		ssize_t got = read(fd, cursor, size);
+		if(got < 0 && errno == EINTR) continue;
+		if(got == 0) errno = ECONNRESET;
+		if(got <= 0) return false;
+		cursor += got, size -= (size_t) got;
+	}
+	return true;
+}
+
+// Sends all of the blocks, a peer that went away is an error and not a SIGPIPE
+static bool _send(int fd, struct iovec *blocks, int count) {
+	while(count > 0) {
+		struct msghdr message;
+		memset(&message, 0, sizeof(message));
+		message.msg_iov = blocks, message.msg_iovlen = count;
+		ssize_t sent = sendmsg(fd, &message, MSG_NOSIGNAL);
+		if(sent < 0 && errno == EINTR) continue;
+		if(sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			// the server's connections don't block, and a client that doesn't
+			// take its response only gets so long to make room for it
+			struct pollfd room = { .fd = fd, .events = POLLOUT, .revents = 0 };
+			int ready = poll(&room, 1, SERVER_TIMEOUT_MS);
+			if(ready == 0) errno = ETIMEDOUT;
+			if(ready > 0 || (ready < 0 && errno == EINTR)) continue;
+			return false;
+		}
+		if(sent < 0) return false;
+		while(count > 0 && (size_t) sent >= blocks->iov_len) sent -= blocks->iov_len, blocks++, count--;
+		if(count > 0) blocks->iov_base = (char *) blocks->iov_base + sent, blocks->iov_len -= sent;
+	}
+	return true;
+}
+
+static void _free_request(server_request_t *request) {
+	for(size_t i = 0; i < request->arg_count; i++) free(request->args[i]);
+	free(request->args);
+	free(request->source.string);
+	*request = (server_request_t) { .args = NULL, .arg_count = 0, .source = EMPTY_STRING };
+}
+
+static void _close(connection_t *connection) {
+	close(connection->fd);
+	_free_request(&connection->request);
+	free(connection->buffer);
+	free(connection);
+}
+
+// Copies the field at the offset of the buffer out and moves past it, or
+// notes how big the buffer has to get for it
+static bool _field(connection_t *connection, size_t *offset, void *field, size_t size) {
+	if(connection->size - *offset < size) {
+		connection->wanted = *offset + size;
+		return false;
+	}
+	if(field) memcpy(field, &connection->buffer[*offset], size);
+	*offset += size;
+	return true;
+}
+
+// Checks the request at the start of the buffer: 1 with its size if it's
+// whole, 0 if more of it has to come or -1 if it's broken
+static int _measure(connection_t *connection, size_t *total) {
+	size_t offset = 0;
+	uint32_t count;
+	if(!_field(connection, &offset, &count, sizeof(count))) return 0;
+	if(count > SERVER_MAX_ARGS) return -1;
+	for(uint32_t i = 0; i < count; i++) {
+		uint32_t size;
+		if(!_field(connection, &offset, &size, sizeof(size))) return 0;
+		if(size > SERVER_MAX_ARG_SIZE) return -1;
+		if(!_field(connection, &offset, NULL, size)) return 0;
+	}
+	uint64_t size;
+	if(!_field(connection, &offset, &size, sizeof(size))) return 0;
+	if(size != SERVER_NO_SOURCE) {
+		if(size > SERVER_MAX_SOURCE) return -1;
+		if(!_field(connection, &offset, NULL, (size_t) size)) return 0;
+	}
+	*total = offset;
+	return 1;
+}
+
+// Takes the whole request of the given size out of the buffer
+static bool _take_request(connection_t *connection, size_t total) {
+	server_request_t *request = &connection->request;
+	const char *cursor = connection->buffer;
+	uint32_t count;
+	memcpy(&count, cursor, sizeof(count)), cursor += sizeof(count);
+	request->args = (char **) calloc(count + 1, sizeof(char *));
+	error_if(request->args == NULL);
+	while(request->arg_count < count) {
+		uint32_t size;
+		memcpy(&size, cursor, sizeof(size)), cursor += sizeof(size);
+		char *arg = (char *) malloc(size + 1);
+		error_if(arg == NULL);
+		memcpy(arg, cursor, size), cursor += size;
+		arg[size] = '\0';
+		request->args[request->arg_count++] = arg;
+	}
+	uint64_t size;
+	memcpy(&size, cursor, sizeof(size)), cursor += sizeof(size);
+	if(size != SERVER_NO_SOURCE) {
+		// a source as big as the buffer can be too big to have twice
+		char *text = (char *) malloc(size + 1);
+		if(text == NULL) return false;
+		memcpy(text, cursor, size);
+		text[size] = '\0';
+		request->source = (string_t) { .size = size + 1, .string = text };
+	}
+	// a client may have sent the next request already
+	connection->size -= total;
+	memmove(connection->buffer, &connection->buffer[total], connection->size);
+	connection->wanted = 0;
+	return true;
+}
+
+// Reads what came from the client, false if it closed the connection or
+// reading it failed
+static bool _receive(connection_t *connection) {
+	size_t room = connection->wanted > connection->size + SERVER_READ_SIZE
+		? connection->wanted - connection->size : SERVER_READ_SIZE;
+	if(connection->capacity - connection->size < room) {
+		size_t capacity = connection->capacity * 2 > connection->size + room
+			? connection->capacity * 2 : connection->size + room;
+		char *buffer = (char *) realloc(connection->buffer, capacity);
+		if(buffer == NULL) return false;
+		connection->buffer = buffer, connection->capacity = capacity;
+	}
+	ssize_t got = read(connection->fd, &connection->buffer[connection->size], connection->capacity - connection->size);
+	if(got < 0) return errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK;
+	connection->size += (size_t) got;
+	return got > 0;
+}
+
+// Queues the next request of the connection for the workers if it's whole,
+// false if it's broken and the connection has to go
+static bool _dispatch(connection_t *connection) {
+	size_t total = 0;
+	int whole = connection->size < connection->wanted ? 0 : _measure(connection, &total);
+	if(whole <= 0) return whole == 0;
+	if(!_take_request(connection, total)) return false;
+	connection->busy = true;
+	connection->next = NULL;
+	pthread_mutex_lock(&ss.lock);
+	if(ss.last) ss.last->next = connection;
+	else ss.first = connection;
+	ss.last = connection;
+	pthread_cond_signal(&ss.ready);
+	pthread_mutex_unlock(&ss.lock);
+	return true;
+}
+
+static bool _send_response(int fd, const server_response_t *response) {
+	response_header_t header = {
+		.status = response->status, .reserved = 0,
+		.out_size = response->out.size, .error_size = response->errors.size
+	};
+	struct iovec blocks[] = {
+		{ .iov_base = &header, .iov_len = sizeof(header) },
+		{ .iov_base = response->out.string, .iov_len = response->out.size },
+		{ .iov_base = response->errors.string, .iov_len = response->errors.size }
+	};
+	return _send(fd, blocks, 3);
+}
+
+// Answers queued requests until the server stops and the queue is empty
+static void *_work(void *data) {
+	(void) data;
+	pthread_mutex_lock(&ss.lock);
+	while(true) {
+		while(ss.first == NULL && !ss.stopping) pthread_cond_wait(&ss.ready, &ss.lock);
+		connection_t *connection = ss.first;
+		if(connection == NULL) break;
+		ss.first = connection->next;
+		if(ss.first == NULL) ss.last = NULL;
+		pthread_mutex_unlock(&ss.lock);
+
+		server_response_t response = { .status = EXIT_FAILURE, .out = EMPTY_STRING, .errors = EMPTY_STRING };
+		ss.handler(&connection->request, &response, ss.data);
+		_free_request(&connection->request);
+		connection->broken = !_send_response(connection->fd, &response);
+		server_response_free(&response);
+
+		pthread_mutex_lock(&ss.lock);
+		connection->next = ss.answered;
+		ss.answered = connection;
+		// a full pipe already has a wakeup in it
+		while(write(ss.wake[1], "", 1) < 0 && errno == EINTR) continue;
+	}
+	pthread_mutex_unlock(&ss.lock);
+	return NULL;
+}
+
+// Reads the connections and hands their requests to the workers until
+// waiting fails or the listener breaks
+static void _serve(int listener) {
+	connection_t **connections = NULL;
+	size_t count = 0, capacity = 0;
+	struct pollfd *polls = NULL;
+	uint64_t accept_again = 0;
+	while(true) {
+		uint64_t now = _now();
+		bool accepting = now >= accept_again;
+		int timeout = accepting ? -1 : (int) (accept_again - now);
+		polls = (struct pollfd *) realloc(polls, (count + 2) * sizeof(struct pollfd));
+		error_if(polls == NULL);
+		polls[0] = (struct pollfd) { .fd = accepting ? listener : -1, .events = POLLIN, .revents = 0 };
+		polls[1] = (struct pollfd) { .fd = ss.wake[0], .events = POLLIN, .revents = 0 };
+		for(size_t i = 0; i < count; i++) {
+			connection_t *connection = connections[i];
+			// the connection of a request that is answered is left alone
+			polls[i + 2] = (struct pollfd) { .fd = connection->busy ? -1 : connection->fd, .events = POLLIN, .revents = 0 };
+			if(connection->busy) continue;
+			uint64_t left = connection->deadline > now ? connection->deadline - now : 0;
+			if(timeout < 0 || left < (uint64_t) timeout) timeout = (int) left;
+		}
+		if(poll(polls, count + 2, timeout) < 0) {
+			if(errno == EINTR) continue;
+			break;
+		}
+		now = _now();
+
+		if(polls[1].revents) {
+			char bytes[64];
+			while(read(ss.wake[0], bytes, sizeof(bytes)) > 0) continue;
+			pthread_mutex_lock(&ss.lock);
+			connection_t *answered = ss.answered;
+			ss.answered = NULL;
+			pthread_mutex_unlock(&ss.lock);
+			while(answered) {
+				// queueing the next request of the connection takes it over
+				connection_t *connection = answered;
+				answered = answered->next;
+				connection->busy = false;
+				connection->deadline = now + SERVER_TIMEOUT_MS;
+				// a connection that broke is closed below
+				if(!connection->broken && !_dispatch(connection)) connection->broken = true;
+			}
+		}
+
+		size_t kept = 0;
+		for(size_t i = 0; i < count; i++) {
+			connection_t *connection = connections[i];
+			// a worker owns a busy connection, down to whether it broke
+			bool open = connection->busy || !connection->broken;
+			if(open && !connection->busy && polls[i + 2].revents) {
+				size_t size = connection->size;
+				open = _receive(connection);
+				if(connection->size > size) connection->deadline = now + SERVER_TIMEOUT_MS;
+				open = open && _dispatch(connection);
+			}
+			if(open && !connection->busy && connection->deadline <= now) open = false;
+			if(open) connections[kept++] = connection;
+			else _close(connection);
+		}
+		count = kept;
+
+		if(polls[0].revents) {
+			int fd = accept(listener, NULL, NULL);
+			// only a listener that's broken itself stops the server
+			if(fd < 0 && (errno == EBADF || errno == EINVAL || errno == ENOTSOCK || errno == EOPNOTSUPP)) break;
+			if(fd < 0 && (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)) {
+				accept_again = now + SERVER_ACCEPT_PAUSE_MS;
+			}
+			if(fd < 0) continue;
+			if(!_set_nonblocking(fd)) {
+				close(fd);
+				continue;
+			}
+			if(count == capacity) connections = array_grow(connections, &capacity, sizeof(connection_t *));
+			connection_t *connection = (connection_t *) calloc(1, sizeof(connection_t));
+			error_if(connection == NULL);
+			connection->fd = fd;
+			connection->deadline = now + SERVER_TIMEOUT_MS;
+			connection->request = (server_request_t) { .args = NULL, .arg_count = 0, .source = EMPTY_STRING };
+			connections[count++] = connection;
+		}
+	}
+
+	// the connections are closed once the workers are done with them
+	ss.connections = connections, ss.connection_count = count;
+	free(polls);
+}
+
+// External Functions //
+
+int server_listen(const char *socket_path) {
+	struct sockaddr_un address;
+	if(!_address(&address, socket_path)) return -1;
+	// a socket that nobody answers on is left over and can go
+	int other = server_connect(socket_path);
+	if(other >= 0) {
+		close(other);
+		errno = EADDRINUSE;
+		return -1;
+	}
+	if(errno == ECONNREFUSED) unlink(socket_path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd < 0) return -1;
+	if(bind(fd, (struct sockaddr *) &address, sizeof(address)) || listen(fd, SERVER_BACKLOG)) {
+		int error = errno;
+		close(fd);
+		errno = error;
+		return -1;
+	}
+	return fd;
+}
+
+void server_run(int listener, size_t workers, server_handler_t handler, void *data) {
+	ss.handler = handler, ss.data = data;
+	error_if(pipe(ss.wake) || !_set_nonblocking(ss.wake[0]) || !_set_nonblocking(ss.wake[1]));
+	error_if(!_set_nonblocking(listener));
+	pthread_t *threads = (pthread_t *) malloc(workers * sizeof(pthread_t));
+	error_if(threads == NULL);
+	for(size_t i = 0; i < workers; i++)
+		error_if((errno = pthread_create(&threads[i], NULL, _work, NULL)) != 0);
+	_serve(listener);
+
+	// the workers answer what was queued before they stop
+	int error = errno;
+	pthread_mutex_lock(&ss.lock);
+	ss.stopping = true;
+	pthread_cond_broadcast(&ss.ready);
+	pthread_mutex_unlock(&ss.lock);
+	for(size_t i = 0; i < workers; i++) pthread_join(threads[i], NULL);
+	free(threads);
+	for(size_t i = 0; i < ss.connection_count; i++) _close(ss.connections[i]);
+	free(ss.connections);
+	close(ss.wake[0]);
+	close(ss.wake[1]);
+	errno = error;
+}
+
+int server_connect(const char *socket_path) {
+	struct sockaddr_un address;
+	if(!_address(&address, socket_path)) return -1;
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd < 0) return -1;
+	if(connect(fd, (struct sockaddr *) &address, sizeof(address))) {
+		int error = errno;
+		close(fd);
+		errno = error;
+		return -1;
+	}
+	return fd;
+}
+
+bool server_send(int fd, const server_request_t *request) {
+	// everything up to the source goes out as one block
+	size_t size = sizeof(uint32_t) + sizeof(uint64_t);
+	for(size_t i = 0; i < request->arg_count; i++) size += sizeof(uint32_t) + strlen(request->args[i]);
+	char *message = (char *) malloc(size);
+	error_if(message == NULL);
+
+	char *cursor = message;
+	uint32_t count = (uint32_t) request->arg_count;
+	memcpy(cursor, &count, sizeof(count)), cursor += sizeof(count);
+	for(size_t i = 0; i < request->arg_count; i++) {
+		uint32_t length = (uint32_t) strlen(request->args[i]);
+		memcpy(cursor, &length, sizeof(length)), cursor += sizeof(length);
+		memcpy(cursor, request->args[i], length), cursor += length;
+	}
+	uint64_t source_size = request->source.string ? request->source.size - 1 : SERVER_NO_SOURCE;
+	memcpy(cursor, &source_size, sizeof(source_size));
+
+	struct iovec blocks[] = {
+		{ .iov_base = message, .iov_len = size },
+		{ .iov_base = request->source.string, .iov_len = request->source.string ? source_size : 0 }
+	};
+	bool sent = _send(fd, blocks, 2);
+	free(message);
+	return sent;
+}
+
+bool server_receive(int fd, server_response_t *response) {
+	*response = (server_response_t) { .status = EXIT_FAILURE, .out = EMPTY_STRING, .errors = EMPTY_STRING };
+	response_header_t header;
+	if(!_read_exact(fd, &header, sizeof(header))) return false;
+	response->status = header.status;
+	response->out = (string_t) { .size = header.out_size, .string = malloc(header.out_size + 1) };
+	response->errors = (string_t) { .size = header.error_size, .string = malloc(header.error_size + 1) };
+	error_if(response->out.string == NULL || response->errors.string == NULL);
+	if(_read_exact(fd, response->out.string, header.out_size)
+		&& _read_exact(fd, response->errors.string, header.error_size)) return true;
+	server_response_free(response);
+	return false;
+}
+
+void server_response_free(server_response_t *response) {
+	free(response->out.string);
+	free(response->errors.string);
+	response->out = response->errors = EMPTY_STRING;
+}
@@ -0,0 +1,593 @@
+#include "bytecode.h"
+
+#include "common/array.h"
+#include "common/io.h"
+#include "lower/lower.h"
+
+#include <inttypes.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Register operand standing in for a value that isn't needed
+#define NO_REG UINT32_MAX
+// End of a list of jumps that still need their target
+#define NO_JUMP SIZE_MAX
+
+const char *opcode_strs[] = {
+	FOREACH_OPCODE(GENERATE_OPCODE_STRS)
+};
+
+// Every thread that compiles has its own state
+static __thread struct compiler_state {
+	/// Where errors go and which variables are in scope.
+	lower_t lower;
+	bytecode_t *code;
+	const native_t *natives;
+	size_t native_count;
+
+	/// Registers are allocated like a stack, locals below temporaries.
+	uint32_t free_reg;
+	/// Open addressing table of indices + 1 into the constants by value.
+	uint32_t *constant_slots;
+	size_t slot_capacity;
+} cs;
+
+// Internal Functions //
+
+static size_t _emit(uint64_t instruction) {
+	bytecode_t *code = cs.code;
+	if(code->count == code->capacity) {
+		// jumps have to reach across the whole program
+		if(code->count >= INT32_MAX) lower_error(&cs.lower, "Program too large\n");
+		code->code = array_grow(code->code, &code->capacity, sizeof(uint64_t));
+	}
+	code->code[code->count] = instruction;
+	return code->count++;
+}
+
+static uint32_t _alloc_reg(void) {
+	// temporaries grow upwards and constants downwards
+	if(cs.free_reg + cs.code->constant_count >= BC_MAX_REGISTERS) {
+		lower_error(&cs.lower, "Too many registers\n");
+	}
+	uint32_t reg = cs.free_reg++;
+	if(cs.free_reg > cs.code->registers) cs.code->registers = cs.free_reg;
+	return reg;
+}
+
+static size_t _constant_slot(int64_t value) {
+	size_t mask = cs.slot_capacity - 1;
+	size_t slot = (size_t) ((uint64_t) value * 0x9E3779B97F4A7C15ull >> 32) & mask;
+	while(cs.constant_slots[slot] && cs.code->constants[cs.constant_slots[slot] - 1] != value) {
+		slot = (slot + 1) & mask;
+	}
+	return slot;
+}
+
+// Returns the register of a constant, adding it if it's new
+static uint32_t _constant(int64_t value) {
+	bytecode_t *code = cs.code;
+	if(code->constant_count * 2 >= cs.slot_capacity) {
+		free(cs.constant_slots);
+		cs.slot_capacity = cs.slot_capacity ? cs.slot_capacity * 2 : 64;
+		cs.constant_slots = (uint32_t *) calloc(cs.slot_capacity, sizeof(uint32_t));
+		error_if(cs.constant_slots == NULL);
+		for(size_t k = 0; k < code->constant_count; k++) {
+			cs.constant_slots[_constant_slot(code->constants[k])] = k + 1;
+		}
+	}
+	size_t slot = _constant_slot(value);
+	if(cs.constant_slots[slot]) return BC_K(cs.constant_slots[slot] - 1);
+
+	if(cs.free_reg + code->constant_count >= BC_MAX_REGISTERS) {
+		lower_error(&cs.lower, "Too many registers\n");
+	}
+	if(code->constant_count == code->constant_capacity) {
+		code->constants = array_grow(code->constants, &code->constant_capacity, sizeof(int64_t));
+	}
+	code->constants[code->constant_count] = value;
+	cs.constant_slots[slot] = ++code->constant_count;
+	return BC_K(code->constant_count - 1);
+}
+
+static void _load_number(uint32_t reg, int64_t value) {
+	if(value >= INT32_MIN && value <= INT32_MAX) _emit(BC_ENCODE_BX(BC_LOADI, reg, value));
+	else _emit(BC_ENCODE(BC_MOVE, reg, _constant(value), 0));
+}
+
+/** Emits a jump whose target is set later. Jumps without a target yet are
+  * chained into lists through their sBx operand, which holds the index of
+  * the next jump of the list until then.
+  * @param op The kind of jump.
+  * @param reg The register a conditional jump tests.
+  * @param list The list to add the jump to.
+  * @return The list with the jump at its head.
+  */
+static size_t _emit_jump(opcode_t op, uint32_t reg, size_t list) {
+	return _emit(BC_ENCODE_BX(op, reg == NO_REG ? 0 : reg, list == NO_JUMP ? -1 : (int32_t) list));
+}
+
+static size_t _next_jump(size_t jump) {
+	int32_t next = BC_SBX(cs.code->code[jump]);
+	return next < 0 ? NO_JUMP : (size_t) next;
+}
+
+static void _patch(size_t list, size_t target) {
+	uint64_t *code = cs.code->code;
+	while(list != NO_JUMP) {
+		size_t next = _next_jump(list);
+		int32_t offset = (int32_t) target - (int32_t) (list + 1);
+		code[list] = BC_ENCODE_BX(BC_OP(code[list]), BC_A(code[list]), offset);
+		list = next;
+	}
+}
+
+// Reads a literal number, negated if asked to, that fits into an sC operand
+static bool _immediate(const Node *node, bool negate, int64_t *value) {
+	if(!lower_literal(node, value)) return false;
+	if(negate) *value = (int64_t) (0 - (uint64_t) *value);
+	return *value >= INT16_MIN && *value <= INT16_MAX;
+}
+
+static value_type_t _expr(Node *node, uint32_t dst);
+
+// Returns a register holding the value of the node, compiling it into a
+// new temporary unless it's a variable or a literal
+static uint32_t _operand(Node *node, value_type_t *type) {
+	int64_t value;
+	if(lower_literal(node, &value)) {
+		if(type) *type = VALUE_NUMBER;
+		return _constant(value);
+	}
+	if(node->type == NODE_IDENT) {
+		const lower_var_t *var = lower_lookup(&cs.lower, (IdentNode *) node);
+		if(type) *type = var->type;
+		return var->reg;
+	}
+	uint32_t reg = _alloc_reg();
+	value_type_t result = _expr(node, reg);
+	if(type) *type = result;
+	return reg;
+}
+
+static void _jump(size_t *list) {
+	*list = _emit_jump(BC_JMP, NO_REG, *list);
+}
+
+static void _test(Node *node, bool when, size_t *list) {
+	uint32_t base = cs.free_reg;
+	uint32_t reg = _operand(node, NULL);
+	cs.free_reg = base;
+	*list = _emit_jump(when ? BC_JMPT : BC_JMPF, reg, *list);
+}
+
+static size_t _new_list(void) {
+	return NO_JUMP;
+}
+
+static void _patch_here(size_t list) {
+	_patch(list, cs.code->count);
+}
+
+// Jumps of conditions go into lists that are patched once their target is known
+static const lower_jumps_t jumps = {
+	.jump = _jump, .test = _test, .new_target = _new_list, .place = _patch_here
+};
+
+// Compiles a condition into jumps that are taken if it has the given truth
+// value, returns the list of jumps taken
+static size_t _branch(Node *node, bool when) {
+	size_t list = NO_JUMP;
+	lower_branch(&jumps, node, when, &list);
+	return list;
+}
+
+static value_type_t _assign(BinaryOpNode *node, uint32_t dst) {
+	if(node->left->type != NODE_IDENT) lower_error(&cs.lower, "Can only assign to variables\n");
+	// a copy, as the right side may declare variables and move the others
+	lower_var_t var = *lower_lookup(&cs.lower, (IdentNode *) node->left);
+	uint32_t base = cs.free_reg;
+	int64_t value;
+	bool checked = false;
+
+	if(node->op == OP_ASSIGN) {
+		checked = node->right->type == NODE_NUMBER;
+		if(lower_writes_late(node->right)) {
+			_expr(node->right, var.reg);
+		} else {
+			uint32_t reg = _alloc_reg();
+			_expr(node->right, reg);
+			_emit(BC_ENCODE(BC_MOVE, var.reg, reg, 0));
+		}
+	} else if((node->op == OP_ASSIGN_ADD || node->op == OP_ASSIGN_SUB)
+		&& _immediate(node->right, node->op == OP_ASSIGN_SUB, &value)) {
+		checked = value >= 0;
+		_emit(BC_ENCODE(BC_ADDI, var.reg, var.reg, value));
+	} else {
+		static const opcode_t ops[] = { BC_ADD, BC_SUB, BC_MUL, BC_DIV, BC_MOD };
+		// the variable is read after the value is evaluated
+		uint32_t reg = _operand(node->right, NULL);
+		_emit(BC_ENCODE(ops[node->op - OP_ASSIGN_ADD], var.reg, var.reg, reg));
+	}
+	cs.free_reg = base;
+
+	if(var.nat && !checked) _emit(BC_ENCODE(BC_CHECKNAT, var.reg, 0, 0));
+	if(dst != NO_REG && dst != var.reg) _emit(BC_ENCODE(BC_MOVE, dst, var.reg, 0));
+	return var.type;
+}
+
+// Puts both operands of a binary operation into registers, left first
+static void _operands(BinaryOpNode *node, uint32_t *left, uint32_t *right) {
+	if(lower_copies_left(node)) {
+		// a variable on the left is copied in case the right side changes it
+		*left = _alloc_reg();
+		_expr(node->left, *left);
+	} else *left = _operand(node->left, NULL);
+	*right = _operand(node->right, NULL);
+}
+
+// Whether an addition or subtraction of a literal becomes a single ADDI
+static bool _adds_immediate(const BinaryOpNode *node, int64_t *value) {
+	return (node->op == OP_ADD || node->op == OP_SUB) && _immediate(node->right, node->op == OP_SUB, value);
+}
+
+// Compiles an arithmetic operation or comparison whose left operand is in a
+// register already, the right one is evaluated after it
+static value_type_t _operate(BinaryOpNode *node, uint32_t target, uint32_t left) {
+	int64_t value;
+	if(_adds_immediate(node, &value)) {
+		_emit(BC_ENCODE(BC_ADDI, target, left, value));
+		return VALUE_NUMBER;
+	}
+	uint32_t right = _operand(node->right, NULL);
+	opcode_t op = BC_ADD;
+	value_type_t type = VALUE_BOOL;
+	bool swap = false;
+	switch(node->op) {
+		case OP_EQ: op = BC_EQ; break;
+		case OP_NE: op = BC_NE; break;
+		case OP_LT: op = BC_LT; break;
+		case OP_LE: op = BC_LE; break;
+		// greater is less with the operands swapped
+		case OP_GT: op = BC_LT, swap = true; break;
+		case OP_GE: op = BC_LE, swap = true; break;
+		case OP_ADD: op = BC_ADD, type = VALUE_NUMBER; break;
+		case OP_SUB: op = BC_SUB, type = VALUE_NUMBER; break;
+		case OP_MUL: op = BC_MUL, type = VALUE_NUMBER; break;
+		case OP_DIV: op = BC_DIV, type = VALUE_NUMBER; break;
+		case OP_MOD: op = BC_MOD, type = VALUE_NUMBER; break;
+		default: break;
+	}
+	_emit(swap ? BC_ENCODE(op, target, right, left) : BC_ENCODE(op, target, left, right));
+	return type;
+}
+
+static value_type_t _binary_op(BinaryOpNode *node, uint32_t dst) {
+	if(node->op <= OP_ASSIGN_MOD) return _assign(node, dst);
+	uint32_t base = cs.free_reg;
+	uint32_t target = dst != NO_REG ? dst : _alloc_reg();
+	// a chain like `a + b - c` is compiled from its innermost operation out
+	NodeStack *chain = &cs.lower.chain;
+	size_t outer = chain->size;
+	lower_push_chain(&cs.lower, node);
+	BinaryOpNode *inner = (BinaryOpNode *) chain->nodes[chain->size - 1];
+	value_type_t type;
+
+	if(node->op == OP_AND || node->op == OP_OR) {
+		// the value of the operand that decided it is the result
+		type = _expr(inner->left, target);
+		for(size_t i = chain->size; i-- > outer;) {
+			BinaryOpNode *logical = (BinaryOpNode *) chain->nodes[i];
+			size_t skip = _emit_jump(logical->op == OP_AND ? BC_JMPF : BC_JMPT, target, NO_JUMP);
+			_expr(logical->right, target);
+			_patch(skip, cs.code->count);
+		}
+		chain->size = outer;
+		cs.free_reg = base;
+		return type;
+	}
+
+	int64_t value;
+	uint32_t left;
+	if(lower_copies_left(inner) && !_adds_immediate(inner, &value)) {
+		// a variable on the left is copied in case the right side changes it
+		left = _alloc_reg();
+		_expr(inner->left, left);
+	} else left = _operand(inner->left, NULL);
+	// the operations inside the outermost one keep their value in a
+	// temporary, as the target may be a variable that the chain reads
+	uint32_t partial = chain->size - outer > 1 ? _alloc_reg() : target;
+	for(size_t i = chain->size; i-- > outer;) {
+		uint32_t temporaries = cs.free_reg;
+		type = _operate((BinaryOpNode *) chain->nodes[i], i == outer ? target : partial, left);
+		cs.free_reg = temporaries;
+		left = partial;
+	}
+	chain->size = outer;
+	cs.free_reg = base;
+	return type;
+}
+
+static value_type_t _call(CallNode *node, uint32_t dst) {
+	size_t native = 0;
+	while(native < cs.native_count && (strlen(cs.natives[native].name) != node->name.size
+		|| memcmp(cs.natives[native].name, node->name.string, node->name.size))) native++;
+	if(native == cs.native_count) {
+		lower_error(&cs.lower, "Unknown function %.*s\n", (int) node->name.size, node->name.string);
+	}
+	const native_t *fn = &cs.natives[native];
+	if(fn->arity >= 0 && (size_t) fn->arity != node->size) {
+		lower_error(&cs.lower, "%s takes %d arguments but got %zu\n", fn->name, fn->arity, node->size);
+	}
+
+	bytecode_t *code = cs.code;
+	if(code->call_count == code->call_capacity) {
+		code->calls = array_grow(code->calls, &code->call_capacity, sizeof(call_site_t));
+	}
+	size_t site = code->call_count++;
+	code->calls[site] = (call_site_t) {
+		.native = native, .count = node->size, .types = code->type_count
+	};
+	// the types are reserved up front, as arguments may contain calls too
+	while(code->type_count + node->size > code->type_capacity) {
+		code->types = array_grow(code->types, &code->type_capacity, sizeof(uint8_t));
+	}
+	code->type_count += node->size;
+
+	// arguments go into consecutive registers, the first one takes the result
+	uint32_t base = cs.free_reg;
+	if(node->size == 0) _alloc_reg();
+	for(size_t i = 0; i < node->size; i++) {
+		uint32_t reg = _alloc_reg();
+		value_type_t type = _expr(((Node **) node->args)[i], reg);
+		code->types[code->calls[site].types + i] = (uint8_t) type;
+	}
+	_emit(BC_ENCODE_BX(BC_CALL, base, site));
+	if(dst != NO_REG && dst != base) _emit(BC_ENCODE(BC_MOVE, dst, base, 0));
+	cs.free_reg = base;
+	return fn->result;
+}
+
+static value_type_t _var(VarNode *node, uint32_t dst) {
+	// the variable only comes into scope after its value
+	uint32_t reg = _alloc_reg();
+	_expr(node->value, reg);
+	bool nat = node->var_type == TOK_TYPE_NAT;
+	if(nat && node->value->type != NODE_NUMBER) _emit(BC_ENCODE(BC_CHECKNAT, reg, 0, 0));
+
+	value_type_t type = node->var_type == TOK_TYPE_BOOL ? VALUE_BOOL : VALUE_NUMBER;
+	lower_declare(&cs.lower, (lower_var_t) {
+		.name = node->name, .symbol = node->symbol, .reg = reg, .type = type, .nat = nat
+	});
+	if(dst != NO_REG) _emit(BC_ENCODE(BC_MOVE, dst, reg, 0));
+	return type;
+}
+
+static value_type_t _block(BlockNode *node, uint32_t dst) {
+	size_t var_count = cs.lower.var_count;
+	uint32_t base = cs.free_reg;
+	value_type_t type = VALUE_NIL;
+	if(node->size == 0 && dst != NO_REG) _emit(BC_ENCODE_BX(BC_LOADI, dst, 0));
+	for(size_t i = 0; i < node->size; i++) {
+		bool last = i + 1 == node->size;
+		type = _expr(((Node **) node->children)[i], last ? dst : NO_REG);
+	}
+	lower_leave_scope(&cs.lower, var_count);
+	cs.free_reg = base;
+	return type;
+}
+
+static value_type_t _if(IfNode *node, uint32_t dst) {
+	size_t otherwise = _branch(node->condition, false);
+	value_type_t type = _expr(node->then, dst);
+	if(!node->otherwise && dst == NO_REG) {
+		_patch(otherwise, cs.code->count);
+		return type;
+	}
+	size_t end = _emit_jump(BC_JMP, NO_REG, NO_JUMP);
+	_patch(otherwise, cs.code->count);
+	if(node->otherwise) _expr(node->otherwise, dst);
+	else _emit(BC_ENCODE_BX(BC_LOADI, dst, 0));
+	_patch(end, cs.code->count);
+	return type;
+}
+
+/** Compiles a comparison into a single instruction that jumps back to the
+  * start of a loop if it holds.
+  * @param node The condition of the loop.
+  * @param target Where the loop starts.
+  * @return Whether the condition is a comparison close enough to the target.
+  */
+static bool _compare_jump(Node *node, size_t target) {
+	if(node->type != NODE_BINARY_OP) return false;
+	BinaryOpNode *compare = (BinaryOpNode *) node;
+	if(compare->op < OP_EQ || compare->op > OP_GE) return false;
+	// greater is less with the operands swapped
+	static const opcode_t ops[] = { BC_JEQ, BC_JNE, BC_JLT, BC_JLE, BC_JLT, BC_JLE };
+	bool swap = compare->op == OP_GT || compare->op == OP_GE;
+
+	uint32_t base = cs.free_reg, left, right;
+	_operands(compare, &left, &right);
+	cs.free_reg = base;
+	int64_t offset = (int64_t) target - (int64_t) (cs.code->count + 1);
+	if(offset < INT16_MIN) {
+		uint32_t reg = _alloc_reg();
+		cs.free_reg = base;
+		static const opcode_t values[] = { BC_EQ, BC_NE, BC_LT, BC_LE, BC_LT, BC_LE };
+		opcode_t op = values[compare->op - OP_EQ];
+		_emit(swap ? BC_ENCODE(op, reg, right, left) : BC_ENCODE(op, reg, left, right));
+		_patch(_emit_jump(BC_JMPT, reg, NO_JUMP), target);
+		return true;
+	}
+	opcode_t op = ops[compare->op - OP_EQ];
+	_emit(swap ? BC_ENCODE(op, offset, right, left) : BC_ENCODE(op, offset, left, right));
+	return true;
+}
+
+static value_type_t _while(WhileNode *node, uint32_t dst) {
+	// the condition goes last so that every iteration takes a single jump
+	size_t test = _emit_jump(BC_JMP, NO_REG, NO_JUMP);
+	size_t body = cs.code->count;
+	_expr(node->body, NO_REG);
+	_patch(test, cs.code->count);
+	if(!_compare_jump(node->condition, body)) _patch(_branch(node->condition, true), body);
+	if(dst != NO_REG) _emit(BC_ENCODE_BX(BC_LOADI, dst, 0));
+	return VALUE_NIL;
+}
+
+/** Compiles a node into the instructions that compute its value.
+  * @param node The node to compile.
+  * @param dst The register to store the value in or NO_REG if it's unused.
+  * @return The type of the value.
+  */
+static value_type_t _expr(Node *node, uint32_t dst) {
+	switch(node->type) {
+		case NODE_NUMBER:
+			if(dst != NO_REG) _load_number(dst, (int64_t) ((NumberNode *) node)->value);
+			return VALUE_NUMBER;
+		case NODE_BOOL:
+			if(dst != NO_REG) _emit(BC_ENCODE_BX(BC_LOADI, dst, ((BoolNode *) node)->value));
+			return VALUE_BOOL;
+		case NODE_NIL:
+			if(dst != NO_REG) _emit(BC_ENCODE_BX(BC_LOADI, dst, 0));
+			return VALUE_NIL;
+		case NODE_IDENT: {
+			const lower_var_t *var = lower_lookup(&cs.lower, (IdentNode *) node);
+			if(dst != NO_REG && dst != var->reg) _emit(BC_ENCODE(BC_MOVE, dst, var->reg, 0));
+			return var->type;
+		}
+		case NODE_UNARY_OP: {
+			UnaryOpNode *unary_op = (UnaryOpNode *) node;
+			int64_t value;
+			if(unary_op->op == OP_POS) return _expr(unary_op->operand, dst);
+			if(lower_literal(node, &value)) {
+				if(dst != NO_REG) _load_number(dst, value);
+				return VALUE_NUMBER;
+			}
+			uint32_t base = cs.free_reg;
+			uint32_t reg = _operand(unary_op->operand, NULL);
+			bool negate = unary_op->op == OP_NEG;
+			if(dst != NO_REG) _emit(BC_ENCODE(negate ? BC_NEG : BC_NOT, dst, reg, 0));
+			cs.free_reg = base;
+			return negate ? VALUE_NUMBER : VALUE_BOOL;
+		}
+		case NODE_BINARY_OP:
+			return _binary_op((BinaryOpNode *) node, dst);
+		case NODE_CALL:
+			return _call((CallNode *) node, dst);
+		case NODE_VAR:
+			return _var((VarNode *) node, dst);
+		case NODE_BLOCK:
+			return _block((BlockNode *) node, dst);
+		case NODE_IF:
+			return _if((IfNode *) node, dst);
+		case NODE_WHILE:
+			return _while((WhileNode *) node, dst);
+		case NODE_RETURN: {
+			uint32_t base = cs.free_reg;
+			_emit(BC_ENCODE(BC_RETURN, _operand(((ReturnNode *) node)->value, NULL), 0, 0));
+			cs.free_reg = base;
+			return VALUE_NIL;
+		}
+	}
+	return VALUE_NIL;
+}
+
+// Prints a register operand, constants as their value
+static void _print_reg(FILE *out, const bytecode_t *code, uint16_t reg, const char *end) {
+	if(reg >= BC_K(code->constant_count) + 1) fprintf(out, "#%" PRId64 "%s", code->constants[BC_K(reg)], end);
+	else fprintf(out, "r%u%s", reg, end);
+}
+
+// External Functions //
+
+bool bytecode_compile(
+	Node *ast, const native_t *natives, size_t native_count, FILE *errors, bytecode_t *code
+) {
+	*code = (bytecode_t) { .code = NULL, .count = 0, .capacity = 0 };
+	cs = (struct compiler_state) {
+		.lower = {
+			.errors = errors,
+			.vars = NULL, .var_count = 0, .var_capacity = 0, .bindings = NULL, .binding_capacity = 0
+		},
+		.code = code, .natives = natives, .native_count = native_count,
+		.free_reg = 0,
+		.constant_slots = NULL, .slot_capacity = 0
+	};
+	if(setjmp(cs.lower.fail)) {
+		lower_free(&cs.lower);
+		free(cs.constant_slots);
+		bytecode_free(code);
+		return false;
+	}
+	// a program that doesn't return returns nil
+	uint32_t result = _alloc_reg();
+	_expr(ast, NO_REG);
+	_emit(BC_ENCODE_BX(BC_LOADI, result, 0));
+	_emit(BC_ENCODE(BC_RETURN, result, 0, 0));
+	lower_free(&cs.lower);
+	free(cs.constant_slots);
+	return true;
+}
+
+void bytecode_print(const bytecode_t *code, FILE *out) {
+	static const char *type_names[] = { "number", "bool", "nil" };
+	for(size_t i = 0; i < code->count; i++) {
+		uint64_t instruction = code->code[i];
+		opcode_t op = BC_OP(instruction);
+		fprintf(out, "%6zu  %-8s ", i, opcode_strs[op]);
+		switch(op) {
+			case BC_MOVE: case BC_NEG: case BC_NOT:
+				_print_reg(out, code, BC_A(instruction), " ");
+				_print_reg(out, code, BC_B(instruction), "\n");
+				break;
+			case BC_LOADI:
+				fprintf(out, "r%u %" PRId32 "\n", BC_A(instruction), BC_SBX(instruction));
+				break;
+			case BC_ADDI:
+				fprintf(out, "r%u ", BC_A(instruction));
+				_print_reg(out, code, BC_B(instruction), "");
+				fprintf(out, " %d\n", BC_SC(instruction));
+				break;
+			case BC_JMP:
+				fprintf(out, "-> %zu\n", i + 1 + BC_SBX(instruction));
+				break;
+			case BC_JMPF: case BC_JMPT:
+				_print_reg(out, code, BC_A(instruction), "");
+				fprintf(out, " -> %zu\n", i + 1 + BC_SBX(instruction));
+				break;
+			case BC_JEQ: case BC_JNE: case BC_JLT: case BC_JLE:
+				_print_reg(out, code, BC_B(instruction), " ");
+				_print_reg(out, code, BC_C(instruction), "");
+				fprintf(out, " -> %zu\n", i + 1 + BC_SA(instruction));
+				break;
+			case BC_CHECKNAT: case BC_RETURN:
+				_print_reg(out, code, BC_A(instruction), "\n");
+				break;
+			case BC_CALL: {
+				const call_site_t *site = &code->calls[BC_BX(instruction)];
+				fprintf(out, "r%u #%" PRIu32 " (", BC_A(instruction), site->native);
+				for(uint32_t arg = 0; arg < site->count; arg++) {
+					fprintf(out, "%s%s", arg ? ", " : "", type_names[code->types[site->types + arg]]);
+				}
+				fprintf(out, ")\n");
+				break;
+			}
+			default:
+				_print_reg(out, code, BC_A(instruction), " ");
+				_print_reg(out, code, BC_B(instruction), " ");
+				_print_reg(out, code, BC_C(instruction), "\n");
+				break;
+		}
+	}
+}
+
+void bytecode_free(bytecode_t *code) {
+	free(code->code);
+	free(code->constants);
+	free(code->calls);
+	free(code->types);
+	*code = (bytecode_t) { .code = NULL, .count = 0, .capacity = 0 };
+}
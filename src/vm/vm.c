@@ -0,0 +1,187 @@
+#define _POSIX_C_SOURCE 200809L // clock_gettime
+
+#include "vm.h"
+#include "bytecode.h"
+
+#include "common/io.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Jumping straight from one handler to the next through a table of label
+// addresses lets the branch predictor learn every handler's successors on its
+// own, which a single `switch` jump can't. Define VM_NO_COMPUTED_GOTO to use
+// the portable `switch` even if the compiler supports them.
+#if defined(__GNUC__) && !defined(VM_NO_COMPUTED_GOTO)
+#define VM_COMPUTED_GOTO 1
+#else
+#define VM_COMPUTED_GOTO 0
+#endif
+
+// Backward jumps a program takes between looking at the clock, which is the
+// only way it runs for long since it has no calls of its own
+#define VM_CHECK_JUMPS 65536
+
+// How long a program may run in nanoseconds, 0 if it has no limit
+static uint64_t time_limit = 0;
+
+// The streams of the program running on this thread, which natives use
+static __thread struct vm_streams {
+	FILE *out;
+	FILE *errors;
+} vs;
+
+// Internal Functions //
+
+static uint64_t _now(void) {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (uint64_t) time.tv_sec * 1000000000 + (uint64_t) time.tv_nsec;
+}
+
+static bool _print(int64_t *result, const int64_t *args, size_t count, const uint8_t *types) {
+	for(size_t i = 0; i < count; i++) {
+		if(i) putc(' ', vs.out);
+		switch((value_type_t) types[i]) {
+			case VALUE_NUMBER: fprintf(vs.out, "%" PRId64, args[i]); break;
+			case VALUE_BOOL: fputs(args[i] ? "true" : "false", vs.out); break;
+			case VALUE_NIL: fputs("nil", vs.out); break;
+		}
+	}
+	putc('\n', vs.out);
+	*result = 0;
+	return true;
+}
+
+static bool _assert(int64_t *result, const int64_t *args, size_t count, const uint8_t *types) {
+	(void) count, (void) types;
+	bool holds = args[0] != 0;
+	if(!holds) fprintf(vs.errors, "Assertion failed\n");
+	*result = 0;
+	return holds;
+}
+
+// External Functions //
+
+const native_t vm_natives[] = {
+	{ .name = "print", .arity = -1, .result = VALUE_NIL, .fn = _print },
+	{ .name = "assert", .arity = 1, .result = VALUE_NIL, .fn = _assert }
+};
+const size_t vm_native_count = sizeof(vm_natives) / sizeof(*vm_natives);
+
+void vm_set_time_limit(uint32_t milliseconds) {
+	time_limit = (uint64_t) milliseconds * 1000000;
+}
+
+bool vm_run(const bytecode_t *code, FILE *out, FILE *errors, int64_t *result) {
+	vs = (struct vm_streams) { .out = out, .errors = errors };
+	// registers between the temporaries and the constants are never touched,
+	// so the pages they'd take aren't even mapped in
+	int64_t *regs = (int64_t *) calloc(BC_MAX_REGISTERS, sizeof(int64_t));
+	error_if(regs == NULL);
+	for(size_t k = 0; k < code->constant_count; k++) regs[BC_K(k)] = code->constants[k];
+	const uint64_t *ip = code->code;
+	uint64_t i;
+	bool ok = false;
+	uint64_t deadline = time_limit ? _now() + time_limit : 0;
+	uint32_t jumps_left = VM_CHECK_JUMPS;
+
+#define R(x) regs[x]
+#define RA R(BC_A(i))
+#define RB R(BC_B(i))
+#define RC R(BC_C(i))
+// arithmetic wraps around through unsigned integers like constant folding
+#define WRAP(a, op, b) ((int64_t) ((uint64_t) (a) op (uint64_t) (b)))
+// only loops jump backward, so only they can keep a program from ending
+#define JUMP(offset) do { \
+		int32_t jump_offset = (offset); \
+		ip += jump_offset; \
+		if(jump_offset < 0 && --jumps_left == 0) { \
+			if(deadline && _now() >= deadline) goto out_of_time; \
+			jumps_left = VM_CHECK_JUMPS; \
+		} \
+	} while(0)
+
+#if VM_COMPUTED_GOTO
+#define GENERATE_OPCODE_LABELS(NAME) __extension__ &&op_##NAME,
+	static const void *labels[] = { FOREACH_OPCODE(GENERATE_OPCODE_LABELS) };
+#define CASE(NAME) op_##NAME:
+#define DISPATCH() __extension__ ({ i = *ip++; goto *labels[BC_OP(i)]; })
+	DISPATCH();
+#else
+#define CASE(NAME) case BC_##NAME:
+#define DISPATCH() continue
+	while(true) switch(BC_OP(i = *ip++)) {
+#endif
+
+	CASE(MOVE) RA = RB; DISPATCH();
+	CASE(LOADI) RA = BC_SBX(i); DISPATCH();
+	CASE(ADD) RA = WRAP(RB, +, RC); DISPATCH();
+	CASE(ADDI) RA = WRAP(RB, +, BC_SC(i)); DISPATCH();
+	CASE(SUB) RA = WRAP(RB, -, RC); DISPATCH();
+	CASE(MUL) RA = WRAP(RB, *, RC); DISPATCH();
+	CASE(DIV)
+		if(RC == 0) goto division_by_zero;
+		// the only quotient that overflows is INT64_MIN / -1
+		RA = RC == -1 ? WRAP(0, -, RB) : RB / RC;
+		DISPATCH();
+	CASE(MOD)
+		if(RC == 0) goto division_by_zero;
+		RA = RC == -1 ? 0 : RB % RC;
+		DISPATCH();
+	CASE(NEG) RA = WRAP(0, -, RB); DISPATCH();
+	CASE(NOT) RA = !RB; DISPATCH();
+	CASE(EQ) RA = RB == RC; DISPATCH();
+	CASE(NE) RA = RB != RC; DISPATCH();
+	CASE(LT) RA = RB < RC; DISPATCH();
+	CASE(LE) RA = RB <= RC; DISPATCH();
+	CASE(JMP) JUMP(BC_SBX(i)); DISPATCH();
+	CASE(JMPF) if(!RA) JUMP(BC_SBX(i)); DISPATCH();
+	CASE(JMPT) if(RA) JUMP(BC_SBX(i)); DISPATCH();
+	CASE(JEQ) if(RB == RC) JUMP(BC_SA(i)); DISPATCH();
+	CASE(JNE) if(RB != RC) JUMP(BC_SA(i)); DISPATCH();
+	CASE(JLT) if(RB < RC) JUMP(BC_SA(i)); DISPATCH();
+	CASE(JLE) if(RB <= RC) JUMP(BC_SA(i)); DISPATCH();
+	CASE(CHECKNAT)
+		if(RA < 0) {
+			fprintf(errors, "Negative value for nat\n");
+			goto done;
+		}
+		DISPATCH();
+	CASE(CALL) {
+		const call_site_t *site = &code->calls[BC_BX(i)];
+		int64_t *args = &RA;
+		if(!vm_natives[site->native].fn(args, args, site->count, &code->types[site->types])) goto done;
+		DISPATCH();
+	}
+	CASE(RETURN)
+		*result = RA;
+		ok = true;
+		goto done;
+
+#if !VM_COMPUTED_GOTO
+		default:
+			goto done;
+	}
+#endif
+
+#undef DISPATCH
+#undef CASE
+#undef JUMP
+#undef WRAP
+#undef RC
+#undef RB
+#undef RA
+#undef R
+
+division_by_zero:
+	fprintf(errors, "Division by zero\n");
+	goto done;
+out_of_time:
+	fprintf(errors, "Program ran out of time\n");
+done:
+	free(regs);
+	return ok;
+}
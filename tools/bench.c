@@ -0,0 +1,408 @@
+// Measures the throughput of the lexer, the parser and the arena on programs
+// from a deterministic generator. Built and run by `build.sh bench`, which
+// links it against the compiler's objects. Every result is printed as one
+// line of JSON, so runs can be compared by scripts:
+//   bench [--shape NAME]... [--size BYTES] [--seed N] [--repeat N]
+//         [--threads N] [--arena-ops N] [--retain BYTES] [--generate]
+// The shapes of the generated programs are:
+//   mixed    - a bit of everything, like ordinary code
+//   deep     - blocks and parentheses nested dozens of levels deep
+//   long     - statements that are single expressions of thousands of terms
+//   comments - line and block comments making up most of the text
+//   idents   - long identifiers that are all different
+// --threads is how many threads lex and how many allocate from the arenas
+// of a group.
+// --retain keeps up to that many bytes of freed arena regions to reuse in
+// the next repetition, like a long running process would.
+// --generate prints the program of the first shape instead of measuring.
+// Every benchmark runs in a process of its own, so that its peak_rss_kb isn't
+// the peak of the ones that ran before it. The parser's run has to lex first,
+// so its peak includes the tokens as well as the tree.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "common/arena.h"
+#include "common/io.h"
+#include "lexer/buffer.h"
+#include "lexer/lexer.h"
+#include "lexer/scan.h"
+#include "parser/flat.h"
+#include "parser/parser.h"
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Same as the parser's, so that allocations are measured like it makes them
+#define ARENA_REGION_SIZE 4096
+#define BENCH_MAX_THREADS 64
+
+typedef enum shape {
+	SHAPE_MIXED,
+	SHAPE_DEEP,
+	SHAPE_LONG,
+	SHAPE_COMMENTS,
+	SHAPE_IDENTS,
+	SHAPE_COUNT
+} shape_t;
+
+static const char *shape_names[] = { "mixed", "deep", "long", "comments", "idents" };
+
+typedef struct generator {
+	char *text;
+	size_t size;
+	size_t capacity;
+	uint64_t state;
+} generator_t;
+
+// Internal Functions //
+
+// splitmix64, which is fast and gives the same sequence everywhere
+static uint64_t _random(generator_t *gen) {
+	uint64_t z = (gen->state += 0x9E3779B97F4A7C15ull);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return z ^ (z >> 31);
+}
+
+static size_t _below(generator_t *gen, size_t bound) {
+	return (size_t) (_random(gen) % bound);
+}
+
+static void _put(generator_t *gen, const char *fmt, ...) {
+	va_list args;
+	while(true) {
+		va_start(args, fmt);
+		int size = vsnprintf(gen->text + gen->size, gen->capacity - gen->size, fmt, args);
+		va_end(args);
+		error_if(size < 0);
+		if(gen->size + size < gen->capacity) {
+			gen->size += size;
+			return;
+		}
+		gen->capacity = gen->capacity ? gen->capacity * 2 : 1 << 16;
+		gen->text = realloc(gen->text, gen->capacity);
+		error_if(gen->text == NULL);
+	}
+}
+
+static void _put_ident(generator_t *gen, size_t count) {
+	_put(gen, "v%zu", _below(gen, count));
+}
+
+static void _put_term(generator_t *gen) {
+	switch(_below(gen, 4)) {
+		case 0: _put(gen, "%zu", 1 + _below(gen, 100000)); break;
+		case 1: _put(gen, "(-%zu)", 1 + _below(gen, 100)); break;
+		default: _put_ident(gen, 16); break;
+	}
+}
+
+static void _put_expr(generator_t *gen, size_t terms) {
+	static const char *ops[] = { "+", "-", "*", "/", "%", "<", "==", "and", "or" };
+	_put_term(gen);
+	for(size_t i = 1; i < terms; i++) {
+		_put(gen, " %s ", ops[_below(gen, sizeof(ops) / sizeof(*ops))]);
+		_put_term(gen);
+	}
+}
+
+// Nests `do` blocks, conditions and parentheses `depth` levels deep
+static void _put_nested(generator_t *gen, size_t depth) {
+	for(size_t i = 0; i < depth; i++) {
+		if(i % 2) _put(gen, "if v%zu < %zu : do\n", i, depth);
+		else _put(gen, "do\n");
+	}
+	_put(gen, "v0 = ");
+	for(size_t i = 0; i < depth; i++) _put(gen, "(v%zu + ", i);
+	_put(gen, "1");
+	for(size_t i = 0; i < depth; i++) _put(gen, ")");
+	_put(gen, ";\n");
+	for(size_t i = 0; i < depth; i++) _put(gen, "end\n");
+}
+
+static void _put_statement(generator_t *gen, shape_t shape) {
+	switch(shape) {
+		case SHAPE_MIXED:
+			switch(_below(gen, 6)) {
+				case 0:
+					_put(gen, "var int v%zu = ", _below(gen, 16));
+					_put_expr(gen, 1 + _below(gen, 6));
+					_put(gen, ";\n");
+					break;
+				case 1:
+					_put(gen, "while v%zu < %zu : do\n  ", _below(gen, 16), _below(gen, 1000));
+					_put_expr(gen, 3);
+					_put(gen, ";\n  v%zu += 1;\nend\n", _below(gen, 16));
+					break;
+				case 2:
+					_put(gen, "if ");
+					_put_expr(gen, 3);
+					_put(gen, " : print(v%zu) elif v%zu : v%zu = 0 else do v1; v2; end\n",
+						_below(gen, 16), _below(gen, 16), _below(gen, 16));
+					break;
+				case 3:
+					_put(gen, "print(");
+					_put_expr(gen, 2);
+					_put(gen, ", v%zu);\n", _below(gen, 16));
+					break;
+				default:
+					_put_ident(gen, 16);
+					_put(gen, " = ");
+					_put_expr(gen, 1 + _below(gen, 8));
+					_put(gen, ";\n");
+					break;
+			}
+			break;
+		case SHAPE_DEEP:
+			_put_nested(gen, 16 + _below(gen, 48));
+			break;
+		case SHAPE_LONG:
+			_put(gen, "v%zu = ", _below(gen, 16));
+			_put_expr(gen, 1000 + _below(gen, 4000));
+			_put(gen, ";\n");
+			break;
+		case SHAPE_COMMENTS:
+			if(_below(gen, 2)) {
+				_put(gen, "// v%zu is left alone by everything below, as long as it's", _below(gen, 16));
+				_put(gen, " not %zu and nothing changes it\n", _below(gen, 1000));
+			} else {
+				_put(gen, "/* The next statement doesn't do much,\n * but it's here all the same");
+				_put(gen, " and keeps a /* stray opening and a * star */\n");
+			}
+			_put_statement(gen, SHAPE_MIXED);
+			break;
+		case SHAPE_IDENTS:
+			_put(gen, "var int ident_%016llx_%08llx = identifier_%016llx + value_%012llx;\n",
+				(unsigned long long) _random(gen), (unsigned long long) (_random(gen) >> 32),
+				(unsigned long long) _random(gen), (unsigned long long) (_random(gen) >> 16));
+			break;
+		case SHAPE_COUNT:
+			break;
+	}
+}
+
+/** Generates a program of the given shape out of whole statements, stopping
+  * after the first one that reaches the size. The same seed always gives the
+  * same program.
+  * @param shape What the statements look like.
+  * @param size The least amount of bytes to generate.
+  * @param seed The start of the random sequence.
+  * @return The null-terminated program, which has to be `free`d.
+  */
+static char *_generate(shape_t shape, size_t size, uint64_t seed) {
+	generator_t gen = { .text = NULL, .size = 0, .capacity = 0, .state = seed };
+	// declares the variables the statements use
+	for(size_t i = 0; i < 64; i++) _put(&gen, "var int v%zu = %zu;\n", i, i);
+	while(gen.size < size) _put_statement(&gen, shape);
+	return gen.text;
+}
+
+static double _now(void) {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+static long _peak_rss_kb(void) {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
+
+/** Measures either the lexer or the parser on a generated program. Parsing
+  * needs the tokens, so the parser's run lexes too, but only the lexer's run
+  * prints the lexer's time.
+  * @param lexer The lexer to load the program with.
+  * @param parse Whether to measure the parser rather than the lexer.
+  */
+static void _bench_frontend(lexer_t *lexer, bool parse, shape_t shape, size_t size, uint64_t seed, size_t repeat) {
+	char *text = _generate(shape, size, seed);
+	char path[] = "/tmp/bench-XXXXXX";
+	int fd = mkstemp(path);
+	error_if(fd < 0);
+	size_t length = strlen(text);
+	error_if(write(fd, text, length) != (ssize_t) length);
+	close(fd);
+	free(text);
+
+	// the best of the repetitions is the one least disturbed by the system
+	double best = 1e300;
+	size_t count = 0;
+	for(size_t run = 0; run < repeat; run++) {
+		error_if(!lexer_load(lexer, path));
+		double start = _now();
+		size_t tokens = 0;
+		while(lexer_next(lexer).type != TOK_EOF) tokens++;
+		double time = _now() - start;
+		count = tokens;
+		if(parse) {
+			arena_t arena = arena_new(ARENA_REGION_SIZE);
+			string_t src = lexer_get_src(lexer);
+			start = _now();
+			Node *ast = parser_parse_tokens(lexer_get_tokens(lexer), src.string, &arena);
+			time = _now() - start;
+			if(!ast) {
+				fprintf(stderr, "The %s program doesn't parse\n", shape_names[shape]);
+				exit(EXIT_FAILURE);
+			}
+			FlatAst flat = flat_from_tree(ast, src.string);
+			count = flat.size;
+			flat_free(&flat);
+			arena_free(&arena);
+		}
+		if(time < best) best = time;
+	}
+	unlink(path);
+
+	if(parse) {
+		printf("{\"bench\":\"parser\",\"shape\":\"%s\",\"bytes\":%zu,\"nodes\":%zu,"
+			"\"seconds\":%.9f,\"nodes_per_sec\":%.0f,\"peak_rss_kb\":%ld}\n",
+			shape_names[shape], length, count, best, count / best, _peak_rss_kb());
+	} else {
+		printf("{\"bench\":\"lexer\",\"shape\":\"%s\",\"bytes\":%zu,\"tokens\":%zu,"
+			"\"seconds\":%.9f,\"tokens_per_sec\":%.0f,\"peak_rss_kb\":%ld}\n",
+			shape_names[shape], length, count, best, count / best, _peak_rss_kb());
+	}
+}
+
+// Work of one thread of the arena benchmark
+typedef struct arena_worker {
+	pthread_t thread;
+	arena_group_t *group;
+	size_t ops;
+} arena_worker_t;
+
+// Allocates blocks of the sizes tree nodes have, a region's worth at a time
+static void *_arena_worker(void *data) {
+	static const size_t sizes[] = { 16, 24, 32, 16, 40, 24, 16, 48 };
+	arena_worker_t *worker = (arena_worker_t *) data;
+	arena_t *arena = arena_join(worker->group);
+	for(size_t i = 0; i < worker->ops; i++) {
+		void *block = arena_alloc(arena, sizes[i % 8]);
+		error_if(block == NULL);
+		// keeps the allocation from being optimized away
+		*(volatile char *) block = (char) i;
+	}
+	arena_leave(worker->group);
+	return NULL;
+}
+
+// Splits the allocations among threads that each have their own arena
+static void _bench_arena(size_t ops, size_t repeat, size_t threads) {
+	arena_worker_t workers[BENCH_MAX_THREADS];
+	if(threads < 1) threads = 1;
+	if(threads > BENCH_MAX_THREADS) threads = BENCH_MAX_THREADS;
+	double best = 1e300;
+	for(size_t run = 0; run < repeat; run++) {
+		arena_group_t group = arena_group_new(ARENA_REGION_SIZE);
+		for(size_t i = 0; i < threads; i++) {
+			workers[i] = (arena_worker_t) { .group = &group, .ops = ops / threads + (i < ops % threads) };
+		}
+		double start = _now();
+		for(size_t i = 1; i < threads; i++) {
+			error_if(pthread_create(&workers[i].thread, NULL, _arena_worker, &workers[i]) != 0);
+		}
+		_arena_worker(&workers[0]);
+		for(size_t i = 1; i < threads; i++) pthread_join(workers[i].thread, NULL);
+		double time = _now() - start;
+		if(time < best) best = time;
+		arena_group_free(&group);
+	}
+	printf("{\"bench\":\"arena_alloc\",\"ops\":%zu,\"threads\":%zu,\"seconds\":%.9f,\"ns_per_op\":%.3f,"
+		"\"peak_rss_kb\":%ld}\n", ops, threads, best, best * 1e9 / ops, _peak_rss_kb());
+}
+
+// Forks a process to run one benchmark in, which is true in the child. The
+// parent waits for it and fails if it did.
+static bool _fork(void) {
+	fflush(stdout);
+	pid_t pid = fork();
+	error_if(pid < 0);
+	if(pid == 0) return true;
+	int status;
+	error_if(waitpid(pid, &status, 0) < 0);
+	if(!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) exit(EXIT_FAILURE);
+	return false;
+}
+
+static void _usage(const char *problem, const char *arg) {
+	fprintf(stderr, "%s %s\n"
+		"usage: bench [--shape NAME]... [--size BYTES] [--seed N] [--repeat N]\n"
+		"             [--threads N] [--arena-ops N] [--retain BYTES] [--generate]\n", problem, arg);
+	exit(EXIT_FAILURE);
+}
+
+// The value after the option at argv[*i], which is skipped
+static const char *_value(int argc, char **argv, int *i) {
+	if(*i + 1 == argc) _usage("Missing a value after", argv[*i]);
+	return argv[++*i];
+}
+
+static shape_t _shape(const char *name) {
+	for(int shape = 0; shape < SHAPE_COUNT; shape++) {
+		if(!strcmp(shape_names[shape], name)) return (shape_t) shape;
+	}
+	_usage("Unknown shape", name);
+	return SHAPE_COUNT;
+}
+
+// External Functions //
+
+int main(int argc, char **argv) {
+	bool shapes[SHAPE_COUNT] = { false }, any_shape = false, generate = false;
+	size_t size = 4 << 20, repeat = 5, threads = 1, arena_ops = 10000000;
+	uint64_t seed = 1;
+	scan_init();
+	for(int i = 1; i < argc; i++) {
+		if(!strcmp(argv[i], "--generate")) generate = true;
+		else if(!strcmp(argv[i], "--shape")) shapes[_shape(_value(argc, argv, &i))] = any_shape = true;
+		else if(!strcmp(argv[i], "--size")) size = strtoull(_value(argc, argv, &i), NULL, 10);
+		else if(!strcmp(argv[i], "--seed")) seed = strtoull(_value(argc, argv, &i), NULL, 10);
+		else if(!strcmp(argv[i], "--repeat")) repeat = strtoull(_value(argc, argv, &i), NULL, 10);
+		else if(!strcmp(argv[i], "--threads")) threads = strtoull(_value(argc, argv, &i), NULL, 10);
+		else if(!strcmp(argv[i], "--arena-ops")) arena_ops = strtoull(_value(argc, argv, &i), NULL, 10);
+		else if(!strcmp(argv[i], "--retain")) arena_set_retain(strtoull(_value(argc, argv, &i), NULL, 10));
+		else _usage("Unknown argument", argv[i]);
+	}
+	if(!any_shape) for(int shape = 0; shape < SHAPE_COUNT; shape++) shapes[shape] = true;
+	if(repeat == 0) repeat = 1;
+
+	if(generate) {
+		int shape = 0;
+		while(!shapes[shape]) shape++;
+		char *text = _generate((shape_t) shape, size, seed);
+		fputs(text, stdout);
+		free(text);
+		return EXIT_SUCCESS;
+	}
+
+	// a single thread by default, so that results compare across machines
+	lexer_t *lexer = lexer_new();
+	lexer_set_threads(lexer, threads);
+	for(int shape = 0; shape < SHAPE_COUNT; shape++) {
+		if(!shapes[shape]) continue;
+		// the lexer and the parser in processes of their own, so that the
+		// lexer's peak doesn't include the trees
+		for(int parse = 0; parse < 2; parse++) {
+			if(_fork()) {
+				_bench_frontend(lexer, parse, (shape_t) shape, size, seed, repeat);
+				exit(EXIT_SUCCESS);
+			}
+		}
+	}
+	lexer_free(lexer);
+	if(arena_ops && _fork()) {
+		_bench_arena(arena_ops, repeat, threads);
+		exit(EXIT_SUCCESS);
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,332 @@
+// Generates the lexer's lookup tables from the token definitions in tokens.h
+// and writes them to standard output. Run by `build.sh` ahead of the build as
+// `lexgen <table>`, its output lives in incl/lexer/<table>.c. The tables are:
+//   hashmap - the perfect hash that tells keywords apart from identifiers
+//   dfa     - the character classes and state machine that split tokens
+// Only ever runs on the build host.
+
+#include "lexer/tokens.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Keywords are compared as a single 64-bit word so they can't be longer
+#define MAX_KEYWORD_LEN 8
+#define MAX_SBOX_ATTEMPTS 1024
+// States and classes are stored as bytes
+#define MAX_DFA_STATES 256
+#define MAX_DFA_CLASSES 256
+
+typedef enum token_type {
+	FOREACH_TOKEN(GENERATE_ENUM)
+	TOKEN_COUNT
+} token_type_t;
+
+static const char *token_names[] = {
+	FOREACH_TOKEN(GENERATE_STRS)
+};
+
+typedef struct symbol {
+	const char *spelling;
+	token_type_t token;
+} symbol_t;
+
+#define GENERATE_SYMBOL(STR, VAL) { STR, TOK_##VAL },
+static const symbol_t symbols[] = {
+	FOREACH_SYMBOL(GENERATE_SYMBOL)
+};
+#undef GENERATE_SYMBOL
+
+// Every token whose name has one of these prefixes is spelled like the
+// lowercased rest of its name
+static const char *keyword_prefixes[] = { "KW_", "TYPE_" };
+
+typedef struct keyword {
+	char spelling[MAX_KEYWORD_LEN + 1];
+	size_t length;
+	token_type_t token;
+	uint8_t hash;
+} keyword_t;
+
+static keyword_t keywords[TOKEN_COUNT];
+static size_t keyword_count;
+
+// The permutation the lexer used before the tables were generated. Search
+// starts from it so that regenerating without keyword changes is stable.
+static uint8_t sbox[256] = {
+	0xeb, 0xce, 0x84, 0xe9, 0x3b, 0x49, 0x2a, 0x4e, 0x76, 0x9e, 0xaa, 0xf2, 0xfa, 0xa0, 0x74, 0xf0,
+	0x21, 0x3c, 0xb9, 0xd3, 0x24, 0x67, 0xfc, 0xae, 0xa2, 0x69, 0x2f, 0xe1, 0xbc, 0x7b, 0xb2, 0x77,
+	0xcd, 0x3e, 0x70, 0xf6, 0xde, 0x7f, 0x7c, 0xb5, 0x65, 0x63, 0x85, 0x8b, 0xc6, 0x0d, 0x15, 0xff,
+	0xa4, 0x79, 0xa9, 0x38, 0x7a, 0x10, 0x88, 0x61, 0xb1, 0x39, 0xe8, 0xbe, 0x8d, 0xbb, 0x5a, 0xe4,
+	0xcc, 0x3f, 0xb7, 0x04, 0xc8, 0x34, 0x44, 0xe5, 0x9b, 0xaf, 0x81, 0x4f, 0xc7, 0xc4, 0xd1, 0xc3,
+	0x1a, 0x9a, 0x31, 0x37, 0x56, 0x90, 0x1d, 0x55, 0x53, 0x41, 0x09, 0xba, 0x48, 0x2b, 0x54, 0x26,
+	0x9f, 0x82, 0x6b, 0x40, 0x08, 0xbf, 0xfd, 0xd8, 0x95, 0x89, 0xd6, 0xa3, 0xb4, 0x92, 0x42, 0x35,
+	0x64, 0xb3, 0x20, 0xe0, 0x73, 0xf5, 0x12, 0x59, 0xdd, 0x96, 0x25, 0x68, 0xc1, 0x03, 0x28, 0x80,
+	0x5b, 0x36, 0x19, 0xf4, 0xd5, 0x83, 0x6d, 0x29, 0xac, 0x6e, 0xf9, 0x66, 0x16, 0x7e, 0xc5, 0x99,
+	0x0c, 0xf7, 0x62, 0xf1, 0x1f, 0xd4, 0x71, 0x9d, 0xe6, 0x0a, 0x32, 0x3a, 0x2c, 0x0f, 0x45, 0xb6,
+	0x33, 0x50, 0x8c, 0xca, 0x8e, 0x87, 0xbd, 0xdf, 0x8a, 0xee, 0x91, 0x43, 0x75, 0x4b, 0xfb, 0x06,
+	0xea, 0x02, 0x6c, 0x7d, 0xd9, 0xec, 0xd7, 0x1b, 0x4c, 0xdb, 0x93, 0x3d, 0xc2, 0xa8, 0x9c, 0x23,
+	0xc0, 0x00, 0xef, 0x4a, 0x97, 0xc9, 0x18, 0x2e, 0x60, 0x27, 0x52, 0x30, 0x78, 0x5e, 0x11, 0xab,
+	0xe3, 0x17, 0x1e, 0x58, 0xfe, 0x22, 0xa7, 0xa6, 0x46, 0xed, 0x5c, 0xa1, 0x1c, 0xd0, 0x98, 0xad,
+	0xa5, 0x13, 0x51, 0x6a, 0xf8, 0x94, 0xe2, 0xd2, 0x01, 0x47, 0x05, 0x5d, 0x2d, 0x4d, 0x0e, 0x0b,
+	0xe7, 0xdc, 0xb0, 0x8f, 0x6f, 0xda, 0x14, 0xf3, 0xb8, 0x07, 0x72, 0x57, 0xcf, 0xcb, 0x86, 0x5f
+};
+
+// Internal Functions //
+
+static void _fail(const char *message, const char *detail) {
+	fprintf(stderr, "lexgen: %s%s\n", message, detail);
+	exit(EXIT_FAILURE);
+}
+
+static void _collect_keywords(void) {
+	size_t prefix_count = sizeof(keyword_prefixes) / sizeof(*keyword_prefixes);
+	for(size_t token = 0; token < TOKEN_COUNT; token++) {
+		for(size_t i = 0; i < prefix_count; i++) {
+			size_t prefix_len = strlen(keyword_prefixes[i]);
+			if(strncmp(token_names[token], keyword_prefixes[i], prefix_len)) continue;
+
+			const char *rest = &token_names[token][prefix_len];
+			keyword_t *keyword = &keywords[keyword_count++];
+			keyword->length = strlen(rest);
+			if(keyword->length == 0 || keyword->length > MAX_KEYWORD_LEN)
+				_fail("keyword has an unsupported length: ", token_names[token]);
+			for(size_t c = 0; c <= keyword->length; c++) {
+				char upper = rest[c];
+				keyword->spelling[c] = upper >= 'A' && upper <= 'Z' ? upper - 'A' + 'a' : upper;
+			}
+			keyword->token = (token_type_t) token;
+			break;
+		}
+	}
+	if(keyword_count >= 255) _fail("too many keywords for 8-bit slots", "");
+}
+
+// Hashes every keyword with the given seed, fails on the first collision
+static bool _try_seed(uint8_t seed) {
+	bool taken[256] = { false };
+	for(size_t i = 0; i < keyword_count; i++) {
+		uint8_t hash = seed;
+		for(size_t c = 0; c < keywords[i].length; c++)
+			hash = sbox[hash ^ (uint8_t) keywords[i].spelling[c]];
+		if(taken[hash]) return false;
+		taken[hash] = true, keywords[i].hash = hash;
+	}
+	return true;
+}
+
+// Deterministic xorshift so the output only depends on the keyword set
+static void _shuffle_sbox(uint32_t *state) {
+	for(size_t i = 255; i > 0; i--) {
+		*state ^= *state << 13, *state ^= *state >> 17, *state ^= *state << 5;
+		size_t j = *state % (i + 1);
+		uint8_t tmp = sbox[i];
+		sbox[i] = sbox[j], sbox[j] = tmp;
+	}
+}
+
+static uint8_t _find_seed(void) {
+	uint32_t state = 0x9e3779b9;
+	for(size_t attempt = 0; attempt < MAX_SBOX_ATTEMPTS; attempt++) {
+		for(unsigned seed = 0; seed < 256; seed++)
+			if(_try_seed((uint8_t) seed)) return (uint8_t) seed;
+		_shuffle_sbox(&state);
+	}
+	_fail("no collision-free keyword hash found", "");
+	return 0;
+}
+
+static void _emit_bytes(const uint8_t *bytes, size_t count, const char *format) {
+	for(size_t i = 0; i < count; i++) {
+		printf(i % 16 ? " " : "\t");
+		printf(format, bytes[i]);
+		printf(i == count - 1 ? "\n" : i % 16 == 15 ? ",\n" : ",");
+	}
+}
+
+static void _emit_header(const char *prefix, const char *lower_prefix) {
+	printf("// Generated by tools/lexgen.c from the token definitions in tokens.h.\n");
+	printf("// Do not edit, rerun `build.sh build` instead.\n\n");
+	printf("#include \"lexer.h\"\n\n#include <stdint.h>\n#include <string.h>\n\n");
+
+	printf("// Fails to compile if the condition doesn't hold\n");
+	printf("#define %s_CHECK(name, cond) typedef char %s_check_##name[(cond) ? 1 : -1]\n\n",
+		prefix, lower_prefix);
+	printf("#define %s_COUNT_TOKEN(VAL) + 1\n", prefix);
+	printf("%s_CHECK(token_count, 0 FOREACH_TOKEN(%s_COUNT_TOKEN) == %d);\n",
+		prefix, prefix, TOKEN_COUNT);
+	printf("#undef %s_COUNT_TOKEN\n\n", prefix);
+}
+
+static void _emit_hashmap(void) {
+	_collect_keywords();
+	uint8_t seed = _find_seed();
+	uint8_t slots[256];
+	memset(slots, (int) keyword_count, sizeof(slots));
+	for(size_t i = 0; i < keyword_count; i++) slots[keywords[i].hash] = (uint8_t) i;
+
+	_emit_header("MAP", "map");
+
+	printf("// Number of keywords, also the index of the slot that matches nothing\n");
+	printf("#define MAP_KEYWORDS %zu\n", keyword_count);
+	printf("// Initial value of the hash before any bytes are mixed in\n");
+	printf("#define MAP_SEED 0x%02x\n\n", seed);
+
+	printf("static const uint8_t map_sbox[256] = {\n");
+	_emit_bytes(sbox, 256, "0x%02x");
+	printf("};\n\n");
+
+	printf("// Maps a hash to the index of the only keyword that can have it\n");
+	printf("static const uint8_t map_slots[256] = {\n");
+	_emit_bytes(slots, 256, "%3u");
+	printf("};\n\n");
+
+	printf("// Zero padded so that they can be loaded as a single word\n");
+	printf("static const char map_keys[MAP_KEYWORDS + 1][8] = {\n");
+	for(size_t i = 0; i < keyword_count; i++) printf("\t\"%s\",\n", keywords[i].spelling);
+	printf("\t\"\"\n};\n\n");
+
+	printf("static const uint8_t map_lens[MAP_KEYWORDS + 1] = {\n\t");
+	for(size_t i = 0; i < keyword_count; i++) printf("%zu, ", keywords[i].length);
+	printf("0\n};\n\n");
+
+	printf("static const token_type_t map_vals[MAP_KEYWORDS + 1] = {\n");
+	for(size_t i = 0; i < keyword_count; i++)
+		printf("\tTOK_%s,\n", token_names[keywords[i].token]);
+	printf("\tTOK_IDENT\n};\n\n");
+
+	printf(
+		"/** Looks up whether the given identifier is a keyword.\n"
+		"  * @param content Pointer to the first character of the identifier.\n"
+		"  * @param count Length of the identifier.\n"
+		"  * @param hash The result of mixing every character of the identifier\n"
+		"  * into `MAP_SEED` using `hash = map_sbox[hash ^ c]`.\n"
+		"  * @return The keyword's token type or `TOK_IDENT` if it isn't one.\n"
+		"  */\n"
+		"static token_type_t map_lookup(const char *content, size_t count, uint8_t hash) {\n"
+		"\t// the slot that matches nothing has length zero, which no identifier has\n"
+		"\tuint8_t slot = map_slots[hash];\n"
+		"\tif(count != map_lens[slot]) return TOK_IDENT;\n"
+		"\tuint64_t word = 0, key;\n"
+		"\tmemcpy(&word, content, count);\n"
+		"\tmemcpy(&key, map_keys[slot], sizeof(key));\n"
+		"\treturn word == key ? map_vals[slot] : TOK_IDENT;\n"
+		"}\n\n"
+		"#undef MAP_CHECK\n");
+}
+
+// Fixed states, the symbol states follow after them
+enum { DFA_STOP, DFA_START, DFA_EOF, DFA_ERROR, DFA_IDENT, DFA_NUMBER, DFA_SYMBOLS };
+// Fixed classes, every symbol character gets its own class after them
+enum { CC_OTHER, CC_NUL, CC_DIGIT, CC_IDENT, CC_SYMBOLS };
+
+static uint8_t dfa_class[256];
+static size_t class_count = CC_SYMBOLS;
+static uint8_t dfa_next[MAX_DFA_STATES][MAX_DFA_CLASSES];
+static token_type_t dfa_accept[MAX_DFA_STATES];
+static size_t state_count = DFA_SYMBOLS;
+
+static void _build_classes(void) {
+	dfa_class[0] = CC_NUL;
+	for(unsigned c = '0'; c <= '9'; c++) dfa_class[c] = CC_DIGIT;
+	for(unsigned c = 'a'; c <= 'z'; c++) dfa_class[c] = CC_IDENT;
+	for(unsigned c = 'A'; c <= 'Z'; c++) dfa_class[c] = CC_IDENT;
+	dfa_class['_'] = CC_IDENT;
+
+	size_t symbol_count = sizeof(symbols) / sizeof(*symbols);
+	for(size_t i = 0; i < symbol_count; i++) {
+		for(const char *c = symbols[i].spelling; *c; c++) {
+			uint8_t byte = (uint8_t) *c;
+			if(dfa_class[byte] >= CC_SYMBOLS) continue;
+			if(dfa_class[byte] != CC_OTHER) _fail("symbol uses a reserved character: ", c);
+			if(class_count == MAX_DFA_CLASSES) _fail("too many symbol characters", "");
+			dfa_class[byte] = (uint8_t) class_count++;
+		}
+	}
+}
+
+static void _build_states(void) {
+	for(size_t i = 0; i < MAX_DFA_STATES; i++) dfa_accept[i] = TOK_ERROR;
+	dfa_accept[DFA_EOF] = TOK_EOF;
+	dfa_accept[DFA_IDENT] = TOK_IDENT;
+	dfa_accept[DFA_NUMBER] = TOK_LIT_NUM;
+
+	// anything unexpected becomes a single character error token
+	for(size_t c = 0; c < class_count; c++) dfa_next[DFA_START][c] = DFA_ERROR;
+	dfa_next[DFA_START][CC_NUL] = DFA_EOF;
+	dfa_next[DFA_START][CC_DIGIT] = DFA_NUMBER;
+	dfa_next[DFA_START][CC_IDENT] = DFA_IDENT;
+	dfa_next[DFA_IDENT][CC_DIGIT] = dfa_next[DFA_IDENT][CC_IDENT] = DFA_IDENT;
+	dfa_next[DFA_NUMBER][CC_DIGIT] = dfa_next[DFA_NUMBER][CC_IDENT] = DFA_NUMBER;
+
+	// the symbol states form a trie over the spellings
+	bool complete[MAX_DFA_STATES] = { false };
+	size_t symbol_count = sizeof(symbols) / sizeof(*symbols);
+	for(size_t i = 0; i < symbol_count; i++) {
+		size_t state = DFA_START;
+		for(const char *c = symbols[i].spelling; *c; c++) {
+			uint8_t class = dfa_class[(uint8_t) *c];
+			size_t next = dfa_next[state][class];
+			// the start state defaults to the error state instead of stopping
+			bool missing = state == DFA_START ? next == DFA_ERROR : next == DFA_STOP;
+			if(missing) {
+				if(state_count == MAX_DFA_STATES) _fail("too many symbol states", "");
+				next = state_count++;
+				dfa_next[state][class] = (uint8_t) next;
+			}
+			state = next;
+		}
+		if(complete[state]) _fail("symbol is spelled out twice: ", symbols[i].spelling);
+		complete[state] = true, dfa_accept[state] = symbols[i].token;
+	}
+
+	// without backtracking every state we pass through has to accept
+	for(size_t state = DFA_SYMBOLS; state < state_count; state++)
+		if(!complete[state]) _fail("a prefix of a symbol is not a symbol itself", "");
+}
+
+static void _emit_dfa(void) {
+	_build_classes();
+	_build_states();
+
+	_emit_header("DFA", "dfa");
+	printf("#define DFA_STATES %zu\n", state_count);
+	printf("#define DFA_CLASSES %zu\n", class_count);
+	printf("// Transitioning to this state means the token ended before the character\n");
+	printf("#define DFA_STOP %d\n", DFA_STOP);
+	printf("#define DFA_START %d\n\n", DFA_START);
+
+	printf("// Maps every character to its class\n");
+	printf("static const uint8_t dfa_class[256] = {\n");
+	_emit_bytes(dfa_class, 256, "%2u");
+	printf("};\n\n");
+
+	printf("// Indexed by the current state and the class of the next character\n");
+	printf("static const uint8_t dfa_next[DFA_STATES][DFA_CLASSES] = {\n");
+	for(size_t state = 0; state < state_count; state++) {
+		printf("\t{");
+		for(size_t c = 0; c < class_count; c++)
+			printf("%s%2u", c ? ", " : " ", dfa_next[state][c]);
+		printf(" }%s\n", state == state_count - 1 ? "" : ",");
+	}
+	printf("};\n\n");
+
+	printf("// The token type of a token that ends in the given state\n");
+	printf("static const token_type_t dfa_accept[DFA_STATES] = {\n");
+	for(size_t state = 0; state < state_count; state++)
+		printf("\tTOK_%s%s\n", token_names[dfa_accept[state]], state == state_count - 1 ? "" : ",");
+	printf("};\n\n");
+
+	printf("#undef DFA_CHECK\n");
+}
+
+int main(int argc, char **argv) {
+	if(argc != 2) _fail("usage: lexgen hashmap|dfa", "");
+	if(!strcmp(argv[1], "hashmap")) _emit_hashmap();
+	else if(!strcmp(argv[1], "dfa")) _emit_dfa();
+	else _fail("unknown table: ", argv[1]);
+	return fflush(stdout) ? EXIT_FAILURE : EXIT_SUCCESS;
+}